@@ -0,0 +1,101 @@
+#ifndef SANDCOUNTERRNG_H
+#define SANDCOUNTERRNG_H
+
+#include <cmath>
+#include <cstdint>
+
+// Counter-based random number generator.
+// A stream is identified by (run seed, event index, subsystem, channel) and
+// the n-th number of the stream is a hash of the key and of n. The numbers
+// drawn for a given channel of a given event are then independent of the
+// processing order, of the thread and of the other events, so that a single
+// event can be re-digitized alone with bit-identical output.
+class SANDCounterRNG
+{
+ public:
+  enum class Subsystem : uint64_t {
+    kT0 = 1,
+    kECAL = 2,
+    kSTT = 3,
+    kDrift = 4,
+    kTrackFinding = 5  // smearing of the truth based track finding
+  };
+
+  SANDCounterRNG(uint64_t run_seed, uint64_t event_index, Subsystem subsystem,
+                 int64_t channel)
+      : _counter(0)
+  {
+    _key = mix(run_seed);
+    _key = mix(_key ^ event_index);
+    _key = mix(_key ^ static_cast<uint64_t>(subsystem));
+    _key = mix(_key ^ static_cast<uint64_t>(channel));
+  }
+
+  // uniform in (0, 1)
+  double Uniform()
+  {
+    uint64_t r = mix(_key ^ mix(++_counter));
+    // 53 random bits, shifted by half a step to exclude 0 and 1
+    return ((r >> 11) + 0.5) * (1.0 / 9007199254740992.0);
+  }
+
+  // gaussian (Box-Muller)
+  double Gaus(double mean = 0., double sigma = 1.)
+  {
+    double u1 = Uniform();
+    double u2 = Uniform();
+    return mean + sigma * std::sqrt(-2. * std::log(u1)) *
+                      std::cos(2. * M_PI * u2);
+  }
+
+  // poisson: multiplication method for small mean, transformed rejection
+  // (Hormann, PTRS) otherwise
+  int Poisson(double mean)
+  {
+    if (mean <= 0.) return 0;
+
+    if (mean < 10.) {
+      double limit = std::exp(-mean);
+      double prod = Uniform();
+      int n = 0;
+      while (prod > limit) {
+        prod *= Uniform();
+        n++;
+      }
+      return n;
+    }
+
+    double smu = std::sqrt(mean);
+    double b = 0.931 + 2.53 * smu;
+    double a = -0.059 + 0.02483 * b;
+    double inv_alpha = 1.1239 + 1.1328 / (b - 3.4);
+    double vr = 0.9277 - 3.6224 / (b - 2.);
+
+    while (true) {
+      double u = Uniform() - 0.5;
+      double v = Uniform();
+      double us = 0.5 - std::fabs(u);
+      double k = std::floor((2. * a / us + b) * u + mean + 0.43);
+      if (us >= 0.07 && v <= vr) return static_cast<int>(k);
+      if (k < 0. || (us < 0.013 && v > us)) continue;
+      if (std::log(v) + std::log(inv_alpha) - std::log(a / (us * us) + b) <=
+          -mean + k * std::log(mean) - std::lgamma(k + 1.))
+        return static_cast<int>(k);
+    }
+  }
+
+ private:
+  uint64_t _key;
+  uint64_t _counter;
+
+  // splitmix64 finalizer
+  static uint64_t mix(uint64_t x)
+  {
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+  }
+};
+
+#endif
@@ -1,6 +1,7 @@
 #include <TRandom3.h>
 
 #include "utils.h"
+#include "SANDCounterRNG.h"
 
 #ifndef SANDDIGITIZATION
 #define SANDDIGITIZATION
@@ -19,15 +20,61 @@ enum class ECAL_digi_mode {
   fixed_thresh
 };
 
-extern TRandom3 rand;
+// generator used by the FLUKA digitization (one per thread)
+extern thread_local TRandom3 rand;
+
+// key of the counter-based random streams used by the edep-sim
+// digitization: run seed (set once) and index of the event being
+// digitized by this thread (see digitization::edep_sim::digitize_event)
+extern unsigned int run_seed;
+extern thread_local int event_index;
+
+// store the full list of photo-electrons in dg_ps (debugging)
+extern bool store_photo_electrons;
 
 namespace ecal
 {
+// photo-electrons of an event as struct of arrays: one entry per
+// photo-electron with the id of the pmt (channel), the arrival time and
+// the index of the hit that produced it
+struct photo_electron_buffer {
+  std::vector<int> channel;
+  std::vector<double> time;
+  std::vector<int> h_index;
+
+  // after sort(): entries ordered by channel and then by time, the
+  // photo-electrons of channels[k] being in [offsets[k], offsets[k+1])
+  std::vector<int> channels;
+  std::vector<unsigned int> offsets;
+
+  void clear();
+  void reserve(unsigned int n);
+  unsigned int size() const { return time.size(); }
+  void push_back(int ch, double t, int h)
+  {
+    channel.push_back(ch);
+    time.push_back(t);
+    h_index.push_back(h);
+  }
+  void sort();
+};
+
+// fill the photo-electron summary of the signal (and the full list if
+// store_photo_electrons is set)
+void set_photo_electrons(dg_ps& signal, const std::vector<pe>& photo_el);
+
 double photo_electron_time_to_pmt_arrival_time(double t0, double d);
+double photo_electron_time_to_pmt_arrival_time(double t0, double d,
+                                               SANDCounterRNG& rng);
 
 void eval_adc_and_tdc_from_photo_electrons(
     std::map<int, std::vector<pe> >& photo_el,
     std::map<int, std::vector<dg_ps> >& map_pmt, ECAL_digi_mode ecal_digi_mode);
+
+// same as above, running over the channel segments of a sorted buffer
+void eval_adc_and_tdc_from_photo_electrons(
+    const photo_electron_buffer& photo_el,
+    std::map<int, std::vector<dg_ps> >& map_pmt, ECAL_digi_mode ecal_digi_mode);
 }  // namespace ecal
 
 }  // namespace digitization
@@ -3,6 +3,7 @@
 #include "TG4Event.h"
 #include "TG4HitSegment.h"
 
+#include "SANDDigitization.h"
 #include "SANDGeoManager.h"
 #include "struct.h"
 
@@ -12,8 +13,6 @@
 namespace digitization
 {
 
-enum class ECAL_digi_mode;
-
 namespace edep_sim
 {
 
@@ -27,7 +26,7 @@ bool process_hit(const SANDGeoManager& g, const TG4HitSegment& hit, int& detID,
                  double& t, double& de);
 
 void simulate_photo_electrons(TG4Event* ev, const SANDGeoManager& g,
-                              std::map<int, std::vector<pe> >& photo_el,
+                              digitization::ecal::photo_electron_buffer& photo_el,
                               std::map<int, double>& L);
 
 void group_pmts_in_cells(const SANDGeoManager& geo,
@@ -79,9 +78,16 @@ void digitize_wire(TG4Event* ev, const SANDGeoManager& geo,
                    std::vector<dg_wire>& wire_digits);
 }  // namespace chamber
 
+// digitize a single event
+void digitize_event(TG4Event* ev, int event_index, SANDGeoManager& sand_geo,
+                    bool is_stt, ECAL_digi_mode ecal_digi_mode,
+                    std::vector<dg_cell>& vec_cell,
+                    std::vector<dg_wire>& wire_digits);
+
 // digitize event
+// nthreads > 1: events are digitized in parallel and written in input order
 void digitize(const char* finname, const char* foutname,
-              ECAL_digi_mode ecal_digi_mode);
+              ECAL_digi_mode ecal_digi_mode, int nthreads = 1);
 
 }  // namespace edep_sim
 
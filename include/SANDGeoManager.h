@@ -8,7 +8,11 @@
 #include <TVector3.h>
 #include <TG4HitSegment.h>
 
+#include <algorithm>
+#include <cstdint>
 #include <map>
+#include <string>
+#include <unordered_map>
 
 #ifndef SANDGEOMANAGER_H
 #define SANDGEOMANAGER_H
@@ -125,6 +129,13 @@ class SANDGeoManager : public TObject
   std::map<int, SANDECALCellInfo> cellmap_;  // map of ecal cell (key: id,
                                              // value: info on cell)
 
+  // ECAL cell neighbour table: ECAL cells numbered in cellmap_ order, the
+  // neighbours of the cell i are the indices
+  // ecal_neighbours_[ecal_neighbour_offsets_[i] .. ecal_neighbour_offsets_[i+1])
+  std::vector<int> ecal_cell_ids_;                  //!
+  std::vector<std::size_t> ecal_neighbour_offsets_; //!
+  std::vector<std::size_t> ecal_neighbours_;        //!
+
   std::map<SANDWireID, SANDWireInfo> wiremap_;  // map of wire (key : id, value:
                                           // info on wire)
 
@@ -138,6 +149,40 @@ class SANDGeoManager : public TObject
   std::vector<SANDTrackerPlane> _planes;
   std::map<SANDTrackerPlaneID, plane_iterator> _id_to_plane;
 
+  // flat cell lookup index used by get_stt_tube_id: one entry per plane,
+  // sorted by z_min, pointing to a contiguous range of the cell arrays
+  // (sorted by transverse coordinate). Built once in init().
+  struct CellLookupPlane {
+    double z_min;
+    double z_max;
+    double z_max_running;  // max of z_max over this and previous entries
+    double x;
+    double y;
+    double z;
+    double cos_rot;
+    double sin_rot;
+    std::size_t first_cell;
+    std::size_t last_cell;  // one past the end
+  };
+  std::vector<CellLookupPlane> _cell_lookup_planes;     //!
+  std::vector<double> _cell_lookup_transverse;          //!
+  std::vector<double> _cell_lookup_z;                   //!
+  std::vector<SANDTrackerCellID> _cell_lookup_id;       //!
+
+  // dense cell index: cells numbered contiguously, ordered by plane (as in
+  // _planes) and by transverse coordinate
+  std::vector<std::map<SANDTrackerCellID, SANDTrackerCell>::const_iterator>
+      _index_to_cell;                                   //!
+  std::vector<SANDTrackerPlaneIndex> _cell_index_to_plane;  //!
+  std::unordered_map<unsigned long, std::size_t> _cell_id_to_index;  //!
+
+  // CSR cell adjacency: one row per dense cell index. The ids adjacent to
+  // the cell r are _adjacency_ids[_adjacency_offsets[r] .. _adjacency_offsets[r+1])
+  std::vector<std::size_t> _adjacency_offsets;          //!
+  std::vector<SANDTrackerCellID> _adjacency_ids;        //!
+  // same rows, dense indices of the adjacent cells
+  std::vector<SANDTrackerCellIndex> _adjacency_indices; //!
+
   mutable TPRegexp stt_tube_regex_{
       sand_geometry::stt::stt_single_tube_regex_string};  // regular expression
                                                           // to match relevant
@@ -209,11 +254,30 @@ class SANDGeoManager : public TObject
                                      const TGeoNode* const node,
                                      int& cell_local_id) const;
   void set_ecal_info();
+  void build_ecal_neighbours();
 
   void set_wire_info();
 
+  void build_cell_index();
   void fill_adjacent_cells(std::string geometry);
+  void link_adjacent_cells();
   void rearrange_planes();
+  void build_cell_lookup();
+  SANDTrackerCellID get_closest_cell_in_lookup(const CellLookupPlane& p,
+                                               double x, double y, double z,
+                                               double& distance) const;
+
+  // binary cache of ECAL cells, planes, cells and adjacency, keyed by a
+  // hash of the TGeo geometry (see SANDGeoManagerCache.cpp)
+  static bool rebuild_geo_cache_;
+  static uint64_t compute_geometry_hash(TGeoManager* const geo);
+  static std::string get_cache_file_name(uint64_t hash);
+  bool read_cache(const std::string& fname, uint64_t hash);
+  void write_cache(const std::string& fname, uint64_t hash) const;
+
+  // TPRegexp compiles its pattern on the first match: compile all of them
+  // in init(), before the manager is shared between threads
+  void compile_regexes() const;
 
   std::vector<TVector2> getLocalLinePlaneIntersections(const TVector2& local_2d_position,
                                                        const SANDTrackerPlane& plane);
@@ -257,6 +321,13 @@ class SANDGeoManager : public TObject
   {
   }
   void init(TGeoManager* const geo);
+  // tracker tables (planes, dense cell index, adjacency) of planes already
+  // filled with their cells, without a TGeo geometry. For the synthetic
+  // geometries of the tests; geometry is "STT" or "DRIFT" as in init()
+  void init_tracker(const std::vector<SANDTrackerPlane>& planes,
+                    const std::string& geometry = "DRIFT");
+  // force init() to rebuild the geometry cache instead of loading it
+  static void SetRebuildGeoCache(bool rebuild) { rebuild_geo_cache_ = rebuild; }
   void SetGeoCurrentPoint(double x, double y, double z) const;
   void SetGeoCurrentDirection(double x, double y, double z) const;
   void InitVolume(volume& v) const;
@@ -272,12 +343,65 @@ class SANDGeoManager : public TObject
     return cellmap_.at(ecal_cell_id);
   }
   std::map<SANDTrackerCellID, SANDTrackerCell>::const_iterator get_cell_info(SANDTrackerCellID cell_id) const;
+  // dense cell index access
+  std::size_t get_n_cells() const
+  {
+    return _index_to_cell.size();
+  }
+  SANDTrackerCellIndex get_cell_index(SANDTrackerCellID cell_id) const
+  {
+    return SANDTrackerCellIndex(_cell_id_to_index.at(cell_id()));
+  }
+  const SANDTrackerCell& get_cell(SANDTrackerCellIndex cell_index) const
+  {
+    return _index_to_cell[cell_index()]->second;
+  }
+  SANDTrackerCellID get_cell_id(SANDTrackerCellIndex cell_index) const
+  {
+    return _index_to_cell[cell_index()]->first;
+  }
+  SANDTrackerPlaneIndex get_cell_plane_index(SANDTrackerCellIndex cell_index) const
+  {
+    return _cell_index_to_plane[cell_index()];
+  }
+  const SANDTrackerCellIndex* get_adjacent_cells_begin(SANDTrackerCellIndex cell_index) const
+  {
+    return _adjacency_indices.data() + _adjacency_offsets[cell_index()];
+  }
+  const SANDTrackerCellIndex* get_adjacent_cells_end(SANDTrackerCellIndex cell_index) const
+  {
+    return _adjacency_indices.data() + _adjacency_offsets[cell_index() + 1];
+  }
   plane_iterator get_plane_info(SANDTrackerCellID cell_id) const;
   plane_iterator get_plane_info(SANDTrackerPlaneID unique_plane_id) const;
   const std::map<int, SANDECALCellInfo>& get_ecal_cell_info() const
   {
     return cellmap_;
   }
+  // dense ECAL cell index (-1 if the id is not an ECAL cell) and neighbours
+  std::size_t get_n_ecal_cells() const
+  {
+    return ecal_cell_ids_.size();
+  }
+  int get_ecal_cell_index(int ecal_cell_id) const
+  {
+    auto it = std::lower_bound(ecal_cell_ids_.begin(), ecal_cell_ids_.end(),
+                               ecal_cell_id);
+    if (it == ecal_cell_ids_.end() || *it != ecal_cell_id) return -1;
+    return it - ecal_cell_ids_.begin();
+  }
+  int get_ecal_cell_id(std::size_t ecal_cell_index) const
+  {
+    return ecal_cell_ids_[ecal_cell_index];
+  }
+  const std::size_t* get_ecal_neighbours_begin(std::size_t ecal_cell_index) const
+  {
+    return ecal_neighbours_.data() + ecal_neighbour_offsets_[ecal_cell_index];
+  }
+  const std::size_t* get_ecal_neighbours_end(std::size_t ecal_cell_index) const
+  {
+    return ecal_neighbours_.data() + ecal_neighbour_offsets_[ecal_cell_index + 1];
+  }
   const std::map<SANDWireID, SANDWireInfo>& get_wire_info() const
   {
     return wiremap_;
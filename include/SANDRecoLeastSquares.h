@@ -0,0 +1,187 @@
+#ifndef SANDRECOLEASTSQUARES_H
+#define SANDRECOLEASTSQUARES_H
+
+#include <vector>
+
+#include "SANDRecoUtils.h"
+
+/*
+    Least squares fit of the drift radii: each model provides the
+    residuals (r_estimated - r_observed) / sigma of the fired wires
+    and their analytic derivatives with respect to the parameters.
+    The minimization is a Levenberg-Marquardt (damped Gauss-Newton)
+    iteration that stops as soon as the chi2 and the parameters are
+    stable.
+*/
+class SANDRecoLeastSquaresModel
+{
+    public:
+        virtual ~SANDRecoLeastSquaresModel() {}
+
+        virtual unsigned int NParameters() const = 0;
+        virtual unsigned int NResiduals() const = 0;
+
+        // fill residuals (NResiduals) and jacobian (NResiduals x
+        // NParameters, row major) at the parameters p
+        virtual void Evaluate(const double* p, double* residuals,
+                              double* jacobian) const = 0;
+};
+
+struct SANDRecoLeastSquaresResult
+{
+    bool                converged;
+    int                 status; // 0 if converged, 4 if failed (as TMinuit)
+    int                 n_iterations;
+    double              chi2;
+    std::vector<double> errors;
+
+    SANDRecoLeastSquaresResult()
+        : converged(false), status(4), n_iterations(0), chi2(-999.), errors() {}
+};
+
+class SANDRecoLeastSquares
+{
+    public:
+        SANDRecoLeastSquares() {}
+
+        void SetMaxIterations(int n) {_max_iterations = n;};
+        // relative chi2 change and relative parameter step below which
+        // the fit is converged
+        void SetTolerance(double tolerance) {_tolerance = tolerance;};
+
+        void FixParameter(unsigned int i);
+        // the parameter is clamped to [lower, upper] after each step
+        void SetParameterLimits(unsigned int i, double lower, double upper);
+        // all the parameters free and unbounded
+        void ReleaseParameters();
+
+        // parameters holds the starting point and is updated with the
+        // result. The workspace is kept between calls, so the same object
+        // can be reused for all the tracks of a run without allocations.
+        // With fewer residuals than free parameters the damping still
+        // leads to a point of the valley of minima, the errors are left 0
+        bool Minimize(const SANDRecoLeastSquaresModel& model,
+                      std::vector<double>& parameters,
+                      SANDRecoLeastSquaresResult& result);
+
+    private:
+        int                 _max_iterations = 100;
+        double              _tolerance = 1E-6;
+
+        std::vector<char>   _fixed;
+        std::vector<double> _lower;
+        std::vector<double> _upper;
+
+        // workspace
+        std::vector<unsigned int> _free;
+        std::vector<double> _residuals;
+        std::vector<double> _jacobian;
+        std::vector<double> _trial_residuals;
+        std::vector<double> _trial_jacobian;
+        std::vector<double> _trial;
+        std::vector<double> _alpha;
+        std::vector<double> _beta;
+        std::vector<double> _matrix;
+        std::vector<double> _step;
+
+        void Resize(unsigned int n_parameters);
+        void Clamp(std::vector<double>& parameters) const;
+        void Normal(unsigned int n_residuals, unsigned int n_parameters);
+        bool Solve(unsigned int n, double lambda);
+        bool Invert(unsigned int n);
+};
+
+/*
+    Circle in the ZY plane fitted to the horizontal wires
+    p = (zc, yc, R)
+*/
+class SANDRecoDriftCircleModel : public SANDRecoLeastSquaresModel
+{
+    public:
+        SANDRecoDriftCircleModel(const std::vector<dg_wire*>& wires, double sigma)
+            : wires_(wires), sigma_(sigma) {}
+
+        unsigned int NParameters() const override {return 3;};
+        unsigned int NResiduals() const override {return wires_.size();};
+        void Evaluate(const double* p, double* residuals,
+                      double* jacobian) const override;
+
+    private:
+        const std::vector<dg_wire*>& wires_;
+        double sigma_;
+};
+
+/*
+    Line z = m * x + q in the XZ plane fitted to the vertical wires
+    p = (m, q)
+*/
+class SANDRecoDriftLineModel : public SANDRecoLeastSquaresModel
+{
+    public:
+        SANDRecoDriftLineModel(const std::vector<dg_wire*>& wires, double sigma)
+            : wires_(wires), sigma_(sigma) {}
+
+        unsigned int NParameters() const override {return 2;};
+        unsigned int NResiduals() const override {return wires_.size();};
+        void Evaluate(const double* p, double* residuals,
+                      double* jacobian) const override;
+
+    private:
+        const std::vector<dg_wire*>& wires_;
+        double sigma_;
+};
+
+/*
+    z = A sin(B x + C) + D in the XZ plane fitted to the vertical wires
+    p = (A, B, C, D). The point of the curve closest to each wire is found
+    with a few Newton steps
+*/
+class SANDRecoDriftSinModel : public SANDRecoLeastSquaresModel
+{
+    public:
+        SANDRecoDriftSinModel(const std::vector<dg_wire*>& wires, double sigma)
+            : wires_(wires), sigma_(sigma) {}
+
+        unsigned int NParameters() const override {return 4;};
+        unsigned int NResiduals() const override {return wires_.size();};
+        void Evaluate(const double* p, double* residuals,
+                      double* jacobian) const override;
+
+    private:
+        const std::vector<dg_wire*>& wires_;
+        double sigma_;
+};
+
+/*
+    Helix fitted to the drift radii of all the wires
+    p = (R, dip, Phi0, h, x0, y0, z0), as Helix::SetHelixParam.
+    h must be kept fixed
+*/
+class SANDRecoDriftHelixModel : public SANDRecoLeastSquaresModel
+{
+    public:
+        SANDRecoDriftHelixModel(const std::vector<dg_wire>& wires, double sigma)
+            : wires_(wires), sigma_(sigma)
+        {
+            for(const auto& wire : wires_) wire_arrays_.Add(wire);
+            impact_parameters_.resize(wires_.size());
+            s_.resize(wires_.size());
+            t_.resize(wires_.size());
+        }
+
+        unsigned int NParameters() const override {return 7;};
+        unsigned int NResiduals() const override {return wires_.size();};
+        void Evaluate(const double* p, double* residuals,
+                      double* jacobian) const override;
+
+    private:
+        const std::vector<dg_wire>& wires_;
+        double sigma_;
+        WireArrays wire_arrays_;
+        // closest approach of the last evaluation
+        mutable std::vector<double> impact_parameters_;
+        mutable std::vector<double> s_;
+        mutable std::vector<double> t_;
+};
+
+#endif
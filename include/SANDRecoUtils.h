@@ -779,6 +779,21 @@ class Line : public SANDWireInfo
   ClassDef(Line, 1);
 };
 
+/*
+    wires of a track as structure of arrays (center, unit direction and
+    half length) for the batch helix - wire distance
+*/
+struct WireArrays
+{
+    std::vector<double> ax, ay, az;
+    std::vector<double> dx, dy, dz;
+    std::vector<double> half_length;
+
+    void Add(const dg_wire& wire);
+    void Clear();
+    unsigned int Size() const {return ax.size();};
+};
+
 namespace RecoUtils
 {  // RecoUtils
 
@@ -810,6 +825,11 @@ double GetMinImpactParameter(const Helix& helix, const Line& line);
 double GetMinImpactParameter(const Helix& helix, const Line& line,
                              double& s_min, double& t_min, bool& HasMinimized);
 
+// impact parameter, helix parameter s and distance t of the closest point
+// from the wire center of all the wires
+void GetMinImpactParameters(const Helix& helix, const WireArrays& wires,
+                            double* impact_parameters, double* s, double* t);
+
 double NewtonRaphson2D(TF1* f, TF1* fprime, double& x_guess, double tol,
                        unsigned int max_iterations);
 
@@ -835,8 +855,13 @@ Helix               GetHelixFromCircleLine(const Circle& circle,
                                            const Helix& true_helix,
                                            TVector3& momentum);
 
-const double* GetHelixParameters(const Helix& helix_initial_guess,
-                                 int& TMinuitStatus);
+std::vector<double> GetHelixParameters(const Helix& helix_initial_guess,
+                                       int& TMinuitStatus);
+
+// reentrant version: fit of the given digits
+std::vector<double> GetHelixParameters(const Helix& helix_initial_guess,
+                                       const std::vector<dg_wire>& digits,
+                                       int& TMinuitStatus);
 
 dg_wire Copy(const dg_wire& wire);
 
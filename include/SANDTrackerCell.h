@@ -1,6 +1,7 @@
 #pragma once
 
 #include "SANDWireInfo.h"
+#include "TVector2.h"
 
 class SANDTrackerPlane;
 
@@ -11,6 +12,15 @@ class SANDTrackerCellID : public SingleElStruct<unsigned long>
   SANDTrackerCellID() : SingleElStruct<unsigned long>(){};
 };
 
+// dense cell index: position of the cell in the contiguous numbering built
+// by SANDGeoManager (planes ordered by z, cells by transverse coordinate)
+class SANDTrackerCellIndex : public SingleElStruct<unsigned long>
+{
+ public:
+  SANDTrackerCellIndex(unsigned long id) : SingleElStruct<unsigned long>(id){};
+  SANDTrackerCellIndex() : SingleElStruct<unsigned long>(){};
+};
+
 class SANDTrackerCell
 {
   SANDTrackerCellID _id;
@@ -23,7 +33,13 @@ class SANDTrackerCell
   bool _isFired;
 
   SANDTrackerPlane* _plane;
-  std::vector<SANDTrackerCell*> _adjacent_cells;
+
+  // range of the ids of the adjacent cells, stored contiguously in the
+  // CSR adjacency array owned by SANDGeoManager
+  const SANDTrackerCellID* _adjacent_begin = nullptr;  //!
+  const SANDTrackerCellID* _adjacent_end = nullptr;    //!
+
+  TVector2 _rotated_wire_position;  // wire center in the plane rotated frame
 
  public:
   SANDTrackerCell() {};
@@ -127,6 +143,14 @@ class SANDTrackerCell
   {
     return _driftVelocity;
   }
+  void rotatedWirePosition(const TVector2& p)
+  {
+    _rotated_wire_position = p;
+  }
+  const TVector2& rotatedWirePosition() const
+  {
+    return _rotated_wire_position;
+  }
 
   double evaluateDriftRadius() const
   {
@@ -136,18 +160,20 @@ class SANDTrackerCell
       return -1;
   }
 
-  void addAdjacentCell(SANDTrackerCell* adj_cell);
-  const std::vector<SANDTrackerCell*> getAdjacentCell() const {return _adjacent_cells;};
+  void setAdjacentCells(const SANDTrackerCellID* begin,
+                        const SANDTrackerCellID* end)
+  {
+    _adjacent_begin = begin;
+    _adjacent_end = end;
+  }
+  const SANDTrackerCellID* adjacentCellsBegin() const {return _adjacent_begin;};
+  const SANDTrackerCellID* adjacentCellsEnd() const {return _adjacent_end;};
+  std::size_t nAdjacentCells() const {return _adjacent_end - _adjacent_begin;};
 
   bool isAdjacent(const SANDTrackerCellID& adj_id) const {
-    if (std::find_if(_adjacent_cells.begin(), 
-                    _adjacent_cells.end(), 
-                    [&adj_id](SANDTrackerCell* cell)
-                    { return (cell->id() == adj_id) ? true : false; })
-      != _adjacent_cells.end()) {
-        return true;
-    } else {
-      return false;
+    for (auto it = _adjacent_begin; it != _adjacent_end; ++it) {
+      if (*it == adj_id) return true;
     }
+    return false;
   }
 };
@@ -23,13 +23,12 @@ class SANDTrackerCluster
 
   const SANDGeoManager* _sand_geo;
 
-  static SANDTrackerClusterID fCounter;
-
 
  public:
   SANDTrackerCluster() = default;
-  SANDTrackerCluster(const SANDGeoManager* sand_geo, std::vector<SANDTrackerDigitID> &digits);
-  SANDTrackerCluster(const SANDGeoManager* sand_geo, std::vector<SANDTrackerDigitID> &digits, plane_iterator plane);
+  // id: unique in the container of the cluster, which assigns it
+  SANDTrackerCluster(SANDTrackerClusterID id, const SANDGeoManager* sand_geo, std::vector<SANDTrackerDigitID> &digits);
+  SANDTrackerCluster(SANDTrackerClusterID id, const SANDGeoManager* sand_geo, std::vector<SANDTrackerDigitID> &digits, plane_iterator plane);
   enum class RecoAlgo { ELikelihood, EMinuit };
   inline SANDTrackerClusterID GetId() const { return fId; };
   inline plane_iterator GetPlane() const {return fPlane;};
@@ -52,7 +51,6 @@ class SANDTrackerCluster
   inline const std::vector<SANDTrackerDigitID> &GetDigits() const { return fDigits; };
   void GetExtendedCluster(int offset);
   inline const std::vector<SANDTrackerDigitID> &GetExtendedDigits() const { return fDigits_extended; };
-  static void ResetCounter() { fCounter = 0; };
 
   friend class SANDTrackerClustersInPlane;
 };
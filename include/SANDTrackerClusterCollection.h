@@ -12,13 +12,17 @@ class SANDTrackerClusterCollection
   public:
   enum class ClusteringMethod {
     kProximityInPlane,
-    kCellAdjacency
+    kCellAdjacency,
+    kConnectedComponents,
+    kCellularAutomaton
   };
-  SANDTrackerClusterCollection(const SANDGeoManager* sand_geo, const std::vector<SANDTrackerDigit> &digits, ClusteringMethod clu_method);
+  SANDTrackerClusterCollection(const SANDGeoManager* sand_geo, const SANDTrackerDigitCollection &digits, ClusteringMethod clu_method);
   ~SANDTrackerClusterCollection(){};
 
-  void ClusterProximityInPlane(const std::vector<SANDTrackerDigit>& digits);
-  void ClusterCellAdjacency(const std::vector<SANDTrackerDigit>& digits);
+  void ClusterProximityInPlane(const SANDTrackerDigitCollection& digits);
+  void ClusterCellAdjacency(const SANDTrackerDigitCollection& digits);
+  void ClusterConnectedComponents(const SANDTrackerDigitCollection& digits);
+  void ClusterCellularAutomaton(const SANDTrackerDigitCollection& digits);
   inline const ClustersContainer* GetClustersInContainerByIndex(const int& index) const
   {
     return containers.at(index);
@@ -17,15 +17,24 @@ class ClustersContainer
   private:
     std::vector<SANDTrackerCluster> fClusters;
     const SANDGeoManager* _sand_geo;
+    const SANDTrackerDigitCollection* _digit_collection = nullptr;
     SANDTrackerClustersContainerID _id;
+    // id of the next cluster. Per container: a container is filled by one
+    // thread and RemoveCluster only looks for ids in its own clusters
+    unsigned long _next_cluster_id = 0;
   
   public:
     virtual void Clusterize(const std::vector<SANDTrackerDigitID> &digits) = 0;
     virtual ~ClustersContainer(){};
     ClustersContainer() {};
-    ClustersContainer(const SANDGeoManager* sand_geo, SANDTrackerClustersContainerID id) : _sand_geo(sand_geo), _id(id) {};
+    ClustersContainer(const SANDGeoManager* sand_geo, const SANDTrackerDigitCollection& digit_collection, SANDTrackerClustersContainerID id) 
+      : _sand_geo(sand_geo), _digit_collection(&digit_collection), _id(id) {};
 
-    virtual const SANDTrackerCluster &GetNearestCluster(double x, double y) const = 0;
+    // cluster with the digit closest to (x, y), the digits in the rotated
+    // frame of their planes. Scans all the digits of all the clusters, ties
+    // go to the first cluster. Throws std::out_of_range if the container
+    // has no clusters
+    virtual const SANDTrackerCluster &GetNearestCluster(double x, double y) const;
     void AddCluster(const SANDTrackerCluster &clu) { fClusters.push_back(clu); };
 
 
@@ -33,6 +42,12 @@ class ClustersContainer
     {
       return _sand_geo;
     }
+
+    // digits of the event the clusters are made of
+    const SANDTrackerDigitCollection& getDigitCollection() const 
+    {
+      return *_digit_collection;
+    }
    
     inline const SANDTrackerClustersContainerID GetId() {return _id;};
     
@@ -47,6 +62,7 @@ class ClustersContainer
     inline TVector2 GetDigitCoord(const SANDTrackerDigit *dg) const;
 
   protected:
+    SANDTrackerClusterID NewClusterId() { return SANDTrackerClusterID(_next_cluster_id++); };
     void RemoveCluster(SANDTrackerClusterID cid)
     {
       auto it =
@@ -57,42 +73,88 @@ class ClustersContainer
     };
 };
 
+// clusters of adjacent fired cells (cell adjacency graph). In
+// kConnectedSubsets mode every connected set of cluster_size fired cells
+// is a cluster, each set exactly once; in kConnectedComponents mode each
+// connected component of the fired cells is a cluster
 class SANDTrackerClustersByProximity : public ClustersContainer
 {
+ public:
+  enum class Mode {
+    kConnectedSubsets,
+    kConnectedComponents
+  };
+
  private:
+  Mode _mode = Mode::kConnectedSubsets;
+  unsigned int _cluster_size = 3;
+
   void Clusterize(const std::vector<SANDTrackerDigitID> &digits) override;
 
  public:
   SANDTrackerClustersByProximity() {};
-  SANDTrackerClustersByProximity(const SANDGeoManager* sand_geo, const SANDTrackerClustersContainerID &id) : ClustersContainer(sand_geo, id) {};
-  SANDTrackerClustersByProximity(const SANDGeoManager* sand_geo, const SANDTrackerClustersContainerID &id, const std::vector<SANDTrackerDigitID> &digits) 
-    : ClustersContainer(sand_geo, id)
+  SANDTrackerClustersByProximity(const SANDGeoManager* sand_geo, const SANDTrackerDigitCollection& digit_collection, const SANDTrackerClustersContainerID &id) : ClustersContainer(sand_geo, digit_collection, id) {};
+  SANDTrackerClustersByProximity(const SANDGeoManager* sand_geo, const SANDTrackerDigitCollection& digit_collection, const SANDTrackerClustersContainerID &id, const std::vector<SANDTrackerDigitID> &digits,
+                                 Mode mode = Mode::kConnectedSubsets, unsigned int cluster_size = 3) 
+    : ClustersContainer(sand_geo, digit_collection, id), _mode(mode), _cluster_size(cluster_size)
   {
     Clusterize(digits);
   };
   ~SANDTrackerClustersByProximity(){};
-  
-  bool IsPermutation(const std::vector<SANDTrackerDigitID>& clu);
-  const SANDTrackerCluster &GetNearestCluster(double x, double y) const override;
-  void findCluster(std::vector<SANDTrackerDigitID>& current_cluster, 
-                                                 std::map<SANDTrackerCellID, SANDTrackerDigitID>::iterator it, 
-                                                 std::map<SANDTrackerCellID, SANDTrackerDigitID>& fMap, 
-                                                 int cluster_size);
 };
 
+// track candidates from a cellular automaton on the cell adjacency graph.
+// Segments join adjacent fired cells of two planes with the same
+// orientation; the state of a segment is the length of the longest chain
+// of compatible segments ending on it and the longest chains are
+// extracted first
+class SANDTrackerClustersByCellularAutomaton : public ClustersContainer
+{
+ private:
+  // max change of direction (in the plane measuring coordinate VS z)
+  // between consecutive segments. Large, since the cells of a straight
+  // track in staggered planes zigzag
+  double _max_angle = 0.8;  // rad
+  unsigned int _min_cells = 3;
+
+  void Clusterize(const std::vector<SANDTrackerDigitID> &digits) override;
+
+ public:
+  SANDTrackerClustersByCellularAutomaton() {};
+  SANDTrackerClustersByCellularAutomaton(const SANDGeoManager* sand_geo, const SANDTrackerDigitCollection& digit_collection, const SANDTrackerClustersContainerID &id) : ClustersContainer(sand_geo, digit_collection, id) {};
+  SANDTrackerClustersByCellularAutomaton(const SANDGeoManager* sand_geo, const SANDTrackerDigitCollection& digit_collection, const SANDTrackerClustersContainerID &id, const std::vector<SANDTrackerDigitID> &digits) 
+    : ClustersContainer(sand_geo, digit_collection, id)
+  {
+    Clusterize(digits);
+  };
+  ~SANDTrackerClustersByCellularAutomaton(){};
+};
+
+// clusters of adjacent fired cells of a plane. The container id is the
+// dense plane index
 class SANDTrackerClustersInPlane : public ClustersContainer
 {
  private:
     plane_iterator fPlane;
     void Clusterize(const std::vector<SANDTrackerDigitID> &digits) override;
 
+    // digits of the clusters in the rotated frame of the plane, ordered by
+    // transverse coordinate (Y), with the index of their cluster. Built
+    // once after the clusterization
+    std::vector<double> fDigitY;
+    std::vector<double> fDigitX;
+    std::vector<unsigned int> fDigitCluster;
+    void BuildIndex();
+    int NearestClusterIndex(double x, double y, std::size_t start) const;
+
  public:
   SANDTrackerClustersInPlane() {};
-  SANDTrackerClustersInPlane(const SANDGeoManager* sand_geo, const SANDTrackerClustersContainerID &id) : ClustersContainer(sand_geo, id), fPlane(getSandGeoManager()->get_plane_info(SANDTrackerPlaneID(id()))) {};
-  SANDTrackerClustersInPlane(const SANDGeoManager* sand_geo, const SANDTrackerClustersContainerID &id, const std::vector<SANDTrackerDigitID> &digits) 
-    : ClustersContainer(sand_geo, id), fPlane(getSandGeoManager()->get_plane_info(SANDTrackerPlaneID(id())))
+  SANDTrackerClustersInPlane(const SANDGeoManager* sand_geo, const SANDTrackerDigitCollection& digit_collection, const SANDTrackerClustersContainerID &id) : ClustersContainer(sand_geo, digit_collection, id), fPlane(getSandGeoManager()->get_planes().cbegin() + id()) {};
+  SANDTrackerClustersInPlane(const SANDGeoManager* sand_geo, const SANDTrackerDigitCollection& digit_collection, const SANDTrackerClustersContainerID &id, const std::vector<SANDTrackerDigitID> &digits) 
+    : ClustersContainer(sand_geo, digit_collection, id), fPlane(getSandGeoManager()->get_planes().cbegin() + id())
   {
     Clusterize(digits);
+    BuildIndex();
   };
   ~SANDTrackerClustersInPlane(){};
 
@@ -105,6 +167,11 @@ class SANDTrackerClustersInPlane : public ClustersContainer
     return fPlane->getPosition().Z();
   };
   
+  // cluster with the digit closest to (x, y), in the rotated frame of the
+  // plane. Throws std::out_of_range if the plane has no clusters
   const SANDTrackerCluster &GetNearestCluster(double x, double y) const override;  
+  // nearest cluster of n positions (rotated frame of the plane) at once:
+  // indices in GetClusters(), -1 if the plane has no clusters
+  void GetNearestClusters(std::size_t n, const double* x, const double* y, int* clusters) const;
 };
 #endif
\ No newline at end of file
@@ -6,6 +6,9 @@
 
 #include <TTreeReader.h>
 
+#include <utility>
+#include <vector>
+
 // digit id -> dg_wire.did
 class SANDTrackerDigitID : public SingleElStruct<unsigned long>
 {
@@ -25,47 +28,64 @@ class SANDTrackerDigitIndex : public SingleElStruct<unsigned long>
 // SANDTrackerDigit
 using SANDTrackerDigit = dg_wire;
 
-// Digit map: key: digit id; value: index in gTreeReaderDigit
-using SANDTrackerDigitMap = std::map<SANDTrackerDigitID, SANDTrackerDigitIndex>;
-
 /**********************************************
- * Class to read and access digits (SANDTrackerDigit)
- * from the input tree through a TTreeReaderValue
+ * Digits (SANDTrackerDigit) of one event.
+ * The collection is a view of the input vector,
+ * which must outlive it, plus an index sorted by
+ * digit id. It is not modified after Fill, so it
+ * can be shared by threads and a collection per
+ * event allows several events in flight
  ***********************************************/
 class SANDTrackerDigitCollection
 {
  private:
-  // vector of SANDTrackerDigits
-  static std::vector<SANDTrackerDigit> SANDfgTrackerDigits;
+  // digits of the event (not owned)
+  const std::vector<SANDTrackerDigit>* _digits = nullptr;
+
+  // (digit id, index in _digits) sorted by id. A repeated id gives the
+  // last digit with that id
+  std::vector<std::pair<unsigned long, SANDTrackerDigitIndex>> _id_to_index;
 
-  // digit map -> key: digit id; value: index in gTreeReaderDigit
-  static SANDTrackerDigitMap fgMapDigit;
+  // dense cell index of each digit (filled only when a geometry is given)
+  std::vector<SANDTrackerCellIndex> _digit_cell_index;
 
  public:
-  SANDTrackerDigitCollection(){};
+  SANDTrackerDigitCollection(const std::vector<SANDTrackerDigit>& digits,
+                             const SANDGeoManager* sand_geo = nullptr)
+  {
+    Fill(digits, sand_geo);
+  };
   ~SANDTrackerDigitCollection(){};
 
-  // fill digit map
-  static void FillMap(const std::vector<SANDTrackerDigit>* digits)
+  // view the digits and build the index
+  void Fill(const std::vector<SANDTrackerDigit>& digits,
+            const SANDGeoManager* sand_geo = nullptr);
+
+  // get digit vector
+  const std::vector<SANDTrackerDigit> &GetDigits() const
   {
-    SANDfgTrackerDigits = *digits;
-    for (auto i = 0u; i < SANDfgTrackerDigits.size(); i++) {
-      fgMapDigit[SANDTrackerDigitID(static_cast<unsigned long>(
-          SANDfgTrackerDigits.at(i).did))] = SANDTrackerDigitIndex(i);
-    }
+    return *_digits;
   };
 
-  // get digit vector
-  static const std::vector<SANDTrackerDigit> &GetDigits()
+  // get digit by its id, throws std::out_of_range if not found
+  const SANDTrackerDigit &GetDigit(const SANDTrackerDigitID &id) const
+  {
+    return (*_digits)[GetDigitIndex(id)()];
+  };
+
+  // get digit by its index
+  const SANDTrackerDigit &GetDigit(const SANDTrackerDigitIndex &index) const
   {
-    return SANDfgTrackerDigits;
+    return (*_digits)[index()];
   };
 
-  // get i-th digit
-  static const SANDTrackerDigit &GetDigit(const SANDTrackerDigitID &id)
+  // get index of a digit, throws std::out_of_range if not found
+  SANDTrackerDigitIndex GetDigitIndex(const SANDTrackerDigitID &id) const;
+
+  // get dense cell index of a digit
+  SANDTrackerCellIndex GetDigitCellIndex(const SANDTrackerDigitIndex &index) const
   {
-    // std::cout << "DIGIT COLLECTION: " << id() << " " << fgMapDigit[id]() << std::endl;
-    return SANDfgTrackerDigits.at(fgMapDigit[id]());
+    return _digit_cell_index.at(index());
   };
 };
 
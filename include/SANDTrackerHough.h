@@ -0,0 +1,63 @@
+#pragma once
+
+#include "struct.h"
+
+#include <cstdint>
+#include <vector>
+
+// Hough transform pattern recognition of the tracker digits.
+// In the bending plane (zy, horizontal wires) each drift circle votes for
+// the circles (curvature, phi, impact parameter) tangent to it; in the xz
+// view (vertical wires) for the tangent lines, i.e. the zero curvature
+// slice (phi, impact parameter) of the same accumulator. Peaks are
+// extracted iteratively: the digits compatible with the highest peak form
+// a candidate and their votes are removed before searching the next one.
+// Cost is O(digits x bins) per view
+class SANDTrackerHough
+{
+ public:
+  SANDTrackerHough(){};
+  ~SANDTrackerHough(){};
+
+  void SetCurvatureBins(int n, double max_curvature)
+  {
+    _n_curvature = n;
+    _max_curvature = max_curvature;
+  };
+  void SetPhiBins(int n) {_n_phi = n;};
+  void SetImpactBinWidth(double w) {_impact_bin_width = w;};
+  void SetMinDigits(unsigned int n) {_min_digits = n;};
+
+  // groups of indices of digits (horizontal ones in groupsY, vertical ones
+  // in groupsX), largest first. radii are the drift radii of the digits
+  // (0 if unknown); an empty vector means all unknown
+  void FindTracks(const std::vector<dg_wire>& digits,
+                  const std::vector<double>& radii,
+                  std::vector<std::vector<int> >& groupsY,
+                  std::vector<std::vector<int> >& groupsX) const;
+
+  // drift radii for FindTracks from the tdc of the digits: drift time is
+  // tdc - t0 for the straw tubes and tdc - t_hit for the drift chamber,
+  // whose digits have no t0 (t_hit is the hit time used as measured by
+  // the NLL fit). The propagation time along the wire is not subtracted:
+  // below 0.5 mm, well within an impact parameter bin. 0 when unknown
+  static std::vector<double> DriftRadii(const std::vector<dg_wire>& digits,
+                                        double v_drift);
+
+ private:
+  int _n_curvature = 33;
+  double _max_curvature = 2E-3;     // 1/mm: pt ~ 0.1 GeV in 0.6 T
+  int _n_phi = 180;
+  double _impact_bin_width = 10.;   // mm
+  unsigned int _min_digits = 4;
+
+  struct Point {
+    int digit;
+    double u;  // z
+    double v;  // y or x
+    double r;  // drift radius
+  };
+
+  void Find(std::vector<Point>& points, int n_curvature, double max_curvature,
+            std::vector<std::vector<int> >& groups) const;
+};
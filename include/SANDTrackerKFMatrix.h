@@ -0,0 +1,154 @@
+#ifndef SANDTrackerKFMATRIX_H
+#define SANDTrackerKFMATRIX_H
+
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <utility>
+
+// fixed size row-major matrix stored on the stack, used for the states,
+// covariances and jacobians of the Kalman filter. Vectors are matrices
+// with one column
+template <std::size_t R, std::size_t C>
+class SANDTrackerKFMatrix
+{
+  std::array<double, R * C> _m;
+
+ public:
+  SANDTrackerKFMatrix()
+  {
+    _m.fill(0.);
+  }
+  static SANDTrackerKFMatrix Identity()
+  {
+    static_assert(R == C, "identity of a non square matrix");
+    SANDTrackerKFMatrix m;
+    for (std::size_t i = 0; i < R; i++) m(i, i) = 1.;
+    return m;
+  }
+  static constexpr std::size_t Rows()
+  {
+    return R;
+  }
+  static constexpr std::size_t Cols()
+  {
+    return C;
+  }
+
+  double& operator()(std::size_t i, std::size_t j)
+  {
+    return _m[i * C + j];
+  }
+  double operator()(std::size_t i, std::size_t j) const
+  {
+    return _m[i * C + j];
+  }
+  // element access for vectors
+  double& operator()(std::size_t i)
+  {
+    return _m[i];
+  }
+  double operator()(std::size_t i) const
+  {
+    return _m[i];
+  }
+
+  SANDTrackerKFMatrix<C, R> T() const
+  {
+    SANDTrackerKFMatrix<C, R> t;
+    for (std::size_t i = 0; i < R; i++)
+      for (std::size_t j = 0; j < C; j++) t(j, i) = (*this)(i, j);
+    return t;
+  }
+
+  SANDTrackerKFMatrix& operator+=(const SANDTrackerKFMatrix& o)
+  {
+    for (std::size_t i = 0; i < R * C; i++) _m[i] += o._m[i];
+    return *this;
+  }
+  SANDTrackerKFMatrix& operator-=(const SANDTrackerKFMatrix& o)
+  {
+    for (std::size_t i = 0; i < R * C; i++) _m[i] -= o._m[i];
+    return *this;
+  }
+  SANDTrackerKFMatrix& operator*=(double s)
+  {
+    for (auto& v : _m) v *= s;
+    return *this;
+  }
+  SANDTrackerKFMatrix operator+(const SANDTrackerKFMatrix& o) const
+  {
+    return SANDTrackerKFMatrix(*this) += o;
+  }
+  SANDTrackerKFMatrix operator-(const SANDTrackerKFMatrix& o) const
+  {
+    return SANDTrackerKFMatrix(*this) -= o;
+  }
+  SANDTrackerKFMatrix operator*(double s) const
+  {
+    return SANDTrackerKFMatrix(*this) *= s;
+  }
+
+  // restore the symmetry lost by rounding in the covariance updates
+  void Symmetrize()
+  {
+    static_assert(R == C, "symmetrization of a non square matrix");
+    for (std::size_t i = 0; i < R; i++)
+      for (std::size_t j = i + 1; j < C; j++) {
+        double v = 0.5 * ((*this)(i, j) + (*this)(j, i));
+        (*this)(i, j) = v;
+        (*this)(j, i) = v;
+      }
+  }
+
+  // Gauss-Jordan inversion with partial pivoting. Returns false if the
+  // matrix is singular
+  bool Invert(SANDTrackerKFMatrix& inv) const
+  {
+    static_assert(R == C, "inversion of a non square matrix");
+    SANDTrackerKFMatrix a(*this);
+    inv = Identity();
+    for (std::size_t c = 0; c < C; c++) {
+      std::size_t pivot = c;
+      for (std::size_t r = c + 1; r < R; r++)
+        if (std::fabs(a(r, c)) > std::fabs(a(pivot, c))) pivot = r;
+      if (a(pivot, c) == 0.) return false;
+      if (pivot != c) {
+        for (std::size_t j = 0; j < C; j++) {
+          std::swap(a(c, j), a(pivot, j));
+          std::swap(inv(c, j), inv(pivot, j));
+        }
+      }
+      double d = 1. / a(c, c);
+      for (std::size_t j = 0; j < C; j++) {
+        a(c, j) *= d;
+        inv(c, j) *= d;
+      }
+      for (std::size_t r = 0; r < R; r++) {
+        if (r == c || a(r, c) == 0.) continue;
+        double f = a(r, c);
+        for (std::size_t j = 0; j < C; j++) {
+          a(r, j) -= f * a(c, j);
+          inv(r, j) -= f * inv(c, j);
+        }
+      }
+    }
+    return true;
+  }
+};
+
+template <std::size_t R, std::size_t K, std::size_t C>
+SANDTrackerKFMatrix<R, C> operator*(const SANDTrackerKFMatrix<R, K>& a,
+                                    const SANDTrackerKFMatrix<K, C>& b)
+{
+  SANDTrackerKFMatrix<R, C> m;
+  for (std::size_t i = 0; i < R; i++)
+    for (std::size_t k = 0; k < K; k++) {
+      double aik = a(i, k);
+      if (aik == 0.) continue;
+      for (std::size_t j = 0; j < C; j++) m(i, j) += aik * b(k, j);
+    }
+  return m;
+}
+
+#endif
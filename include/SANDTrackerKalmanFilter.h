@@ -0,0 +1,95 @@
+#pragma once
+
+#include "SANDTrackerUtils.h"
+#include "struct.h"
+
+#include <vector>
+
+// one measurement site of the Kalman filter: a digit measuring x (vertical
+// wire) or y (horizontal wire) at the z of its wire
+struct SANDTrackerKFSite
+{
+  int digit;           // index of the digit in the fitted collection
+  bool hor;            // true if the digit measures y
+  double z;
+  double measurement;
+  double sigma;
+
+  SANDTrackerKFStateVector predicted;
+  SANDTrackerKFStateVector filtered;
+  SANDTrackerKFStateVector smoothed;
+  SANDTrackerKFStateCovarianceMatrix predicted_cov;
+  SANDTrackerKFStateCovarianceMatrix filtered_cov;
+  SANDTrackerKFStateCovarianceMatrix smoothed_cov;
+  // transport from the previous site
+  SANDTrackerKFStateCovarianceMatrix jacobian;
+
+  double chi2;            // contribution of the site to the filter chi2
+  double residual;        // smoothed residual
+  double residual_sigma;  // error of the smoothed residual
+};
+
+struct SANDTrackerKFResult
+{
+  bool ok = false;
+  double chi2 = 0.;
+  int ndf = 0;
+  std::vector<SANDTrackerKFSite> sites;  // ordered by z
+};
+
+// Kalman filter and Rauch-Tung-Striebel smoother of the tracks in the
+// uniform magnetic field of SAND (along x). The state (x, y, tx, ty, q/p)
+// is transported in z with a Runge-Kutta integration, the jacobian being
+// integrated with the same steps; the multiple scattering in the material
+// of each crossed plane is added as process noise. The iterations after
+// the first linearize around the smoothed trajectory. Units: mm, GeV
+class SANDTrackerKalmanFilter
+{
+ public:
+  SANDTrackerKalmanFilter(){};
+  ~SANDTrackerKalmanFilter(){};
+
+  void SetSigmaPosition(double sp) {_sigma_pos = sp;};
+  void SetPlaneThicknessInX0(double t) {_plane_x0 = t;};
+  void SetParticleMassInGeV(double m) {_mass = m;};
+  void SetMaxStep(double s) {_max_step = s;};
+  void SetNIterations(int n) {_n_iterations = n;};
+
+  // fit the digits, in any order. Returns false if the digits are not
+  // enough to constrain the state or the filter fails
+  bool Fit(const std::vector<dg_wire>& digits, SANDTrackerKFResult& result) const;
+
+  // transport a state from z_from to z_to; the jacobian is evaluated if
+  // required
+  void Propagate(const SANDTrackerKFStateVector& state, double z_from,
+                 double z_to, SANDTrackerKFStateVector& out,
+                 SANDTrackerKFStateCovarianceMatrix* jacobian = nullptr) const;
+
+  // multiple scattering covariance of the slopes after crossing a plane
+  SANDTrackerKFStateCovarianceMatrix MultipleScattering(
+      const SANDTrackerKFStateVector& state) const;
+
+ private:
+  double _sigma_pos = 2. * SANDTrackerUtils::GetTubeRadius() / sqrt(12.);
+  // material of a tracker plane (straws, wires and gas)
+  double _plane_x0 = 2.5E-3;
+  // particles assumed to be muons
+  double _mass = 0.10566;
+  double _max_step = 50.;
+  int _n_iterations = 3;
+
+  // above this momentum the scattering is evaluated at the maximum
+  const double _max_momentum = 100.;
+
+  // Runge-Kutta transport, with the jacobian integrated along if required
+  void Transport(SANDTrackerKFStateVector& state, double dz,
+                 SANDTrackerKFStateCovarianceMatrix* jacobian = nullptr) const;
+  void Seed(const std::vector<SANDTrackerKFSite>& sites,
+            SANDTrackerKFStateVector& state) const;
+  // use_reference: transport linearized around the smoothed states of the
+  // sites (previous iteration)
+  bool Filter(std::vector<SANDTrackerKFSite>& sites,
+              const SANDTrackerKFStateVector& seed, bool use_reference,
+              double& chi2) const;
+  bool Smooth(std::vector<SANDTrackerKFSite>& sites) const;
+};
@@ -2,6 +2,7 @@
 #include "SANDTrackerCell.h"
 #include <vector>
 #include <map>
+#include <cmath>
 class SANDTrackerModule;
 
 class SANDTrackerPlaneID : public SingleElStruct<unsigned long>
@@ -33,6 +34,8 @@ class SANDTrackerPlane
   SANDTrackerPlaneID _unique_id;
   SANDTrackerPlaneID _local_id;
   double _rotation; //rad, mano destra su z
+  double _cos_rotation = 1.;
+  double _sin_rotation = 0.;
   TVector3 _position;
   TVector3 _dimension;
   std::map<double, SANDTrackerCellID> _coord_to_id_map;
@@ -99,7 +102,30 @@ class SANDTrackerPlane
   SANDTrackerModule* getModule() const {return _module;} ;
   void setPosition(TVector3 p)  { _position  = p;};
   void setDimension(TVector3 d) { _dimension = d;};
-  void setRotation(double r) {_rotation = r;};
+  void setRotation(double r) {_rotation = r; _cos_rotation = cos(r); _sin_rotation = sin(r);};
+  double getCosRotation() const {return _cos_rotation;} ;
+  double getSinRotation() const {return _sin_rotation;} ;
+
+  // global xy <-> plane rotated frame (translation + rotation) using the
+  // cached sin/cos of the plane
+  TVector2 globalToRotated(const TVector2& global) const
+  {
+    double lx = global.X() - _position.X();
+    double ly = global.Y() - _position.Y();
+    return TVector2( lx * _cos_rotation + ly * _sin_rotation,
+                    -lx * _sin_rotation + ly * _cos_rotation);
+  }
+  TVector2 rotatedToGlobal(const TVector2& rotated) const
+  {
+    return TVector2(rotated.X() * _cos_rotation - rotated.Y() * _sin_rotation + _position.X(),
+                    rotated.X() * _sin_rotation + rotated.Y() * _cos_rotation + _position.Y());
+  }
+  // batch versions: n points given as arrays of coordinates
+  void globalToRotated(std::size_t n, const double* x, const double* y, double* rx, double* ry) const;
+  void rotatedToGlobal(std::size_t n, const double* rx, const double* ry, double* x, double* y) const;
+
+  // cache the rotated position of the wires of the cells
+  void computeRotatedWirePositions();
 };
 
 using plane_iterator = std::vector<SANDTrackerPlane>::const_iterator;
@@ -10,11 +10,15 @@
 #include "utils.h"
 
 #include "SANDTrackerDigitCollection.h"
+#include "SANDTrackerKFMatrix.h"
 // #include "SANDTrackerStrawTubeTracker.h"
 // #include "SANDTrackerKFKalmanFilter.h"
 
-using SANDTrackerKFStateCovarianceMatrix = TMatrixD;
-using SANDTrackerKFMeasurement = TMatrixD;
+// Kalman filter state (x, y, tx = dx/dz, ty = dy/dz, q/p) and its
+// covariance; each digit measures one coordinate
+using SANDTrackerKFStateVector = SANDTrackerKFMatrix<5, 1>;
+using SANDTrackerKFStateCovarianceMatrix = SANDTrackerKFMatrix<5, 5>;
+using SANDTrackerKFMeasurement = SANDTrackerKFMatrix<1, 1>;
 
 #define IS_VERBOSE false
 
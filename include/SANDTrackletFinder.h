@@ -12,9 +12,6 @@
 #include "TBox.h"
 
 
-#include <Math/Factory.h>
-#include <Math/Minimizer.h>
-#include <Math/Functor.h>
 #include <TCanvas.h>
 #include <TPolyLine3D.h>
 #include <TLine.h>
@@ -22,6 +19,7 @@
 #include <SANDTrackerCell.h>
 #include "SANDTrackerCluster.h"
 #include "SANDTrackerDigitCollection.h"
+#include "SANDRecoLeastSquares.h"
 
 #include <CLine3D.h>
 #include "utils.h"
@@ -30,6 +28,11 @@
 #include "iostream"
 #include "math.h"
 
+/*
+  Finds the tracklets of one cluster at a time. The geometry and the
+  digits are only read: independent instances can process different
+  clusters concurrently
+*/
 class TrackletFinder {
   public:
     TrackletFinder() {};
@@ -40,7 +43,14 @@ class TrackletFinder {
     void SetSigmaAngle(double sa)    {_sigma_ang = sa;};
     void SetCells(const SANDTrackerCluster& cluster) {_cluster = cluster;};
     void SetTrajectory(TVector3 tp, TVector3 td)     {_trajectory = CLine3D(tp, td);};
-    void SetDigitCollection(SANDTrackerDigitCollection* digit_collection) {_digit_collection = digit_collection;};
+    // digits of the event, read only
+    void SetDigitCollection(const SANDTrackerDigitCollection& digit_collection) {_digit_collection = &digit_collection;};
+    // (subdivisions + 1)^4 points of the coarse scan
+    void SetGridSubdivisions(int n) {_grid_subdivisions = n;};
+    // number of basins of the coarse scan that are refined
+    void SetMaxSeeds(unsigned int n) {_max_seeds = n;};
+    // minima closer than this (mm, rad) are the same tracklet
+    void SetMergeTolerance(double position, double angle) {_merge_position = position; _merge_angle = angle;};
 
     bool CheckParallel(TVector3 d1, TVector3 d2);
     void LinesParallelToWire(CLine3D w, double distance, std::vector<CLine3D>& lines);
@@ -51,6 +61,8 @@ class TrackletFinder {
 
     const std::map<SANDTrackerDigitID, double>& GetDigitToDriftTimeMap() const {return _digitId_to_drift_time;};
 
+    // minima (x, y, theta_xz, theta_yz, MinimizingFunction) of the
+    // cluster, sorted by increasing MinimizingFunction
     std::vector<TVectorD> FindTracklets();
 
     void Clear();
@@ -63,7 +75,7 @@ class TrackletFinder {
 
   private:
     SANDTrackerCluster _cluster;
-    SANDTrackerDigitCollection* _digit_collection;
+    const SANDTrackerDigitCollection* _digit_collection = nullptr;
     std::map<SANDTrackerDigitID, double> _digitId_to_drift_time;
     CLine3D _trajectory;
 
@@ -76,6 +88,12 @@ class TrackletFinder {
     int* _volume_parameters;
     TVector3 _mean_point_3d;
 
+    int          _grid_subdivisions = 8;
+    unsigned int _max_seeds = 8;
+    double       _merge_position = 0.1; // mm
+    double       _merge_angle = 1E-3; // rad
+    SANDRecoLeastSquares _fitter;
+
     TCanvas* _c2 = nullptr;
     TCanvas* _c3 = nullptr;
 
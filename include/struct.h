@@ -37,6 +37,13 @@ struct dg_ps
   int side;
   double adc;
   double tdc;
+  // summary of the photo-electrons of the signal
+  int pe_count = 0;
+  double pe_first_time = 1e9;
+  double pe_last_time = 1e9;
+  std::vector<int> h_index;         // hits contributing to the signal
+  std::vector<int> h_multiplicity;  // number of p.e. from each hit
+  // full list of photo-electrons: filled only on request (Digitize -full_pe)
   std::vector<pe> photo_el;
 };
 
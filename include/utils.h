@@ -14,7 +14,8 @@
 
 namespace sand_reco
 {
-extern std::map<int, double> t0;
+// t0 of the current event (one table per thread)
+extern thread_local std::map<int, double> t0;
 
 namespace stt
 {
@@ -81,12 +82,14 @@ const double tm_stt_smearing = 3.5;   // ns
 double getT(double y1, double y2, double y, double z1, double z2, double z);
 bool isDigBefore(dg_wire d1, dg_wire d2);
 bool isDigUpstream(const dg_wire& d1, const dg_wire& d2);
-void initT0(TG4Event* ev, SANDGeoManager& geo);
+void initT0(TG4Event* ev, SANDGeoManager& geo, unsigned int run_seed,
+            int event_index);
 }  // namespace stt
 
 namespace chamber
 {
-void initT0(TG4Event* ev, SANDGeoManager& geo);
+void initT0(TG4Event* ev, SANDGeoManager& geo, unsigned int run_seed,
+            int event_index);
 }  // namespace chamber
 
 namespace ecal
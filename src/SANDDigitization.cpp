@@ -2,17 +2,128 @@
 
 #include "utils.h"
 
+#include <algorithm>
 #include <iostream>
+#include <unordered_map>
 
 using namespace sand_reco;
 
 namespace digitization
 {
 
-TRandom3 rand(0);
+thread_local TRandom3 rand(0);
+
+unsigned int run_seed = 0;
+thread_local int event_index = 0;
+
+bool store_photo_electrons = false;
 
 namespace ecal
 {
+void photo_electron_buffer::clear()
+{
+  channel.clear();
+  time.clear();
+  h_index.clear();
+  channels.clear();
+  offsets.clear();
+}
+
+void photo_electron_buffer::reserve(unsigned int n)
+{
+  channel.reserve(n);
+  time.reserve(n);
+  h_index.reserve(n);
+}
+
+// segmented sort: counting sort by channel, then sort by time within
+// each channel segment. The slot of each photo-electron is found in one
+// pass; only the distinct channels are sorted
+void photo_electron_buffer::sort()
+{
+  const unsigned int n = size();
+
+  // slots in order of first appearance
+  std::unordered_map<int, unsigned int> channel_slot;
+  std::vector<unsigned int> slot(n);
+  channels.clear();
+  for (unsigned int i = 0; i < n; i++) {
+    auto it = channel_slot.emplace(channel[i], channels.size()).first;
+    if (it->second == channels.size()) channels.push_back(channel[i]);
+    slot[i] = it->second;
+  }
+
+  // renumber the slots by increasing channel
+  std::vector<unsigned int> rank(channels.size());
+  for (unsigned int k = 0; k < channels.size(); k++) rank[k] = k;
+  std::sort(rank.begin(), rank.end(), [this](unsigned int k1, unsigned int k2) {
+    return channels[k1] < channels[k2];
+  });
+  std::vector<unsigned int> sorted_slot(channels.size());
+  std::vector<int> sorted_channels(channels.size());
+  for (unsigned int k = 0; k < channels.size(); k++) {
+    sorted_slot[rank[k]] = k;
+    sorted_channels[k] = channels[rank[k]];
+  }
+  channels.swap(sorted_channels);
+
+  offsets.assign(channels.size() + 1, 0);
+  for (unsigned int i = 0; i < n; i++) {
+    slot[i] = sorted_slot[slot[i]];
+    offsets[slot[i] + 1]++;
+  }
+  for (unsigned int k = 0; k < channels.size(); k++)
+    offsets[k + 1] += offsets[k];
+
+  // order[j] = index of the photo-electron in position j
+  std::vector<unsigned int> order(n);
+  std::vector<unsigned int> fill(offsets.begin(), offsets.end() - 1);
+  for (unsigned int i = 0; i < n; i++) order[fill[slot[i]]++] = i;
+
+  for (unsigned int k = 0; k < channels.size(); k++) {
+    std::sort(order.begin() + offsets[k], order.begin() + offsets[k + 1],
+              [this](unsigned int i1, unsigned int i2) {
+                return time[i1] < time[i2] ||
+                       (time[i1] == time[i2] && i1 < i2);
+              });
+  }
+
+  std::vector<int> sorted_channel(n);
+  std::vector<double> sorted_time(n);
+  std::vector<int> sorted_h_index(n);
+  for (unsigned int j = 0; j < n; j++) {
+    sorted_channel[j] = channel[order[j]];
+    sorted_time[j] = time[order[j]];
+    sorted_h_index[j] = h_index[order[j]];
+  }
+  channel.swap(sorted_channel);
+  time.swap(sorted_time);
+  h_index.swap(sorted_h_index);
+}
+
+void set_photo_electrons(dg_ps& signal, const std::vector<pe>& photo_el)
+{
+  signal.pe_count = photo_el.size();
+  signal.h_index.clear();
+  signal.h_multiplicity.clear();
+
+  if (!photo_el.empty()) {
+    auto minmax = std::minmax_element(photo_el.begin(), photo_el.end(),
+                                      sand_reco::ecal::isPeBefore);
+    signal.pe_first_time = minmax.first->time;
+    signal.pe_last_time = minmax.second->time;
+  }
+
+  std::map<int, int> multiplicity;
+  for (const auto& p : photo_el) multiplicity[p.h_index]++;
+  for (const auto& m : multiplicity) {
+    signal.h_index.push_back(m.first);
+    signal.h_multiplicity.push_back(m.second);
+  }
+
+  if (store_photo_electrons) signal.photo_el = photo_el;
+}
+
 // simulate pe arrival time to pmt
 double photo_electron_time_to_pmt_arrival_time(double t0, double d)
 {
@@ -54,6 +165,19 @@ C                      + 1ns  uncertainty
   return time;
 }
 
+// same as above, drawing from the counter-based stream of the pmt
+double photo_electron_time_to_pmt_arrival_time(double t0, double d,
+                                               SANDCounterRNG& rng)
+{
+  double tdec = sand_reco::ecal::scintillation::tscin *
+                TMath::Power(1. / rng.Uniform() - 1.,
+                             sand_reco::ecal::scintillation::tscex);
+
+  return t0 + tdec +
+         sand_reco::ecal::scintillation::vlfb * d * conversion::mm_to_m +
+         rng.Gaus();
+}
+
 // from simulated pe produce adc e tdc of calo cell
 void eval_adc_and_tdc_from_photo_electrons(
     std::map<int, std::vector<pe> >& photo_el,
@@ -124,7 +248,7 @@ void eval_adc_and_tdc_from_photo_electrons(
           }
           signal.tdc = it->second[index].time;
 
-          signal.photo_el = photo_el_digit;
+          set_photo_electrons(signal, photo_el_digit);
           map_pmt[it->first].push_back(signal);
         }
         // get ready for next digiit
@@ -142,11 +266,93 @@ void eval_adc_and_tdc_from_photo_electrons(
       index = int(sand_reco::ecal::acquisition::costant_fraction * pe_count) +
               start_index;
       signal.tdc = it->second[index].time;
-      signal.photo_el = photo_el_digit;
+      set_photo_electrons(signal, photo_el_digit);
       map_pmt[it->first].push_back(signal);
     }
   }
 }
+
+void eval_adc_and_tdc_from_photo_electrons(
+    const photo_electron_buffer& photo_el,
+    std::map<int, std::vector<dg_ps> >& map_pmt, ECAL_digi_mode ecal_digi_mode)
+{
+  // same algorithm as the map based version above: photo_el must be sorted
+
+  double int_start;
+  int pe_count;
+  unsigned int start_index;
+  unsigned int index;
+
+  std::vector<pe> photo_el_digit;
+
+  auto add_signal = [&](int channel, int side, unsigned int last) {
+    dg_ps signal;
+    signal.side = side;
+    signal.adc = sand_reco::ecal::acquisition::pe2ADC * pe_count;
+    // stay in the channel segment
+    signal.tdc = photo_el.time[std::min(index, last - 1)];
+    set_photo_electrons(signal, photo_el_digit);
+    map_pmt[channel].push_back(signal);
+  };
+
+  for (unsigned int k = 0; k < photo_el.channels.size(); k++) {
+    const int channel = photo_el.channels[k];
+    const unsigned int first = photo_el.offsets[k];
+    const unsigned int last = photo_el.offsets[k + 1];
+
+    auto side = 2 * (channel > 0) - 1;
+
+    photo_el_digit.clear();
+
+    int_start = photo_el.time[first];
+    pe_count = 0;
+    start_index = first;
+    index = first;
+
+    for (unsigned int j = first; j < last; j++) {
+      const double time = photo_el.time[j];
+      // integrate for int_time
+      if (time < int_start + sand_reco::ecal::acquisition::int_time) {
+        pe_count++;
+        photo_el_digit.push_back(pe{time, photo_el.h_index[j]});
+      } else if (time > int_start + sand_reco::ecal::acquisition::int_time +
+                            sand_reco::ecal::acquisition::dead_time) {
+        // above threshold -> digit
+        if (pe_count > sand_reco::ecal::acquisition::pe_threshold) {
+          switch (ecal_digi_mode) {
+            case ECAL_digi_mode::const_fract:
+              index = int(sand_reco::ecal::acquisition::costant_fraction *
+                          pe_count) +
+                      start_index;
+              if (debug) std::cout << " Const. Fract. " << index << std::endl;
+              break;
+            case ECAL_digi_mode::fixed_thresh:
+              double tdc_thresh =
+                  (sand_reco::ecal::acquisition::fixed_thresh_pe >
+                   sand_reco::ecal::acquisition::pe_threshold)
+                      ? sand_reco::ecal::acquisition::fixed_thresh_pe
+                      : sand_reco::ecal::acquisition::pe_threshold;
+              index = TMath::Ceil(tdc_thresh) + start_index;
+              if (debug) std::cout << " Fix. Thresh. " << index << std::endl;
+              break;
+          }
+          add_signal(channel, side, last);
+        }
+        // get ready for next digiit
+        pe_count = 1;
+        photo_el_digit.clear();
+        int_start = time;
+        start_index = j;
+      }
+    }
+
+    if (pe_count > sand_reco::ecal::acquisition::pe_threshold) {
+      index = int(sand_reco::ecal::acquisition::costant_fraction * pe_count) +
+              start_index;
+      add_signal(channel, side, last);
+    }
+  }
+}
 }  // namespace ecal
 
 }  // namespace digitization
\ No newline at end of file
@@ -3,11 +3,16 @@
 
 #include <iomanip>
 #include <iostream>
-
-#include <iomanip>
+#include <cmath>
+#include <condition_variable>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
 
 #include "TFile.h"
 #include "TTree.h"
+#include "TROOT.h"
 
 #include "utils.h"
 
@@ -142,7 +147,11 @@ void create_digits_from_hits(const SANDGeoManager& geo,
       d.de += running_hit.de;
       d.hindex.push_back(running_hit.index);
     }
-    d.tdc = wire_time + rand.Gaus(0, sand_reco::stt::tm_stt_smearing);
+    SANDCounterRNG rng(digitization::run_seed, digitization::event_index,
+                       d.det == "Straw" ? SANDCounterRNG::Subsystem::kSTT
+                                        : SANDCounterRNG::Subsystem::kDrift,
+                       did);
+    d.tdc = wire_time + rng.Gaus(0, sand_reco::stt::tm_stt_smearing);
     d.t_hit = t_hit;
     d.drift_time = drift_time;
     d.signal_time = signal_time;
@@ -223,7 +232,8 @@ bool process_hit(const SANDGeoManager& g, const TG4HitSegment& hit, int& detID,
     std::cout << "modID   : " << modID << "\n";
     std::cout << "planeID : " << planeID << "\n";
     std::cout << "cellID  : " << cellID << "\n";
-    throw "";
+    throw std::runtime_error("process_hit: invalid ECAL cell id " +
+                             std::to_string(cell_global_id));
   }
   return true;
 
@@ -285,63 +295,97 @@ bool process_hit(const SANDGeoManager& g, const TG4HitSegment& hit, int& detID,
 }
 
 void simulate_photo_electrons(TG4Event* ev, const SANDGeoManager& g,
-                              std::map<int, std::vector<pe> >& photo_el,
+                              digitization::ecal::photo_electron_buffer& photo_el,
                               std::map<int, double>& L)
 {
-  int detID, modID, planeID, cellID, uniqID;
+  photo_el.clear();
+
+  int detID, modID, planeID, cellID;
   double d1, d2, t0, de;
 
-  for (std::map<std::string, std::vector<TG4HitSegment> >::iterator it =
-           ev->SegmentDetectors.begin();
-       it != ev->SegmentDetectors.end(); ++it) {
-    if (it->first == "EMCalSci") {
-      for (unsigned int j = 0; j < it->second.size(); j++) {
-
-        if (digitization::edep_sim::ecal::process_hit(g, it->second[j], detID,
-                                                      modID, planeID, cellID,
-                                                      d1, d2, t0, de) == true) {
-          double en1 =
-              de * sand_reco::ecal::attenuation::AttenuationFactor(d1, planeID);
-          double en2 =
-              de * sand_reco::ecal::attenuation::AttenuationFactor(d2, planeID);
-
-          double ave_pe1 =
-              digitization::edep_sim::ecal::energy_to_photo_electrons(en1);
-          double ave_pe2 =
-              digitization::edep_sim::ecal::energy_to_photo_electrons(en2);
-
-          int pe1 = digitization::rand.Poisson(ave_pe1);
-          int pe2 = digitization::rand.Poisson(ave_pe2);
-
-          uniqID =
-              sand_reco::ecal::decoder::EncodeID(detID, modID, planeID, cellID);
-
-          // cellend 1 -> x < 0 -> ID > 0 -> left
-          // cellend 2 -> x > 0 -> ID < 0 -> right
-
-          for (int i = 0; i < pe1; i++) {
-            pe this_pe;
-            this_pe.time =
-                digitization::ecal::photo_electron_time_to_pmt_arrival_time(t0,
-                                                                            d1);
-            this_pe.h_index = j;
-            photo_el[uniqID].push_back(this_pe);
-            L[uniqID] = d1 + d2;
-          }
-
-          for (int i = 0; i < pe2; i++) {
-            pe this_pe;
-            this_pe.time =
-                digitization::ecal::photo_electron_time_to_pmt_arrival_time(t0,
-                                                                            d2);
-            this_pe.h_index = j;
-            photo_el[-1 * uniqID].push_back(this_pe);
-            L[-1 * uniqID] = d1 + d2;
-          }
-        }
-      }
+  // one random stream per pmt
+  std::map<int, SANDCounterRNG> rng;
+  auto get_rng = [&rng](int pmt_id) -> SANDCounterRNG& {
+    auto it = rng.find(pmt_id);
+    if (it == rng.end())
+      it = rng.emplace(pmt_id, SANDCounterRNG(digitization::run_seed,
+                                              digitization::event_index,
+                                              SANDCounterRNG::Subsystem::kECAL,
+                                              pmt_id))
+               .first;
+    return it->second;
+  };
+
+  // first pass: cells and expected photo-electrons of the hits, to reserve
+  // the buffer once for the whole event
+  struct ecal_hit {
+    int j;
+    int uniqID;
+    double d1, d2, t0;
+    double ave_pe1, ave_pe2;
+  };
+  std::vector<ecal_hit> hits;
+  double expected_pe = 0.;
+
+  auto segments = ev->SegmentDetectors.find("EMCalSci");
+  if (segments == ev->SegmentDetectors.end()) return;
+  hits.reserve(segments->second.size());
+
+  for (unsigned int j = 0; j < segments->second.size(); j++) {
+    if (digitization::edep_sim::ecal::process_hit(g, segments->second[j], detID,
+                                                  modID, planeID, cellID, d1,
+                                                  d2, t0, de) == true) {
+      double en1 =
+          de * sand_reco::ecal::attenuation::AttenuationFactor(d1, planeID);
+      double en2 =
+          de * sand_reco::ecal::attenuation::AttenuationFactor(d2, planeID);
+
+      ecal_hit hit;
+      hit.j = j;
+      hit.uniqID =
+          sand_reco::ecal::decoder::EncodeID(detID, modID, planeID, cellID);
+      hit.d1 = d1;
+      hit.d2 = d2;
+      hit.t0 = t0;
+      hit.ave_pe1 = digitization::edep_sim::ecal::energy_to_photo_electrons(en1);
+      hit.ave_pe2 = digitization::edep_sim::ecal::energy_to_photo_electrons(en2);
+      expected_pe += hit.ave_pe1 + hit.ave_pe2;
+      hits.push_back(hit);
     }
   }
+
+  // expected count plus a few standard deviations of the Poisson draws
+  photo_el.reserve(expected_pe + 3. * sqrt(expected_pe) + 1.);
+
+  for (const auto& hit : hits) {
+    int uniqID = hit.uniqID;
+    SANDCounterRNG& rng1 = get_rng(uniqID);
+    SANDCounterRNG& rng2 = get_rng(-1 * uniqID);
+
+    int pe1 = rng1.Poisson(hit.ave_pe1);
+    int pe2 = rng2.Poisson(hit.ave_pe2);
+
+    // cellend 1 -> x < 0 -> ID > 0 -> left
+    // cellend 2 -> x > 0 -> ID < 0 -> right
+
+    for (int i = 0; i < pe1; i++) {
+      photo_el.push_back(
+          uniqID,
+          digitization::ecal::photo_electron_time_to_pmt_arrival_time(
+              hit.t0, hit.d1, rng1),
+          hit.j);
+    }
+    if (pe1 > 0) L[uniqID] = hit.d1 + hit.d2;
+
+    for (int i = 0; i < pe2; i++) {
+      photo_el.push_back(
+          -1 * uniqID,
+          digitization::ecal::photo_electron_time_to_pmt_arrival_time(
+              hit.t0, hit.d2, rng2),
+          hit.j);
+    }
+    if (pe2 > 0) L[-1 * uniqID] = hit.d1 + hit.d2;
+  }
 }
 
 // construct calo digit and collect them in a vector
@@ -385,7 +429,7 @@ void digitize_ecal(TG4Event* ev, const SANDGeoManager& geo,
                    std::vector<dg_cell>& vec_cell,
                    ECAL_digi_mode ecal_digi_mode)
 {
-  std::map<int, std::vector<pe> > photo_el;
+  digitization::ecal::photo_electron_buffer photo_el;
   std::map<int, std::vector<dg_ps> > ps;
   std::map<int, double> L;
 
@@ -399,6 +443,7 @@ void digitize_ecal(TG4Event* ev, const SANDGeoManager& geo,
   if (debug) {
     std::cout << "TimeAndSignal" << std::endl;
   }
+  photo_el.sort();
   digitization::ecal::eval_adc_and_tdc_from_photo_electrons(photo_el, ps,
                                                             ecal_digi_mode);
   if (debug) {
@@ -487,7 +532,7 @@ void create_digits_from_hits(const SANDGeoManager& geo,
     double min_drift_time = 1E9;  // mm
     SANDTrackerCellID cell_global_id = it->first;
 
-    auto cell_info = geo.get_cell_info(cell_global_id)->second;
+    const auto& cell_info = geo.get_cell_info(cell_global_id)->second;
 
     SANDTrackerModuleID module_unique_id;
     SANDTrackerPlaneID plane_global_id, plane_local_id, plane_type;
@@ -567,7 +612,9 @@ void create_digits_from_hits(const SANDGeoManager& geo,
       d.hindex.push_back(it->second[i].index);
     }
 
-    d.tdc = min_time_tub + rand.Gaus(0, sand_reco::stt::tm_stt_smearing);
+    SANDCounterRNG rng(digitization::run_seed, digitization::event_index,
+                       SANDCounterRNG::Subsystem::kSTT, d.did);
+    d.tdc = min_time_tub + rng.Gaus(0, sand_reco::stt::tm_stt_smearing);
     d.drift_time = min_drift_time;
     d.adc = d.de;
 
@@ -683,54 +730,56 @@ void group_hits_by_cell(TG4Event* ev, const SANDGeoManager& geo,
 
     auto& plane = *geo.get_plane_info(SANDTrackerCellID(start_id));
 
-    TVector2 rotated_hit_start_2d_position = geo.GlobalToRotated(TVector2(hseg.Start.X(), hseg.Start.Y()), plane);
-    TVector2 rotated_hit_stop_2d_position  = geo.GlobalToRotated(TVector2(hseg.Stop.X(), hseg.Stop.Y())  , plane);
+    // hit start and stop in the plane rotated frame
+    const double global_x[2] = {hseg.Start.X(), hseg.Stop.X()};
+    const double global_y[2] = {hseg.Start.Y(), hseg.Stop.Y()};
+    double rotated_x[2], rotated_y[2];
+    plane.globalToRotated(2, global_x, global_y, rotated_x, rotated_y);
 
-    auto rotated_delta_x = rotated_hit_stop_2d_position.X() - rotated_hit_start_2d_position.X();
-    auto rotated_delta_y = rotated_hit_stop_2d_position.Y() - rotated_hit_start_2d_position.Y();
+    auto rotated_delta_x = rotated_x[1] - rotated_x[0];
+    auto rotated_delta_y = rotated_y[1] - rotated_y[0];
     auto rotated_delta_z = hseg.Stop.Z() - hseg.Start.Z();
 
+    // start of the current step in the plane rotated frame
+    double rotated_start_x = rotated_x[0];
+    double rotated_start_y = rotated_y[0];
+
     for (auto i = start_id; i <= stop_id; i++) {
       auto cell1 = geo.get_cell_info(i);
       auto cell2 = geo.get_cell_info(i + 1);
 
-      
-      TVector2 rotated_start_2d_position = geo.GlobalToRotated(TVector2(start.X(), start.Y()), plane);
-      double transverse_coord_start = rotated_start_2d_position.Y();
+
+      double transverse_coord_start = rotated_start_y;
 
       double step_coordinate;
 
       if (cell2 != plane.getIdToCellMapEnd()) {
 
-        SANDWireInfo wire1 = cell1->second.wire();
-        SANDWireInfo wire2 = cell2->second.wire();
-        
-        TVector2 rotated_wire_center1_2d_position = geo.GlobalToRotated(TVector2(wire1.center().X(), wire1.center().Y()), plane);
-        double transverse_coord1 = rotated_wire_center1_2d_position.Y();
- 
-        TVector2 rotated_wire_center2_2d_position = geo.GlobalToRotated(TVector2(wire2.center().X(), wire2.center().Y()), plane);
-        double transverse_coord2 = rotated_wire_center2_2d_position.Y();
+        double transverse_coord1 = cell1->second.rotatedWirePosition().Y();
+        double transverse_coord2 = cell2->second.rotatedWirePosition().Y();
 
         double plane_coordinate = (transverse_coord1 + transverse_coord2) * 0.5;
         
         if (fabs(plane_coordinate - transverse_coord_start) < 
-            fabs(rotated_hit_stop_2d_position.Y() - transverse_coord_start)) {
+            fabs(rotated_y[1] - transverse_coord_start)) {
           step_coordinate = plane_coordinate;
         } else {
-          step_coordinate = rotated_hit_stop_2d_position.Y();
+          step_coordinate = rotated_y[1];
         }
       } else {
-        step_coordinate = rotated_hit_stop_2d_position.Y();
+        step_coordinate = rotated_y[1];
       }
       double t = fabs((step_coordinate - transverse_coord_start) / rotated_delta_y);
       
-      TVector2 rotated_crossing_point(rotated_start_2d_position.X() + rotated_delta_x * t, 
-                                      rotated_start_2d_position.Y() + rotated_delta_y * t);
+      double rotated_crossing_x = rotated_start_x + rotated_delta_x * t;
+      double rotated_crossing_y = rotated_start_y + rotated_delta_y * t;
 
-      TVector2 global_crossing_point = geo.RotatedToGlobal(TVector2(rotated_crossing_point.X(), rotated_crossing_point.Y()), plane);
+      double global_crossing_x, global_crossing_y;
+      plane.rotatedToGlobal(1, &rotated_crossing_x, &rotated_crossing_y,
+                            &global_crossing_x, &global_crossing_y);
 
-      TVector3 stop(global_crossing_point.X(), 
-                    global_crossing_point.Y(), 
+      TVector3 stop(global_crossing_x, 
+                    global_crossing_y, 
                     start.Z() + rotated_delta_z * t);
 
       double portion = (start - stop).Mag() / hseg_length;
@@ -763,6 +812,8 @@ void group_hits_by_cell(TG4Event* ev, const SANDGeoManager& geo,
       hits2cell[cell_id].push_back(h);
 
       start = stop;
+      rotated_start_x = rotated_crossing_x;
+      rotated_start_y = rotated_crossing_y;
       hseg_start_t += t * hseg_dt;
 
       if ((start - hseg.Stop.Vect()).Mag() < 1E-6) {
@@ -803,9 +854,162 @@ void digitize_drift(TG4Event* ev, const SANDGeoManager& geo,
 
 }  // namespace chamber
 
+// digitize a single event. The random streams are keyed on the event index
+// and the t0 table is reset, so that the result does not depend on the
+// order (or the thread) in which events are processed
+void digitize_event(TG4Event* ev, int event_index, SANDGeoManager& sand_geo,
+                    bool is_stt, ECAL_digi_mode ecal_digi_mode,
+                    std::vector<dg_cell>& vec_cell,
+                    std::vector<dg_wire>& wire_digits)
+{
+  digitization::event_index = event_index;
+
+  // define the T0 for this event
+  // for each straw tubs:
+  // std::map<int, double> sand_reco::t0
+  sand_reco::stt::initT0(ev, sand_geo, digitization::run_seed, event_index);
+  digitization::edep_sim::ecal::digitize_ecal(ev, sand_geo, vec_cell,
+                                              ecal_digi_mode);
+
+  if (is_stt) {
+    digitization::edep_sim::stt::digitize_stt(ev, sand_geo, wire_digits);
+  } else {
+    digitization::edep_sim::chamber::digitize_drift(ev, sand_geo,
+                                                    wire_digits);
+  }
+}
+
+namespace
+{
+// digits of one event waiting to be written
+struct digitized_event {
+  std::vector<dg_cell> vec_cell;
+  std::vector<dg_wire> wire_digits;
+};
+
+// max number of digitized events kept in memory waiting for the writer
+const int max_events_in_flight_per_thread = 16;
+
+void print_progress(int i, int nev)
+{
+  std::cout << "\b\b\b\b\b" << std::setw(3) << int(double(i) / nev * 100)
+            << "%]" << std::flush;
+}
+}  // namespace
+
+// event-parallel digitization: each worker reads its own copy of the input
+// tree and digitizes the next available event; the calling thread writes
+// the events in input order so that tDigit stays aligned to EDepSimEvents
+void digitize_parallel(const char* finname, TGeoManager* geo,
+                       SANDGeoManager& sand_geo, bool is_stt,
+                       ECAL_digi_mode ecal_digi_mode, int nthreads, int nev,
+                       TTree& tout, std::vector<dg_cell>& vec_cell,
+                       std::vector<dg_wire>& wire_digits)
+{
+  ROOT::EnableThreadSafety();
+  geo->SetMaxThreads(nthreads);
+
+  const int max_in_flight = nthreads * max_events_in_flight_per_thread;
+
+  std::mutex mtx;
+  std::condition_variable cv_done;   // an event has been digitized
+  std::condition_variable cv_space;  // an event has been written
+  std::map<int, digitized_event> done;
+  int next_event = 0;
+  int next_to_write = 0;
+  bool failed = false;
+  std::string failure;
+
+  auto worker = [&]() {
+    geo->AddNavigator();
+
+    TFile f(finname, "READ");
+    TTree* t = (TTree*)f.Get("EDepSimEvents");
+    TG4Event* ev = new TG4Event;
+    t->SetBranchAddress("Event", &ev);
+
+    while (true) {
+      int i;
+      {
+        std::unique_lock<std::mutex> lock(mtx);
+        cv_space.wait(lock, [&] {
+          return failed || next_event >= nev ||
+                 next_event < next_to_write + max_in_flight;
+        });
+        if (failed || next_event >= nev) break;
+        i = next_event++;
+      }
+
+      digitized_event result;
+      try {
+        t->GetEntry(i);
+        digitize_event(ev, i, sand_geo, is_stt, ecal_digi_mode,
+                       result.vec_cell, result.wire_digits);
+      } catch (const std::exception& e) {
+        std::lock_guard<std::mutex> lock(mtx);
+        if (!failed)
+          failure = "event " + std::to_string(i) + ": " + e.what();
+        failed = true;
+        cv_done.notify_all();
+        cv_space.notify_all();
+        break;
+      } catch (...) {
+        std::lock_guard<std::mutex> lock(mtx);
+        if (!failed) failure = "event " + std::to_string(i) + ": unknown error";
+        failed = true;
+        cv_done.notify_all();
+        cv_space.notify_all();
+        break;
+      }
+
+      std::lock_guard<std::mutex> lock(mtx);
+      done[i] = std::move(result);
+      cv_done.notify_all();
+    }
+
+    t->ResetBranchAddresses();
+    delete ev;
+    f.Close();
+    geo->ClearThreadData();
+  };
+
+  std::vector<std::thread> workers;
+  for (int k = 0; k < nthreads; k++) workers.emplace_back(worker);
+
+  // ordered writer
+  for (; next_to_write < nev; ) {
+    digitized_event result;
+    {
+      std::unique_lock<std::mutex> lock(mtx);
+      cv_done.wait(lock,
+                   [&] { return failed || done.count(next_to_write) > 0; });
+      if (failed) break;
+      auto it = done.find(next_to_write);
+      result = std::move(it->second);
+      done.erase(it);
+    }
+
+    print_progress(next_to_write, nev);
+
+    vec_cell.swap(result.vec_cell);
+    wire_digits.swap(result.wire_digits);
+    tout.Fill();
+
+    std::lock_guard<std::mutex> lock(mtx);
+    next_to_write++;
+    cv_space.notify_all();
+  }
+
+  for (auto& w : workers) w.join();
+
+  if (failed)
+    throw std::runtime_error("digitize_parallel: digitization failed at " +
+                             failure);
+}
+
 // digitize event
 void digitize(const char* finname, const char* foutname,
-              ECAL_digi_mode ecal_digi_mode)
+              ECAL_digi_mode ecal_digi_mode, int nthreads)
 {
   TFile f(finname, "READ");
 
@@ -868,7 +1072,9 @@ void digitize(const char* finname, const char* foutname,
 
   tout.Branch("dg_cell", "std::vector<dg_cell>", &vec_cell);
 
-  if (geo->FindVolumeFast("STTtracker_PV")) {
+  bool is_stt = geo->FindVolumeFast("STTtracker_PV");
+
+  if (is_stt) {
     std::cout << "\n--- Digitize STT based simulation ---\n";
   } else {
     std::cout << "\n--- Digitize Drift based simulation ---\n";
@@ -881,28 +1087,21 @@ void digitize(const char* finname, const char* foutname,
   std::cout << "Events: " << nev << " [";
   std::cout << std::setw(3) << int(0) << "%]" << std::flush;
 
-  // loop on all input events
-  for (int i = 0; i < nev; i++) {
-    t->GetEntry(i);
+  if (nthreads > 1) {
+    digitize_parallel(finname, geo, sand_geo, is_stt, ecal_digi_mode,
+                      nthreads, nev, tout, vec_cell, wire_digits);
+  } else {
+    // loop on all input events
+    for (int i = 0; i < nev; i++) {
+      t->GetEntry(i);
 
-    std::cout << "\b\b\b\b\b" << std::setw(3) << int(double(i) / nev * 100)
-              << "%]" << std::flush;
+      print_progress(i, nev);
 
-    // define the T0 for this event
-    // for each straw tubs:
-    // std::map<int, double> sand_reco::t0
-    sand_reco::stt::initT0(ev, sand_geo);
-    digitization::edep_sim::ecal::digitize_ecal(ev, sand_geo, vec_cell,
-                                                ecal_digi_mode);
+      digitize_event(ev, i, sand_geo, is_stt, ecal_digi_mode, vec_cell,
+                     wire_digits);
 
-    if (geo->FindVolumeFast("STTtracker_PV")) {
-      digitization::edep_sim::stt::digitize_stt(ev, sand_geo, wire_digits);
-    } else {
-      digitization::edep_sim::chamber::digitize_drift(ev, sand_geo,
-                                                      wire_digits);
+      tout.Fill();
     }
-
-    tout.Fill();
   }
   std::cout << "\b\b\b\b\b" << std::setw(3) << 100 << "%]" << std::flush;
   std::cout << std::endl;
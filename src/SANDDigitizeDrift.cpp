@@ -1,5 +1,6 @@
 #include <iostream>
 #include <fstream>
+#include <unordered_map>
 #include <TAxis.h>
 #include <TRandom3.h>
 
@@ -67,6 +68,23 @@ TGeoManager* geo = nullptr;
 
 TG4Event* evEdep = nullptr;
 
+// WIRE INDEX__________________________________________________________________
+
+/*
+    wires of a plane share the same z and orientation: they are stored
+    sorted by their transverse coordinate (y for horizontal wires, x for
+    vertical wires) so that a hit only tests the wires whose cells it
+    can cross
+*/
+struct WirePlane
+{
+    double z;
+    bool hor;
+    std::vector<double> transverse;
+    std::vector<unsigned int> wire_index; // index in wire_infos
+};
+
+std::vector<WirePlane> wire_planes;
 
 // COLORS ______________________________________________________________________
 
@@ -164,23 +182,25 @@ std::vector<TG4HitSegment> FilterHits(const std::vector<TG4HitSegment>& hits, co
     return filtered_hits;
 }
 
-void UpdateFiredWires(std::vector<dg_wire>& fired_wires, dg_wire new_fired){
+void UpdateFiredWires(std::vector<dg_wire>& fired_wires, 
+                      std::unordered_map<long, unsigned int>& did_to_fired,
+                      dg_wire new_fired){
     
-    bool found = false;
-    //(f.did == new_fired.did) && (f.tdc > new_fired.tdc)
-    for(auto& f : fired_wires){
-        if((f.did == new_fired.did)){ // wire already fired
-            found = true;
-            // if tdc is shorter than the one saved, update otherwise discard wire
-            if(f.tdc > new_fired.tdc){
-                f.tdc = new_fired.tdc;
-                f.drift_time = new_fired.drift_time;
-                f.signal_time = new_fired.signal_time;
-                f.t_hit = new_fired.t_hit;
-            }
+    auto found = did_to_fired.find(new_fired.did);
+
+    if(found != did_to_fired.end()){ // wire already fired
+        auto& f = fired_wires[found->second];
+        // if tdc is shorter than the one saved, update otherwise discard wire
+        if(f.tdc > new_fired.tdc){
+            f.tdc = new_fired.tdc;
+            f.drift_time = new_fired.drift_time;
+            f.signal_time = new_fired.signal_time;
+            f.t_hit = new_fired.t_hit;
         }
+    }else{
+        did_to_fired[new_fired.did] = fired_wires.size();
+        fired_wires.push_back(new_fired);
     }
-    if(!found) fired_wires.push_back(new_fired);
 }
 
 void SortWiresByTime(std::vector<dg_wire>& wires){
@@ -190,6 +210,72 @@ void SortWiresByTime(std::vector<dg_wire>& wires){
     });
 }
 
+void BuildWireIndex(const std::vector<dg_wire>& wire_infos){
+    /*
+        group wires in planes (same z and orientation),
+        planes sorted by z, wires sorted by transverse coordinate
+    */
+    wire_planes.clear();
+
+    std::vector<unsigned int> sorted(wire_infos.size());
+    for(auto i = 0u; i < wire_infos.size(); i++) sorted[i] = i;
+
+    std::sort(sorted.begin(), sorted.end(), [&](unsigned int i1, unsigned int i2) {
+        const auto& w1 = wire_infos[i1];
+        const auto& w2 = wire_infos[i2];
+        if(w1.z != w2.z) return w1.z < w2.z;
+        if(w1.hor != w2.hor) return w1.hor < w2.hor;
+        return (w1.hor ? w1.y : w1.x) < (w2.hor ? w2.y : w2.x);
+    });
+
+    for(auto i : sorted){
+        const auto& wire = wire_infos[i];
+        
+        if(wire_planes.empty() || 
+           fabs(wire_planes.back().z - wire.z) > 1e-3 || 
+           wire_planes.back().hor != wire.hor){
+            WirePlane plane;
+            plane.z = wire.z;
+            plane.hor = wire.hor;
+            wire_planes.push_back(plane);
+        }
+        wire_planes.back().transverse.push_back(wire.hor ? wire.y : wire.x);
+        wire_planes.back().wire_index.push_back(i);
+    }
+}
+
+void GetCandidateWires(const TLorentzVector& start, 
+                       const TLorentzVector& stop,
+                       std::vector<unsigned int>& candidates){
+    /*
+        get the index (in wire_infos) of the wires whose plane is close 
+        to the hit middle z and whose cell can be crossed by the hit
+    */
+    candidates.clear();
+
+    double hit_middle_z = (start.Z() + stop.Z()) * 0.5;
+
+    auto plane = std::lower_bound(wire_planes.begin(), wire_planes.end(), 
+                                  hit_middle_z - MYLAR_2_MYLAR_DIST * 0.5,
+                                  [](const WirePlane& p, double z) { return p.z < z; });
+
+    for(; plane != wire_planes.end() && plane->z < hit_middle_z + MYLAR_2_MYLAR_DIST * 0.5; ++plane){
+        
+        double t_start = plane->hor ? start.Y() : start.X();
+        double t_stop  = plane->hor ? stop.Y()  : stop.X();
+
+        auto first = std::lower_bound(plane->transverse.begin(), plane->transverse.end(), 
+                                      std::min(t_start, t_stop) - SENSE_2_SENSE_DIST * 0.5);
+        auto last  = std::upper_bound(first, plane->transverse.end(), 
+                                      std::max(t_start, t_stop) + SENSE_2_SENSE_DIST * 0.5);
+
+        for(auto it = first; it != last; ++it)
+            candidates.push_back(plane->wire_index[it - plane->transverse.begin()]);
+    }
+    // keep the wire_infos order of the exhaustive scan
+    std::sort(candidates.begin(), candidates.end());
+}
+
 void CreateDigitsFromEDep(const std::vector<TG4HitSegment>& hits,
                           const std::vector<dg_wire>& wire_infos, 
                           std::vector<dg_wire>& fired_wires
@@ -197,14 +283,24 @@ void CreateDigitsFromEDep(const std::vector<TG4HitSegment>& hits,
     /*
     Perform digitization of edepsim hits
     */
+    std::unordered_map<long, unsigned int> did_to_fired;
+
+    for(auto i = 0u; i < fired_wires.size(); i++) did_to_fired[fired_wires[i].did] = i;
+
+    std::vector<unsigned int> candidates;
+
     for(auto i = 0u; i < hits.size(); i++){
         
         auto hit_middle = (hits[i].GetStop() + hits[i].GetStart())*0.5;
         auto hit_delta =  (hits[i].GetStop() - hits[i].GetStart());
 
         Line hit_line = Line(hits[i]);
+
+        GetCandidateWires(hits[i].GetStart(), hits[i].GetStop(), candidates);
         
-        for(auto& wire : wire_infos){
+        for(auto wire_index : candidates){
+
+            const auto& wire = wire_infos[wire_index];
 
             // first scan along z to find the wire plane
             bool is_hit_in_wire_plane = fabs(wire.z - hit_middle.Z()) < MYLAR_2_MYLAR_DIST * 0.5;
@@ -242,7 +338,7 @@ void CreateDigitsFromEDep(const std::vector<TG4HitSegment>& hits,
                     fired.hindex.push_back(i);
 
                     // if wire already fired check if the tdc saved is the smallest
-                    UpdateFiredWires(fired_wires, fired);
+                    UpdateFiredWires(fired_wires, did_to_fired, fired);
 
                 }
             }
@@ -348,6 +444,7 @@ int main(int argc, char* argv[]){
     
     LOG("I","Loading wires lookup table");
     ReadWireInfos(fWireInfo, wire_infos);
+    BuildWireIndex(wire_infos);
 
     LOG("I", "Reading branch Event from EDepFile");
     tEdep->SetBranchAddress("Event", &evEdep);
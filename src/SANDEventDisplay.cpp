@@ -324,11 +324,11 @@ void SANDEventDisplay::FillDigitHits()
     int pe = 0;
 
     for (auto &ps : cell.ps1) {
-      for (auto &pe1 : ps.photo_el) ++pe;
+      pe += (ps.pe_count > 0) ? ps.pe_count : ps.photo_el.size();
     }
 
     for (auto &ps : cell.ps2) {
-      for (auto &pe1 : ps.photo_el) ++pe;
+      pe += (ps.pe_count > 0) ? ps.pe_count : ps.photo_el.size();
     }
 
     hit.e = pe;
@@ -5,6 +5,8 @@
 #include <fstream>
 
 #include <iomanip>
+#include <algorithm>
+#include <mutex>
 
 
 #include <TGeoTrd2.h>
@@ -449,6 +451,124 @@ void SANDGeoManager::set_ecal_info()
   }
 }
 
+// Two ECAL cells are neighbours if:
+// - they are in the same module and their layer and cell ids differ at most
+//   by one
+// - they are in consecutive barrel modules (23 and 0 included), at the
+//   module edges (cells 0 and 11) and their layer ids differ at most by one
+// - one is in the barrel and one in an endcap and the distance between
+//   them is below a layer thickness. Barrel cells are along x and endcap
+//   cells are along y: the distance is evaluated per axis using the half
+//   lengths
+void SANDGeoManager::build_ecal_neighbours()
+{
+  const double seam_max_distance =
+      sand_geometry::ecal::layer_thickness[sand_geometry::ecal::number_of_layers - 1];
+  const int ncells_barrel_layer =
+      sand_geometry::ecal::number_of_cells_per_barrel_layer;
+  const int nbarrel_modules = sand_geometry::ecal::number_of_barrel_modules;
+
+  ecal_cell_ids_.clear();
+  ecal_neighbour_offsets_.assign(1, 0);
+  ecal_neighbours_.clear();
+
+  struct ecal_cell {
+    int det, mod, lay, cel;
+    SANDECALCellInfo info;
+  };
+  std::vector<ecal_cell> cells;
+  for (auto id_cell : cellmap_) {
+    ecal_cell c;
+    decode_ecal_cell_id(id_cell.first, c.det, c.mod, c.lay, c.cel);
+    c.info = id_cell.second;
+    cells.push_back(c);
+    ecal_cell_ids_.push_back(id_cell.first);
+  }
+
+  auto is_barrel = [](const ecal_cell& c) { return c.det == 2; };
+
+  // cells of the same module are contiguous in cellmap_ (id order)
+  std::map<std::pair<int, int>, std::pair<std::size_t, std::size_t>> module_range;
+  for (std::size_t i = 0; i < cells.size(); i++) {
+    auto key = std::make_pair(cells[i].det, cells[i].mod);
+    auto it = module_range.find(key);
+    if (it == module_range.end())
+      module_range[key] = std::make_pair(i, i + 1);
+    else
+      it->second.second = i + 1;
+  }
+
+  std::vector<std::pair<std::size_t, std::size_t>> endcap_ranges;
+  for (const auto& m : module_range)
+    if (m.first.first != 2) endcap_ranges.push_back(m.second);
+
+  std::vector<std::size_t> neighbours;
+  for (std::size_t i = 0; i < cells.size(); i++) {
+    auto& c = cells[i];
+    neighbours.clear();
+
+    // same module (dm = 0) and, for the barrel, the two adjacent modules.
+    // Across the module boundary the first cell of a module faces the last
+    // cell of the previous one
+    struct module_cells {
+      int dm;
+      std::pair<std::size_t, std::size_t> range;
+    };
+    std::vector<module_cells> ranges = {
+        {0, module_range[std::make_pair(c.det, c.mod)]}};
+    if (is_barrel(c)) {
+      for (int dm : {-1, 1}) {
+        int mod = (c.mod + dm + nbarrel_modules) % nbarrel_modules;
+        auto it = module_range.find(std::make_pair(c.det, mod));
+        if (it != module_range.end()) ranges.push_back({dm, it->second});
+      }
+    }
+    for (const auto& r : ranges) {
+      for (auto j = r.range.first; j < r.range.second; j++) {
+        if (j == i) continue;
+        const auto& n = cells[j];
+        if (std::abs(c.lay - n.lay) > 1) continue;
+        if (r.dm == 0) {
+          if (std::abs(c.cel - n.cel) <= 1) neighbours.push_back(j);
+        } else if (r.dm == -1) {
+          if (c.cel == 0 && n.cel == ncells_barrel_layer - 1)
+            neighbours.push_back(j);
+        } else if (c.cel == ncells_barrel_layer - 1 && n.cel == 0) {
+          neighbours.push_back(j);
+        }
+      }
+    }
+
+    // barrel - endcap seams
+    auto seam_distance = [](ecal_cell& barrel, ecal_cell& endcap) {
+      double dx = std::max(0., std::abs(barrel.info.x() - endcap.info.x()) -
+                                   barrel.info.length());
+      double dy = std::max(0., std::abs(barrel.info.y() - endcap.info.y()) -
+                                   endcap.info.length());
+      double dz = barrel.info.z() - endcap.info.z();
+      return std::sqrt(dx * dx + dy * dy + dz * dz);
+    };
+    if (is_barrel(c)) {
+      for (const auto& r : endcap_ranges)
+        for (auto j = r.first; j < r.second; j++)
+          if (seam_distance(c, cells[j]) < seam_max_distance)
+            neighbours.push_back(j);
+    } else {
+      for (const auto& m : module_range) {
+        if (m.first.first != 2) continue;
+        for (auto j = m.second.first; j < m.second.second; j++)
+          if (seam_distance(cells[j], c) < seam_max_distance)
+            neighbours.push_back(j);
+      }
+    }
+
+    std::sort(neighbours.begin(), neighbours.end());
+    ecal_neighbours_.insert(ecal_neighbours_.end(), neighbours.begin(),
+                            neighbours.end());
+    ecal_neighbour_offsets_.push_back(ecal_neighbours_.size());
+  }
+}
+
 plane_iterator SANDGeoManager::get_plane_info(SANDTrackerPlaneID plane_global_id) const
 {
   SANDTrackerModuleID module_unique_id;
@@ -470,6 +590,9 @@ plane_iterator SANDGeoManager::get_plane_info(SANDTrackerCellID cell_global_id)
 
 std::map<SANDTrackerCellID, SANDTrackerCell>::const_iterator SANDGeoManager::get_cell_info(SANDTrackerCellID cell_global_id) const
 {
+  auto index = _cell_id_to_index.find(cell_global_id());
+  if (index != _cell_id_to_index.end()) return _index_to_cell[index->second];
+
   SANDTrackerModuleID module_unique_id;
   SANDTrackerPlaneID  plane_global_id, plane_local_id, plane_type;
   SANDTrackerCellID   cell_local_id;
@@ -839,15 +962,17 @@ const TVector2 SANDGeoManager::GlobalToLocal(TVector2 global, const SANDTrackerP
 }
 const TVector2 SANDGeoManager::LocalToRotated(TVector2 local, const SANDTrackerPlane& plane) const
 {
-  return pointInRotatedSystem(local, plane.getRotation());
+  return TVector2( local.X() * plane.getCosRotation() + local.Y() * plane.getSinRotation(),
+                  -local.X() * plane.getSinRotation() + local.Y() * plane.getCosRotation());
 }
 const TVector2 SANDGeoManager::GlobalToRotated(TVector2 global, const SANDTrackerPlane& plane) const
 {
-  return LocalToRotated(GlobalToLocal(global, plane), plane);
+  return plane.globalToRotated(global);
 }
 const TVector2 SANDGeoManager::RotatedToLocal(TVector2 rotated, const SANDTrackerPlane& plane) const
 {
-  return pointInRotatedSystem(rotated, -plane.getRotation());
+  return TVector2(rotated.X() * plane.getCosRotation() - rotated.Y() * plane.getSinRotation(),
+                  rotated.X() * plane.getSinRotation() + rotated.Y() * plane.getCosRotation());
 }
 const TVector2 SANDGeoManager::LocalToGlobal(TVector2 local, const SANDTrackerPlane& plane) const
 {
@@ -855,7 +980,7 @@ const TVector2 SANDGeoManager::LocalToGlobal(TVector2 local, const SANDTrackerPl
 }
 const TVector2 SANDGeoManager::RotatedToGlobal(TVector2 rotated, const SANDTrackerPlane& plane) const
 {
-  return LocalToGlobal(RotatedToLocal(rotated, plane), plane);
+  return plane.rotatedToGlobal(rotated);
 }
 
 
@@ -1095,35 +1220,125 @@ void SANDGeoManager::fill_adjacent_cells(std::string geometry)
   double max_distance = sqrt(dy*dy + dz*dz) + 0.1;
   std::cout << "max_distance " << dy << " " << dz << " " << max_distance << std::endl;
 
-  for(auto plane_it = _planes.begin(); plane_it != _planes.end(); plane_it++) {
-    // std::cout << "Checking plane " << plane_it->uid()() << std::endl;
-    int c = 0;
-    for(auto next_plane_it = plane_it; c < 3 && next_plane_it != _planes.end(); next_plane_it++) {
-      // std::cout << "with plane " << next_plane_it->uid()() << std::endl;
-      c++;
-      auto&      plane_it_cells =      plane_it->getIdToCellMap();
-      auto& next_plane_it_cells = next_plane_it->getIdToCellMap();
-
-        
-      for(auto& plane_cell:plane_it_cells) {
-        for(auto& next_plane_cell:next_plane_it_cells) {
-          if(plane_cell.first == next_plane_cell.first) {
-            continue;
+  // The wires of a plane are parallel: each plane keeps its cells sorted by
+  // the coordinate orthogonal to its wires (t). For a cell of another plane
+  // only the cells with t within max_distance of the t-range spanned by its
+  // wire can be adjacent, and they are found with a binary search. The
+  // bounding boxes of the wires are compared before the exact distance.
+  struct SweepCell {
+    double t;
+    std::size_t row;
+    TVector3 first;
+    TVector3 second;
+    TVector3 box_min;
+    TVector3 box_max;
+  };
+  struct SweepPlane {
+    double nx;
+    double ny;
+    std::vector<SweepCell> cells;
+  };
+
+  std::vector<SweepPlane> sweep_planes(_planes.size());
+  for (auto& sp : sweep_planes) {
+    sp.nx = 0.;
+    sp.ny = 1.;
+  }
+  for (std::size_t row = 0; row < get_n_cells(); row++) {
+    auto& sp = sweep_planes[_cell_index_to_plane[row]()];
+    const auto& wire = get_cell(SANDTrackerCellIndex(row)).wire();
+    SweepCell c;
+    c.row = row;
+    c.first = wire.getFirstPoint();
+    c.second = wire.getSecondPoint();
+    for (int k = 0; k < 3; k++) {
+      c.box_min[k] = std::min(c.first[k], c.second[k]) - max_distance;
+      c.box_max[k] = std::max(c.first[k], c.second[k]) + max_distance;
+    }
+    if (sp.cells.empty()) {
+      TVector2 dir = (c.second - c.first).XYvector();
+      if (dir.Mod() > 0.) {
+        sp.nx = -dir.Unit().Y();
+        sp.ny =  dir.Unit().X();
+      }
+    }
+    sp.cells.push_back(c);
+  }
+  for (auto& sp : sweep_planes) {
+    for (auto& c : sp.cells) c.t = sp.nx * c.first.X() + sp.ny * c.first.Y();
+    std::sort(sp.cells.begin(), sp.cells.end(),
+              [](const SweepCell& c1, const SweepCell& c2) {return c1.t < c2.t;});
+  }
+
+  std::vector<std::vector<std::size_t>> neighbours(get_n_cells());
+  for (std::size_t i = 0; i < sweep_planes.size(); i++) {
+    for (std::size_t j = i; j < i + 3 && j < sweep_planes.size(); j++) {
+      const auto& next = sweep_planes[j];
+      for (const auto& cell : sweep_planes[i].cells) {
+        double t1 = next.nx * cell.first.X()  + next.ny * cell.first.Y();
+        double t2 = next.nx * cell.second.X() + next.ny * cell.second.Y();
+        double t_min = std::min(t1, t2) - max_distance;
+        double t_max = std::max(t1, t2) + max_distance;
+
+        auto it = std::lower_bound(next.cells.begin(), next.cells.end(), t_min,
+                                   [](const SweepCell& c, double t) {return c.t < t;});
+        for (; it != next.cells.end() && it->t <= t_max; ++it) {
+          if (it->row == cell.row) continue;
+          bool overlap = true;
+          for (int k = 0; k < 3 && overlap; k++) {
+            overlap = cell.box_min[k] <= it->box_max[k] && it->box_min[k] <= cell.box_max[k];
           }
+          if (!overlap) continue;
 
-          double distance = getMinDistanceBetweenSegments(plane_cell.second.wire().getFirstPoint(),
-                                                          plane_cell.second.wire().getSecondPoint(),
-                                                          next_plane_cell.second.wire().getFirstPoint(),
-                                                          next_plane_cell.second.wire().getSecondPoint());
-          // std::cout << c << " " << distance << " " << plane_cell.first() << " " << next_plane_cell.first() << std::endl;
+          double distance = getMinDistanceBetweenSegments(cell.first, cell.second,
+                                                          it->first, it->second);
           if (distance < max_distance) {
-            plane_cell.second.addAdjacentCell(&(next_plane_cell.second));
-            next_plane_cell.second.addAdjacentCell(&(plane_cell.second));
+            neighbours[cell.row].push_back(it->row);
+            neighbours[it->row].push_back(cell.row);
           }
         }
       }
     }
-    // break;
+  }
+
+  _adjacency_offsets.assign(1, 0);
+  _adjacency_ids.clear();
+  for (auto& n : neighbours) {
+    std::sort(n.begin(), n.end());
+    n.erase(std::unique(n.begin(), n.end()), n.end());
+    for (auto row : n) _adjacency_ids.push_back(get_cell_id(SANDTrackerCellIndex(row)));
+    _adjacency_offsets.push_back(_adjacency_ids.size());
+  }
+  link_adjacent_cells();
+}
+
+void SANDGeoManager::build_cell_index()
+{
+  _index_to_cell.clear();
+  _cell_index_to_plane.clear();
+  _cell_id_to_index.clear();
+
+  for (std::size_t i = 0; i < _planes.size(); i++) {
+    for (const auto& coord_id : _planes[i].getCoordToIDMap()) {
+      _cell_id_to_index[coord_id.second()] = _index_to_cell.size();
+      _index_to_cell.push_back(_planes[i].getCell(coord_id.second));
+      _cell_index_to_plane.push_back(SANDTrackerPlaneIndex(i));
+    }
+  }
+}
+
+void SANDGeoManager::link_adjacent_cells()
+{
+  _adjacency_indices.clear();
+  _adjacency_indices.reserve(_adjacency_ids.size());
+  for (const auto& id : _adjacency_ids)
+    _adjacency_indices.push_back(get_cell_index(id));
+
+  for (std::size_t row = 0; row < get_n_cells(); row++) {
+    auto& plane = _planes[_cell_index_to_plane[row]()];
+    plane.getCell(_index_to_cell[row]->first)->second.setAdjacentCells(
+        _adjacency_ids.data() + _adjacency_offsets[row],
+        _adjacency_ids.data() + _adjacency_offsets[row + 1]);
   }
 }
 
@@ -1140,6 +1355,54 @@ void SANDGeoManager::rearrange_planes()
   }
 }
 
+void SANDGeoManager::build_cell_lookup()
+{
+  _cell_lookup_planes.clear();
+  _cell_lookup_transverse.clear();
+  _cell_lookup_z.clear();
+  _cell_lookup_id.clear();
+
+  for (const auto& plane : _planes) {
+    if (plane.nCells() == 0) continue;
+
+    CellLookupPlane p;
+    p.x = plane.getPosition().X();
+    p.y = plane.getPosition().Y();
+    p.z = plane.getPosition().Z();
+    p.cos_rot = plane.getCosRotation();
+    p.sin_rot = plane.getSinRotation();
+    p.z_min = p.z - 0.5 * plane.getDimension().Z();
+    p.z_max = p.z + 0.5 * plane.getDimension().Z();
+    p.first_cell = _cell_lookup_id.size();
+
+    // _coord_to_id_map is already ordered by transverse coordinate
+    for (const auto& coord_id : plane.getCoordToIDMap()) {
+      const auto& cell = plane.getCell(coord_id.second)->second;
+      double h, w;
+      cell.size(h, w);
+      double wire_z = cell.wire().center().Z();
+      p.z_min = std::min(p.z_min, wire_z - 0.5 * h);
+      p.z_max = std::max(p.z_max, wire_z + 0.5 * h);
+
+      _cell_lookup_transverse.push_back(coord_id.first);
+      _cell_lookup_z.push_back(wire_z);
+      _cell_lookup_id.push_back(coord_id.second);
+    }
+    p.last_cell = _cell_lookup_id.size();
+    _cell_lookup_planes.push_back(p);
+  }
+
+  std::sort(_cell_lookup_planes.begin(), _cell_lookup_planes.end(),
+            [](const CellLookupPlane& p1, const CellLookupPlane& p2)
+              {return p1.z_min < p2.z_min;});
+
+  double z_max_running = -1E9;
+  for (auto& p : _cell_lookup_planes) {
+    z_max_running = std::max(z_max_running, p.z_max);
+    p.z_max_running = z_max_running;
+  }
+}
+
 void SANDGeoManager::set_wire_info()
 {
   geo_->CdTop();
@@ -1154,6 +1417,9 @@ void SANDGeoManager::set_wire_info()
     geometry = "DRIFT";
   }
   rearrange_planes();
+  for (auto& plane : _planes) plane.computeRotatedWirePositions();
+  build_cell_lookup();
+  build_cell_index();
   fill_adjacent_cells(geometry);
   std::cout << "writing wiremap_ info on separate file\n";
   std::cout << "wiremap_ size: " << wiremap_.size() << std::endl;
@@ -1189,7 +1455,8 @@ void SANDGeoManager::PrintModulesInfo(int verbose)
                                         << c.second.wire().getSecondPoint().Y() << " "
                                         << c.second.wire().getSecondPoint().Z() << std::endl;
         std::cout << "        Adjacent ids: ";
-        for (const auto& adj:c.second.getAdjacentCell()) std::cout << adj->id()() << " ";
+        for (auto adj = c.second.adjacentCellsBegin(); adj != c.second.adjacentCellsEnd(); ++adj)
+          std::cout << (*adj)() << " ";
         std::cout << std::endl;
 
       }
@@ -1239,6 +1506,9 @@ void SANDGeoManager::WriteMapOnFile(std::string fName,
 
 void Counter::IncrementCounter(std::string k)
 {
+  // the counter is shared by the digitization worker threads
+  static std::mutex counter_mutex;
+  std::lock_guard<std::mutex> lock(counter_mutex);
   hit_counter_[k]++;
 }
 
@@ -1256,8 +1526,57 @@ void SANDGeoManager::init(TGeoManager* const geo)
   wire_tranverse_position_map_.clear();
   _planes.clear();
   _id_to_plane.clear();
+  _cell_lookup_planes.clear();
+  _cell_lookup_transverse.clear();
+  _cell_lookup_z.clear();
+  _cell_lookup_id.clear();
+  _index_to_cell.clear();
+  _cell_index_to_plane.clear();
+  _cell_id_to_index.clear();
+  _adjacency_offsets.clear();
+  _adjacency_ids.clear();
+  _adjacency_indices.clear();
+
+  compile_regexes();
+
+  uint64_t hash = compute_geometry_hash(geo_);
+  std::string cache_file = get_cache_file_name(hash);
+  if (!rebuild_geo_cache_ && read_cache(cache_file, hash)) return;
+
   set_ecal_info();
+  build_ecal_neighbours();
   set_wire_info();
+  write_cache(cache_file, hash);
+}
+
+void SANDGeoManager::init_tracker(const std::vector<SANDTrackerPlane>& planes,
+                                  const std::string& geometry)
+{
+  geo_ = 0;
+  _planes = planes;
+  _id_to_plane.clear();
+  _adjacency_offsets.clear();
+  _adjacency_ids.clear();
+  _adjacency_indices.clear();
+
+  rearrange_planes();
+  for (auto& plane : _planes) {
+    // the cells still point to the planes they were added to
+    for (auto& id_cell : plane.getIdToCellMap()) id_cell.second.setPlane(&plane);
+    plane.computeRotatedWirePositions();
+  }
+  build_cell_lookup();
+  build_cell_index();
+  fill_adjacent_cells(geometry);
+}
+
+void SANDGeoManager::compile_regexes() const
+{
+  for (auto regex : {&stt_tube_regex_, &stt_plane_regex_, &stt_module_regex_,
+                     &stt_supermodule_regex_, &wire_regex_, &drift_plane_regex_,
+                     &drift_chamber_regex_, &module_regex_,
+                     &supermodule_regex_})
+    delete regex->MatchS("");
 }
 
 void SANDGeoManager::SetGeoCurrentPoint(double x, double y, double z) const
@@ -1399,8 +1718,7 @@ double SANDGeoManager::GetHitCellDistance(TVector2 rotated_yz_hit_position,
                                         std::map<SANDTrackerCellID, SANDTrackerCell>::const_iterator cell_it, 
                                         const SANDTrackerPlane& plane) const
 {
-  TVector2 global_wire_xy_position(cell_it->second.wire().center().X(), cell_it->second.wire().center().Y());
-  TVector2 rotated_wire_2d_position = GlobalToRotated(global_wire_xy_position, plane);
+  const TVector2& rotated_wire_2d_position = cell_it->second.rotatedWirePosition();
   
   TVector2 rotated_yz_wire_position(rotated_wire_2d_position.Y(), 
                                     cell_it->second.wire().center().Z() - plane.getPosition().Z());
@@ -1457,22 +1775,66 @@ SANDTrackerCellID SANDGeoManager::GetClosestCellToHit(TVector3 hit_center, const
   return (distance1 < distance2) ? cell_it->first : next_cell_it->first;
 }
 
+SANDTrackerCellID SANDGeoManager::get_closest_cell_in_lookup(
+    const CellLookupPlane& p, double x, double y, double z,
+    double& distance) const
+{
+  // same rotated frame as GlobalToRotated
+  double transverse_coord = -(x - p.x) * p.sin_rot + (y - p.y) * p.cos_rot;
+
+  auto first = _cell_lookup_transverse.cbegin() + p.first_cell;
+  auto last  = _cell_lookup_transverse.cbegin() + p.last_cell;
+  std::size_t i = std::lower_bound(first, last, transverse_coord) -
+                  _cell_lookup_transverse.cbegin();
+
+  // STT planes are made of two staggered layers of tubes: the closest wire
+  // in the (transverse, z) plane is within two positions of the lower bound
+  std::size_t begin = (i >= p.first_cell + 2) ? i - 2 : p.first_cell;
+  std::size_t end   = std::min(i + 2, p.last_cell);
+
+  SANDTrackerCellID closest(-999);
+  distance = 1E9;
+  for (std::size_t j = begin; j < end; j++) {
+    double dt = transverse_coord - _cell_lookup_transverse[j];
+    double dz = z - _cell_lookup_z[j];
+    double d = sqrt(dt * dt + dz * dz);
+    if (d < distance) {
+      distance = d;
+      closest = _cell_lookup_id[j];
+    }
+  }
+  return closest;
+}
+
 SANDTrackerCellID SANDGeoManager::get_stt_tube_id(double x, double y, double z) const
 {
-  if (geo_ == 0) {
-    std::cout << "ERROR: TGeoManager pointer not initialized" << std::endl;
+  if (_cell_lookup_planes.empty()) {
+    std::cout << "ERROR: cell lookup index not initialized" << std::endl;
     return -999;
   }
 
-  TGeoNode* node = geo_->FindNode(x, y, z);
-
-  TString node_path = gGeoManager->GetPath();
-  SANDTrackerPlaneID stt_plane_unique_id = get_stt_plane_id(node_path);
-
-  auto& plane = _planes.at(GetPlaneIndex(stt_plane_unique_id)());
-
-  TVector3 hit_center(x, y, z);
-  return GetClosestCellToHit(hit_center, plane, true);
+  // first plane starting after z: candidates are the ones before it whose
+  // z range still reaches z
+  auto it = std::upper_bound(_cell_lookup_planes.cbegin(),
+                             _cell_lookup_planes.cend(), z,
+                             [](double value, const CellLookupPlane& p)
+                               {return value < p.z_min;});
+
+  SANDTrackerCellID closest(-999);
+  double min_distance = 1E9;
+  while (it != _cell_lookup_planes.cbegin()) {
+    --it;
+    if (it->z_max_running < z) break;
+    if (it->z_max < z) continue;
+
+    double distance;
+    SANDTrackerCellID cell = get_closest_cell_in_lookup(*it, x, y, z, distance);
+    if (distance < min_distance) {
+      min_distance = distance;
+      closest = cell;
+    }
+  }
+  return closest;
 }
 
 long SANDGeoManager::print_stt_tube_id(double x, double y, double z) const
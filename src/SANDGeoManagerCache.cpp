@@ -0,0 +1,405 @@
+/*Binary cache of the SANDGeoManager content (ECAL cells, tracker planes,
+cells, wires and cell adjacency), keyed by a hash of the TGeo geometry.
+The file is a flat sequence of fixed size records and it is read through
+a read-only memory mapping*/
+
+#include "SANDGeoManager.h"
+
+#include <TGeoBBox.h>
+#include <TGeoMatrix.h>
+#include <TGeoVolume.h>
+#include <TList.h>
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace
+{
+const char cache_magic[8] = {'S', 'A', 'N', 'D', 'G', 'E', 'O', '\0'};
+
+// to be increased any time the layout of the cache file or the code
+// building the cells, planes and wires changes. The geometry hash covers
+// the TGeo volumes and nodes and the constants of sand_geometry used to
+// build the tables (regular expressions of the volume names, ECAL
+// segmentation), not the code.
+// - 1: first version
+// - 2: adjacency stored and read back in CSR row order, constants of
+//      sand_geometry in the hash
+const uint32_t cache_version = 2;
+
+// FNV-1a
+class Hash
+{
+  uint64_t h_ = 14695981039346656037ULL;
+
+ public:
+  void add(const void* data, std::size_t size)
+  {
+    auto bytes = static_cast<const unsigned char*>(data);
+    for (std::size_t i = 0; i < size; i++) {
+      h_ ^= bytes[i];
+      h_ *= 1099511628211ULL;
+    }
+  }
+  void add(const char* s)
+  {
+    if (s) add(s, strlen(s));
+  }
+  void add(double v)
+  {
+    add(&v, sizeof(v));
+  }
+  uint64_t value() const
+  {
+    return h_;
+  }
+};
+
+class Writer
+{
+  std::ofstream& out_;
+
+ public:
+  Writer(std::ofstream& out) : out_(out) {}
+  template <typename T>
+  void put(T v)
+  {
+    out_.write(reinterpret_cast<const char*>(&v), sizeof(T));
+  }
+  void put(const TVector3& v)
+  {
+    put(v.X());
+    put(v.Y());
+    put(v.Z());
+  }
+};
+
+class Reader
+{
+  const char* pos_;
+  const char* end_;
+  bool ok_ = true;
+
+ public:
+  Reader(const char* begin, std::size_t size) : pos_(begin), end_(begin + size)
+  {
+  }
+  bool ok() const
+  {
+    return ok_;
+  }
+  template <typename T>
+  T get()
+  {
+    T v{};
+    if (!ok_ || pos_ + sizeof(T) > end_) {
+      ok_ = false;
+      return v;
+    }
+    memcpy(&v, pos_, sizeof(T));
+    pos_ += sizeof(T);
+    return v;
+  }
+  TVector3 get_vector()
+  {
+    double x = get<double>();
+    double y = get<double>();
+    double z = get<double>();
+    return TVector3(x, y, z);
+  }
+};
+
+void put_wire(Writer& w, const SANDWireInfo& wire)
+{
+  w.put<uint64_t>(wire.id()());
+  w.put(wire.x());
+  w.put(wire.y());
+  w.put(wire.z());
+  w.put(wire.center());
+  w.put(wire.length());
+  w.put<int32_t>(static_cast<int32_t>(wire.orientation()));
+  w.put<int32_t>(static_cast<int32_t>(wire.readout_end()));
+  w.put<int32_t>(static_cast<int32_t>(wire.type()));
+  w.put(wire.ax());
+  w.put(wire.ay());
+  w.put(wire.az());
+  auto points = wire.getPoints();
+  w.put<uint32_t>(points.size());
+  for (const auto& p : points) w.put(p);
+}
+
+SANDWireInfo get_wire(Reader& r)
+{
+  SANDWireInfo wire;
+  wire.id(SANDWireID(r.get<uint64_t>()));
+  wire.x(r.get<double>());
+  wire.y(r.get<double>());
+  wire.z(r.get<double>());
+  wire.center(r.get_vector());
+  wire.length(r.get<double>());
+  wire.orientation(static_cast<SANDWireInfo::Orient>(r.get<int32_t>()));
+  wire.readout_end(static_cast<SANDWireInfo::ReadoutEnd>(r.get<int32_t>()));
+  wire.type(static_cast<SANDWireInfo::Type>(r.get<int32_t>()));
+  wire.ax(r.get<double>());
+  wire.ay(r.get<double>());
+  wire.az(r.get<double>());
+  uint32_t npoints = r.get<uint32_t>();
+  for (uint32_t i = 0; i < npoints && r.ok(); i++) wire.setPoint(r.get_vector());
+  return wire;
+}
+}  // namespace
+
+bool SANDGeoManager::rebuild_geo_cache_ = false;
+
+uint64_t SANDGeoManager::compute_geometry_hash(TGeoManager* const geo)
+{
+  Hash h;
+  h.add(&cache_version, sizeof(cache_version));
+
+  // constants used to decode the volume names and to segment the ECAL
+  namespace chamber = sand_geometry::chamber;
+  namespace stt = sand_geometry::stt;
+  namespace ecal = sand_geometry::ecal;
+  for (auto regex : {chamber::wire_regex_string,
+                     chamber::drift_plane_regex_string,
+                     chamber::drift_chamber_regex_string,
+                     chamber::module_regex_string,
+                     chamber::supermodule_regex_string,
+                     stt::stt_single_tube_regex_string,
+                     stt::stt_plane_regex_string, stt::stt_module_regex_string,
+                     stt::stt_supermodule_regex_string})
+    h.add(regex);
+  for (auto name : {sand_geometry::path_internal_volume,
+                    ecal::path_barrel_template, ecal::path_endcapL_template,
+                    ecal::path_endcapR_template, ecal::barrel_module_name,
+                    ecal::endcap_module_name})
+    h.add(name);
+  h.add(&ecal::number_of_layers, sizeof(int));
+  h.add(&ecal::number_of_cells_per_barrel_layer, sizeof(int));
+  h.add(&ecal::number_of_barrel_modules, sizeof(int));
+  h.add(&ecal::number_of_cells_per_endcap_layer, sizeof(int));
+  h.add(ecal::layer_thickness, sizeof(ecal::layer_thickness));
+  h.add(ecal::endcap_module_ids, sizeof(ecal::endcap_module_ids));
+
+  TIter next(geo->GetListOfVolumes());
+  while (TGeoVolume* volume = static_cast<TGeoVolume*>(next())) {
+    h.add(volume->GetName());
+    auto shape = static_cast<TGeoBBox*>(volume->GetShape());
+    if (shape) {
+      h.add(shape->ClassName());
+      h.add(shape->GetDX());
+      h.add(shape->GetDY());
+      h.add(shape->GetDZ());
+    }
+    for (int i = 0; i < volume->GetNdaughters(); i++) {
+      auto node = volume->GetNode(i);
+      h.add(node->GetName());
+      auto matrix = node->GetMatrix();
+      h.add(matrix->GetTranslation(), 3 * sizeof(double));
+      h.add(matrix->GetRotationMatrix(), 9 * sizeof(double));
+    }
+  }
+  return h.value();
+}
+
+std::string SANDGeoManager::get_cache_file_name(uint64_t hash)
+{
+  const char* dir = getenv("SAND_GEO_CACHE_DIR");
+  std::stringstream name;
+  name << ((dir && strlen(dir) > 0) ? dir : ".") << "/sand_geo_cache_"
+       << std::hex << hash << ".bin";
+  return name.str();
+}
+
+void SANDGeoManager::write_cache(const std::string& fname,
+                                 uint64_t hash) const
+{
+  // unique temporary file: jobs sharing the cache directory may write
+  // the same cache at the same time. Readable by all as the cache
+  std::vector<char> tmp_template(fname.begin(), fname.end());
+  const char suffix[] = ".XXXXXX";
+  tmp_template.insert(tmp_template.end(), suffix, suffix + sizeof(suffix));
+  int fd = mkstemp(tmp_template.data());
+  if (fd < 0) {
+    std::cout << "WARNING: cannot write geometry cache " << fname << std::endl;
+    return;
+  }
+  fchmod(fd, 0644);
+  close(fd);
+  std::string tmp_name(tmp_template.data());
+
+  std::ofstream out(tmp_name, std::ios::binary | std::ios::trunc);
+  if (!out) {
+    std::cout << "WARNING: cannot write geometry cache " << fname << std::endl;
+    remove(tmp_name.c_str());
+    return;
+  }
+  Writer w(out);
+
+  out.write(cache_magic, sizeof(cache_magic));
+  w.put(cache_version);
+  w.put<uint64_t>(hash);
+
+  // ECAL
+  w.put<uint64_t>(cellmap_.size());
+  for (auto cell : cellmap_) {
+    w.put<int32_t>(cell.second.id());
+    w.put(cell.second.x());
+    w.put(cell.second.y());
+    w.put(cell.second.z());
+    w.put(cell.second.length());
+    w.put<int32_t>(static_cast<int32_t>(cell.second.orientation()));
+  }
+
+  // tracker planes and cells, planes already sorted by z
+  w.put<uint64_t>(_planes.size());
+  for (const auto& plane : _planes) {
+    w.put<uint64_t>(plane.uid()());
+    w.put<uint64_t>(plane.lid()());
+    w.put(plane.getRotation());
+    w.put(plane.getPosition());
+    w.put(plane.getDimension());
+    w.put<uint64_t>(plane.getCoordToIDMap().size());
+    for (const auto& coord_id : plane.getCoordToIDMap()) {
+      const auto& cell = plane.getCell(coord_id.second)->second;
+      double height, width;
+      cell.size(height, width);
+      w.put(coord_id.first);
+      w.put<uint64_t>(cell.id()());
+      w.put(width);
+      w.put(height);
+      w.put(cell.driftVelocity());
+      put_wire(w, cell.wire());
+    }
+  }
+
+  // adjacency
+  for (const auto& plane : _planes) {
+    for (const auto& coord_id : plane.getCoordToIDMap()) {
+      const auto& cell = plane.getCell(coord_id.second)->second;
+      w.put<uint32_t>(cell.nAdjacentCells());
+      for (auto adj = cell.adjacentCellsBegin(); adj != cell.adjacentCellsEnd(); ++adj)
+        w.put<uint64_t>((*adj)());
+    }
+  }
+
+  out.close();
+  if (!out || rename(tmp_name.c_str(), fname.c_str()) != 0) {
+    std::cout << "WARNING: cannot write geometry cache " << fname << std::endl;
+    remove(tmp_name.c_str());
+    return;
+  }
+  std::cout << "geometry cache written on " << fname << std::endl;
+}
+
+bool SANDGeoManager::read_cache(const std::string& fname, uint64_t hash)
+{
+  int fd = open(fname.c_str(), O_RDONLY);
+  if (fd < 0) return false;
+
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size == 0) {
+    close(fd);
+    return false;
+  }
+  std::size_t size = st.st_size;
+  void* data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) return false;
+
+  Reader r(static_cast<const char*>(data), size);
+
+  bool ok = true;
+  char magic[sizeof(cache_magic)];
+  for (auto& c : magic) c = r.get<char>();
+  if (memcmp(magic, cache_magic, sizeof(cache_magic)) != 0 ||
+      r.get<uint32_t>() != cache_version ||
+      r.get<uint64_t>() != hash) {
+    ok = false;
+  }
+
+  // ECAL
+  uint64_t ncells = ok ? r.get<uint64_t>() : 0;
+  for (uint64_t i = 0; i < ncells && r.ok(); i++) {
+    int id = r.get<int32_t>();
+    double x = r.get<double>();
+    double y = r.get<double>();
+    double z = r.get<double>();
+    double length = r.get<double>();
+    auto orientation =
+        static_cast<SANDECALCellInfo::Orient>(r.get<int32_t>());
+    cellmap_[id] = SANDECALCellInfo(id, x, y, z, length, orientation);
+  }
+
+  // tracker planes and cells. Planes are created in place: cells keep a
+  // pointer to their plane
+  uint64_t nplanes = ok ? r.get<uint64_t>() : 0;
+  _planes.resize(nplanes);
+  for (uint64_t i = 0; i < nplanes && r.ok(); i++) {
+    SANDTrackerPlaneID uid(r.get<uint64_t>());
+    SANDTrackerPlaneID lid(r.get<uint64_t>());
+    auto& plane = _planes[i];
+    plane = SANDTrackerPlane(uid, lid);
+    plane.setRotation(r.get<double>());
+    plane.setPosition(r.get_vector());
+    plane.setDimension(r.get_vector());
+    plane.computePlaneVertices();
+    plane.computeMaxTransversePosition();
+
+    uint64_t nplane_cells = r.get<uint64_t>();
+    for (uint64_t j = 0; j < nplane_cells && r.ok(); j++) {
+      double transverse = r.get<double>();
+      SANDTrackerCellID id(r.get<uint64_t>());
+      double width = r.get<double>();
+      double height = r.get<double>();
+      double drift_velocity = r.get<double>();
+      SANDWireInfo wire = get_wire(r);
+      plane.addCell(transverse,
+                    SANDTrackerCell(id, wire, width, height, drift_velocity));
+    }
+    _id_to_plane[plane.uid()] = _planes.cbegin() + i;
+  }
+
+  // adjacency, in CSR row order
+  _adjacency_offsets.assign(1, 0);
+  for (const auto& plane : _planes) {
+    for (std::size_t j = 0; j < plane.getCoordToIDMap().size() && r.ok(); j++) {
+      uint32_t nadjacent = r.get<uint32_t>();
+      for (uint32_t k = 0; k < nadjacent && r.ok(); k++)
+        _adjacency_ids.push_back(SANDTrackerCellID(r.get<uint64_t>()));
+      _adjacency_offsets.push_back(_adjacency_ids.size());
+    }
+  }
+
+  munmap(data, size);
+
+  if (!ok || !r.ok()) {
+    if (ok) std::cout << "WARNING: corrupted geometry cache " << fname << std::endl;
+    cellmap_.clear();
+    _planes.clear();
+    _id_to_plane.clear();
+    _adjacency_offsets.clear();
+    _adjacency_ids.clear();
+    return false;
+  }
+
+  build_ecal_neighbours();
+  for (auto& plane : _planes) plane.computeRotatedWirePositions();
+  build_cell_lookup();
+  build_cell_index();
+  link_adjacent_cells();
+
+  std::cout << "geometry loaded from cache " << fname << std::endl;
+  return true;
+}
@@ -3,10 +3,21 @@
 #include <TFile.h>
 #include <TMarker.h>
 #include <TArrow.h>
+#include <TROOT.h>
 
+#include <algorithm>
+#include <cerrno>
 #include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <exception>
 #include <fstream>
 #include <iostream>
+#include <limits>
+#include <mutex>
+#include <string>
+#include <thread>
 #include <vector>
 #include <map>
 #include <unordered_map>
@@ -18,8 +29,150 @@
 #include "SANDTrackerDigitCollection.h"
 #include "utils.h"
 
+// tracklets of a cluster
+struct ClusterTracklets
+{
+  std::vector<TVectorD> minima;
+  std::map<SANDTrackerDigitID, double> digitId_to_drift_time;
+};
+
+/*
+  Find the tracklets of the clusters on nthreads threads, one
+  TrackletFinder per cluster. Each thread starts from a block of
+  consecutive clusters and, once done, steals from the back of the
+  blocks of the others. The results are in the order of the clusters
+*/
+std::vector<ClusterTracklets> FindTrackletsParallel(const std::vector<const SANDTrackerCluster*>& clusters,
+                                                    const SANDTrackerDigitCollection& digit_collection,
+                                                    int* volume_parameters,
+                                                    unsigned int nthreads)
+{
+  std::vector<ClusterTracklets> results(clusters.size());
+  if (clusters.empty()) return results;
+
+  nthreads = std::max(1u, std::min<unsigned int>(nthreads, clusters.size()));
+  if (nthreads > 1) ROOT::EnableThreadSafety();
+
+  std::vector<std::deque<unsigned int>> queues(nthreads);
+  std::vector<std::mutex> queue_mutex(nthreads);
+  for (auto i = 0u; i < clusters.size(); i++)
+    queues[static_cast<std::size_t>(i) * nthreads / clusters.size()].push_back(i);
+
+  auto next_cluster = [&](unsigned int self, unsigned int& index) {
+    for (auto k = 0u; k < nthreads; k++) {
+      auto victim = (self + k) % nthreads;
+      std::lock_guard<std::mutex> lock(queue_mutex[victim]);
+      auto& queue = queues[victim];
+      if (queue.empty()) continue;
+      if (victim == self) {
+        index = queue.front();
+        queue.pop_front();
+      } else {
+        index = queue.back();
+        queue.pop_back();
+      }
+      return true;
+    }
+    return false;
+  };
+
+  std::mutex error_mutex;
+  std::exception_ptr error;
+
+  auto worker = [&](unsigned int self) {
+    try {
+      unsigned int index;
+      while (next_cluster(self, index)) {
+        TrackletFinder traklet_finder;
+        traklet_finder.SetVolumeParameters(volume_parameters);
+        traklet_finder.SetSigmaPosition(0.2);
+        traklet_finder.SetSigmaAngle(0.2);
+        traklet_finder.SetDigitCollection(digit_collection);
+        traklet_finder.SetCells(*clusters[index]);
+        results[index].minima = traklet_finder.FindTracklets();
+        results[index].digitId_to_drift_time = traklet_finder.GetDigitToDriftTimeMap();
+      }
+    } catch (...) {
+      std::lock_guard<std::mutex> lock(error_mutex);
+      if (!error) error = std::current_exception();
+    }
+  };
+
+  if (nthreads == 1) {
+    worker(0);
+  } else {
+    std::vector<std::thread> workers;
+    for (auto k = 0u; k < nthreads; k++) workers.emplace_back(worker, k);
+    for (auto& w : workers) w.join();
+  }
+
+  if (error) std::rethrow_exception(error);
+
+  return results;
+}
+
+void help_measurements()
+{
+  std::cout << "usage: Measurements <event> <MC file> <digit file> "
+               "[nthreads] [-clustering <method>] [-rebuild_geo_cache]\n";
+  std::cout << "    - nthreads: number of threads of the tracklet search "
+               "(default: all the cores)\n";
+  std::cout << "    - clustering: in_plane, cell_adjacency (default), "
+               "connected_components or cellular_automaton\n";
+  std::cout << "    - rebuild_geo_cache: ignore the geometry cache "
+               "(sand_geo_cache_<hash>.bin in $SAND_GEO_CACHE_DIR or in the "
+               "current directory) and rebuild it\n";
+}
+
+// clustering method from its command line name, false if unknown
+bool get_clustering_method(const std::string& name,
+                           SANDTrackerClusterCollection::ClusteringMethod& method)
+{
+  using Method = SANDTrackerClusterCollection::ClusteringMethod;
+  static const std::map<std::string, Method> methods = {
+      {"in_plane", Method::kProximityInPlane},
+      {"cell_adjacency", Method::kCellAdjacency},
+      {"connected_components", Method::kConnectedComponents},
+      {"cellular_automaton", Method::kCellularAutomaton}};
+  auto it = methods.find(name);
+  if (it == methods.end()) return false;
+  method = it->second;
+  return true;
+}
+
 int main(int argc, char* argv[])
 {
+  if (argc < 4) {
+    help_measurements();
+    return -1;
+  }
+
+  // optional number of threads, all the cores by default
+  unsigned int nthreads = std::thread::hardware_concurrency();
+  auto clustering_method = SANDTrackerClusterCollection::ClusteringMethod::kCellAdjacency;
+  for (int i = 4; i < argc; i++) {
+    if (strcmp(argv[i], "-rebuild_geo_cache") == 0) {
+      SANDGeoManager::SetRebuildGeoCache(true);
+    } else if (strcmp(argv[i], "-clustering") == 0) {
+      if (i + 1 == argc || !get_clustering_method(argv[++i], clustering_method)) {
+        help_measurements();
+        return -1;
+      }
+    } else {
+      // an integer, values below 1 are clamped to 1
+      char* end = nullptr;
+      errno = 0;
+      long n = std::strtol(argv[i], &end, 10);
+      if (end == argv[i] || *end != '\0' || errno == ERANGE) {
+        std::cout << "invalid number of threads: " << argv[i] << "\n";
+        help_measurements();
+        return -1;
+      }
+      nthreads = std::max(1L, std::min<long>(n, std::numeric_limits<unsigned int>::max()));
+    }
+  }
+  if (nthreads == 0) nthreads = 1;
+
   TFile f(argv[2], "READ");
   TGeoManager* geo = 0;
   geo = (TGeoManager*)f.Get("EDepSimGeometry");
@@ -56,14 +209,9 @@ int main(int argc, char* argv[])
     gStyle->SetOptStat(0);
     int p[9] = {100, -2000, 2000, 100, -3200, -2300, 100, 23800, 26000};
 
-    SANDTrackerDigitCollection::FillMap(digits);
-    SANDTrackerClusterCollection clusters(&sand_geo, SANDTrackerDigitCollection::GetDigits(), SANDTrackerClusterCollection::ClusteringMethod::kCellAdjacency);
-    auto digit_map =  SANDTrackerDigitCollection::GetDigits();
-    
-    TrackletFinder traklet_finder;
-    traklet_finder.SetVolumeParameters(p);
-    traklet_finder.SetSigmaPosition(0.2);
-    traklet_finder.SetSigmaAngle(0.2);
+    SANDTrackerDigitCollection digit_collection(*digits, &sand_geo);
+    SANDTrackerClusterCollection clusters(&sand_geo, digit_collection, clustering_method);
+    const auto& digit_map = digit_collection.GetDigits();
     
 
     TCanvas* canvas_cluster = new TCanvas("canvas_cluster","canvas_cluster",2000,1000);
@@ -80,174 +228,180 @@ int main(int argc, char* argv[])
 
     std::map<double, std::vector<TVectorD>> z_to_tracklets;
 
-    int color = 2;
+    // the first 499 clusters of each container
+    std::vector<const SANDTrackerCluster*> clusters_to_fit;
     for (const auto& container:clusters.GetContainers()) {
       int gg = 0;
       for (const auto& cluster_in_container:container->GetClusters()) {
-        std::cout << (double)gg / container->GetClusters().size() * 100 << std::endl;
         gg++;
         if (gg == 500) break;
-        if (color > 9) color = 2;
-        
-
-        traklet_finder.SetCells(cluster_in_container);
-        auto minima = traklet_finder.FindTracklets();
-        // Draw tracklets
-        if (minima.size() != 0) {
-          canvas_cluster->cd();
-          std::sort(minima.begin(), minima.end(),
-                    [](TVectorD v1, TVectorD v2){ return v1[4] < v2[4];});
-          double z_start = cluster_in_container.GetZ();
-          for (uint trk = 0; trk < minima.size(); trk++) {
-            h_minima1000->Fill(minima[trk][4]);
-            h_minima_100->Fill(minima[trk][4]);
-            h_minima_0_1->Fill(minima[trk][4]);
-            h_minima_0_0001->Fill(minima[trk][4]);
-            
-            if (minima[trk][4] < 1E-2) {
-              // std::cout << minima[trk][0] << " " << minima[trk][2] << std::endl;
-              
-              z_to_tracklets[cluster_in_container.GetZ()].push_back(minima[trk]);
-
-              TVector2 start_tracklet_yz(z_start, minima[trk][1]);
-              TVector2 start_tracklet_xz(z_start, minima[trk][0]);
-              double z_end = z_start + 5 * cos(minima[trk][3]);
-              double y_end = minima[trk][1] + 5 * sin(minima[trk][3]);
-              double x_end = minima[trk][0] + 5 * cos(minima[trk][2]);
-              TVector2 end_tracklet_yz(z_end, y_end);
-              TVector2 end_tracklet_xz(z_end, x_end);
-              
-              TLine* line_yz_tracklet = new TLine(start_tracklet_yz.X(), start_tracklet_yz.Y(), end_tracklet_yz.X(), end_tracklet_yz.Y());
-              TLine* line_xz_tracklet = new TLine(start_tracklet_xz.X(), start_tracklet_xz.Y(), end_tracklet_xz.X(), end_tracklet_xz.Y());
-              line_yz_tracklet->SetLineColor(color);
-              line_yz_tracklet->SetLineWidth(1);
-              line_xz_tracklet->SetLineColor(color);
-              line_xz_tracklet->SetLineWidth(1);
-              
-              canvas_cluster->cd(1);
-              line_yz_tracklet->Draw();
-              canvas_cluster->cd(2);
-              line_xz_tracklet->Draw();
-            }
-          }
-        }
-
-        auto digitId_to_drift_time = traklet_finder.GetDigitToDriftTimeMap();
-        
-        // Draw cells of all digits
-        for (auto digit:digit_map) {
-          auto cell = sand_geo.get_cell_info(SANDTrackerCellID(digit.did));
-          double h,w;
-          cell->second.size(w,h);
-          TBox* box_yz = new TBox(cell->second.wire().center().Z() - h/2., cell->second.wire().center().Y() - w/2., cell->second.wire().center().Z() + h/2., cell->second.wire().center().Y() + w/2.);
-          TBox* box_xz = new TBox(cell->second.wire().center().Z() - h/2., cell->second.wire().center().X() - w/2., cell->second.wire().center().Z() + h/2., cell->second.wire().center().X() + w/2.);
-          box_yz->SetFillStyle(0);
-          box_yz->SetLineColor(1);
-          box_yz->SetLineWidth(1);
-          box_xz->SetFillStyle(0);
-          box_xz->SetLineColor(1);
-          box_xz->SetLineWidth(1);
-          canvas_cluster->cd(1);
-          box_yz->Draw();
-          canvas_cluster->cd(2);
-          box_xz->Draw();
-        }
+        clusters_to_fit.push_back(&cluster_in_container);
+      }
+    }
 
-        std::vector<SANDTrackerDigitID> digits_cluster = cluster_in_container.GetDigits();
-        for (uint d = 0; d < digits_cluster.size(); d++) {
-          canvas_cluster->cd();
-
-          auto digit = SANDTrackerDigitCollection::GetDigit(digits_cluster[d]);
-          auto cell = sand_geo.get_cell_info(SANDTrackerCellID(digit.did));
-
-          // Draw lines connecting cells in cluster
-          // if (d < digits_cluster.size() - 1) {
-          //   auto next_digit = SANDTrackerDigitCollection::GetDigit(digits_cluster[d+1]);
-          //   auto next_cell  = sand_geo.get_cell_info(SANDTrackerCellID(next_digit.did));
-          //   TLine* line_yz1 = new TLine(cell->second.wire().center().Z(), cell->second.wire().center().Y(), next_cell->second.wire().center().Z(), next_cell->second.wire().center().Y());
-          //   canvas_cluster->cd();
-          //   line_yz1->SetLineWidth(1);
-          //   line_yz1->SetLineColor(color);
-          //   line_yz1->Draw();
-          // }
-          
-          // Draw cells of cluster
-          double h,w;
-          cell->second.size(w,h);
-          TBox* box_yz = new TBox(cell->second.wire().center().Z() - h/2., cell->second.wire().center().Y() - w/2., cell->second.wire().center().Z() + h/2., cell->second.wire().center().Y() + w/2.);
-          TBox* box_xz = new TBox(cell->second.wire().center().Z() - h/2., cell->second.wire().center().X() - w/2., cell->second.wire().center().Z() + h/2., cell->second.wire().center().X() + w/2.);
-          box_yz->SetFillStyle(0);
-          box_yz->SetLineColor(color);
-          box_yz->SetLineWidth(1);
-          box_xz->SetFillStyle(0);
-          box_xz->SetLineColor(color);
-          box_xz->SetLineWidth(1);
-          canvas_cluster->cd(1);
-          box_yz->Draw();
-          canvas_cluster->cd(2);
-          box_xz->Draw();
-          
+    std::cout << "Finding tracklets of " << clusters_to_fit.size() << " clusters on " << nthreads << " threads" << std::endl;
+    auto tracklets = FindTrackletsParallel(clusters_to_fit, digit_collection, p, nthreads);
 
-          // Draw reco drift time of digits in cluster
-          TEllipse* el_yz_comp = new TEllipse(cell->second.wire().center().Z(), cell->second.wire().center().Y(), 
-                                sand_reco::stt::wire_radius + cell->second.driftVelocity() * digitId_to_drift_time[digits_cluster[d]]);
-          TEllipse* el_xz_comp = new TEllipse(cell->second.wire().center().Z(), cell->second.wire().center().X(), 
-                                sand_reco::stt::wire_radius + cell->second.driftVelocity() * digitId_to_drift_time[digits_cluster[d]]);
-          el_yz_comp->SetFillStyle(0);
-          el_yz_comp->SetLineColor(color);
-          el_yz_comp->SetLineWidth(1);
-          el_xz_comp->SetFillStyle(0);
-          el_xz_comp->SetLineColor(color);
-          el_xz_comp->SetLineWidth(1);
-          canvas_cluster->cd(1);
-          el_yz_comp->Draw();
-          canvas_cluster->cd(2);
-          el_xz_comp->Draw();
+    int color = 2;
+    for (auto c = 0u; c < clusters_to_fit.size(); c++) {
+      const auto& cluster_in_container = *clusters_to_fit[c];
+      if (color > 9) color = 2;
+
+      auto& minima = tracklets[c].minima;
+      // Draw tracklets
+      if (minima.size() != 0) {
+        canvas_cluster->cd();
+        std::sort(minima.begin(), minima.end(),
+                  [](TVectorD v1, TVectorD v2){ return v1[4] < v2[4];});
+        double z_start = cluster_in_container.GetZ();
+        for (uint trk = 0; trk < minima.size(); trk++) {
+          h_minima1000->Fill(minima[trk][4]);
+          h_minima_100->Fill(minima[trk][4]);
+          h_minima_0_1->Fill(minima[trk][4]);
+          h_minima_0_0001->Fill(minima[trk][4]);
           
-          // Draw true drift time of digits in cluster
-          TEllipse* el_yz = new TEllipse(cell->second.wire().center().Z(), cell->second.wire().center().Y(), 
-                                sand_reco::stt::wire_radius + cell->second.driftVelocity() * digit.drift_time);
-          TEllipse* el_xz = new TEllipse(cell->second.wire().center().Z(), cell->second.wire().center().X(), 
-                                sand_reco::stt::wire_radius + cell->second.driftVelocity() * digit.drift_time);
-          el_yz->SetFillStyle(0);
-          el_yz->SetLineWidth(1);
-          el_yz->SetLineColor(1);
-          el_xz->SetFillStyle(0);
-          el_xz->SetLineWidth(1);
-          el_xz->SetLineColor(1);
-          canvas_cluster->cd(1);
-          el_yz->Draw();
-          canvas_cluster->cd(2);
-          el_xz->Draw();
-
-          // Draw hit segments for the cluster
-          for (auto& kk:digit.hindex) {
-            const TG4HitSegment& hseg = ev->SegmentDetectors[digit.det].at(kk);
-            TLine* l_yz = new TLine(hseg.Start.Z(), hseg.Start.Y(), hseg.Stop.Z(), hseg.Stop.Y());
-            TLine* l_xz = new TLine(hseg.Start.Z(), hseg.Start.X(), hseg.Stop.Z(), hseg.Stop.X());
-            l_yz->SetLineColor(1);
-            l_xz->SetLineColor(1);
+          if (minima[trk][4] < 1E-2) {
+            // std::cout << minima[trk][0] << " " << minima[trk][2] << std::endl;
+            
+            z_to_tracklets[cluster_in_container.GetZ()].push_back(minima[trk]);
+
+            TVector2 start_tracklet_yz(z_start, minima[trk][1]);
+            TVector2 start_tracklet_xz(z_start, minima[trk][0]);
+            double z_end = z_start + 5 * cos(minima[trk][3]);
+            double y_end = minima[trk][1] + 5 * sin(minima[trk][3]);
+            double x_end = minima[trk][0] + 5 * cos(minima[trk][2]);
+            TVector2 end_tracklet_yz(z_end, y_end);
+            TVector2 end_tracklet_xz(z_end, x_end);
+            
+            TLine* line_yz_tracklet = new TLine(start_tracklet_yz.X(), start_tracklet_yz.Y(), end_tracklet_yz.X(), end_tracklet_yz.Y());
+            TLine* line_xz_tracklet = new TLine(start_tracklet_xz.X(), start_tracklet_xz.Y(), end_tracklet_xz.X(), end_tracklet_xz.Y());
+            line_yz_tracklet->SetLineColor(color);
+            line_yz_tracklet->SetLineWidth(1);
+            line_xz_tracklet->SetLineColor(color);
+            line_xz_tracklet->SetLineWidth(1);
+            
             canvas_cluster->cd(1);
-            l_yz->Draw();
+            line_yz_tracklet->Draw();
             canvas_cluster->cd(2);
-            l_xz->Draw();
+            line_xz_tracklet->Draw();
           }
-          
-          // h_res->Fill(digitId_to_drift_time[d] - digit.drift_time);
         }
-        color++;
-        canvas_cluster->Write();
-        canvas_cluster->Print("clu.pdf","pdf");
-        canvas_cluster->Clear();
+      }
 
-        canvas_cluster->Divide(2,1);
+      auto& digitId_to_drift_time = tracklets[c].digitId_to_drift_time;
+      
+      // Draw cells of all digits
+      for (auto digit:digit_map) {
+        auto cell = sand_geo.get_cell_info(SANDTrackerCellID(digit.did));
+        double h,w;
+        cell->second.size(w,h);
+        TBox* box_yz = new TBox(cell->second.wire().center().Z() - h/2., cell->second.wire().center().Y() - w/2., cell->second.wire().center().Z() + h/2., cell->second.wire().center().Y() + w/2.);
+        TBox* box_xz = new TBox(cell->second.wire().center().Z() - h/2., cell->second.wire().center().X() - w/2., cell->second.wire().center().Z() + h/2., cell->second.wire().center().X() + w/2.);
+        box_yz->SetFillStyle(0);
+        box_yz->SetLineColor(1);
+        box_yz->SetLineWidth(1);
+        box_xz->SetFillStyle(0);
+        box_xz->SetLineColor(1);
+        box_xz->SetLineWidth(1);
         canvas_cluster->cd(1);
-        h_cluster_yz->Draw();
+        box_yz->Draw();
         canvas_cluster->cd(2);
-        h_cluster_xz->Draw();
-        traklet_finder.Clear();
+        box_xz->Draw();
+      }
 
+      std::vector<SANDTrackerDigitID> digits_cluster = cluster_in_container.GetDigits();
+      for (uint d = 0; d < digits_cluster.size(); d++) {
+        canvas_cluster->cd();
+
+        auto digit = digit_collection.GetDigit(digits_cluster[d]);
+        auto cell = sand_geo.get_cell_info(SANDTrackerCellID(digit.did));
+
+        // Draw lines connecting cells in cluster
+        // if (d < digits_cluster.size() - 1) {
+        //   auto next_digit = digit_collection.GetDigit(digits_cluster[d+1]);
+        //   auto next_cell  = sand_geo.get_cell_info(SANDTrackerCellID(next_digit.did));
+        //   TLine* line_yz1 = new TLine(cell->second.wire().center().Z(), cell->second.wire().center().Y(), next_cell->second.wire().center().Z(), next_cell->second.wire().center().Y());
+        //   canvas_cluster->cd();
+        //   line_yz1->SetLineWidth(1);
+        //   line_yz1->SetLineColor(color);
+        //   line_yz1->Draw();
+        // }
+        
+        // Draw cells of cluster
+        double h,w;
+        cell->second.size(w,h);
+        TBox* box_yz = new TBox(cell->second.wire().center().Z() - h/2., cell->second.wire().center().Y() - w/2., cell->second.wire().center().Z() + h/2., cell->second.wire().center().Y() + w/2.);
+        TBox* box_xz = new TBox(cell->second.wire().center().Z() - h/2., cell->second.wire().center().X() - w/2., cell->second.wire().center().Z() + h/2., cell->second.wire().center().X() + w/2.);
+        box_yz->SetFillStyle(0);
+        box_yz->SetLineColor(color);
+        box_yz->SetLineWidth(1);
+        box_xz->SetFillStyle(0);
+        box_xz->SetLineColor(color);
+        box_xz->SetLineWidth(1);
+        canvas_cluster->cd(1);
+        box_yz->Draw();
+        canvas_cluster->cd(2);
+        box_xz->Draw();
+        
+
+        // Draw reco drift time of digits in cluster
+        TEllipse* el_yz_comp = new TEllipse(cell->second.wire().center().Z(), cell->second.wire().center().Y(), 
+                              sand_reco::stt::wire_radius + cell->second.driftVelocity() * digitId_to_drift_time[digits_cluster[d]]);
+        TEllipse* el_xz_comp = new TEllipse(cell->second.wire().center().Z(), cell->second.wire().center().X(), 
+                              sand_reco::stt::wire_radius + cell->second.driftVelocity() * digitId_to_drift_time[digits_cluster[d]]);
+        el_yz_comp->SetFillStyle(0);
+        el_yz_comp->SetLineColor(color);
+        el_yz_comp->SetLineWidth(1);
+        el_xz_comp->SetFillStyle(0);
+        el_xz_comp->SetLineColor(color);
+        el_xz_comp->SetLineWidth(1);
+        canvas_cluster->cd(1);
+        el_yz_comp->Draw();
+        canvas_cluster->cd(2);
+        el_xz_comp->Draw();
+        
+        // Draw true drift time of digits in cluster
+        TEllipse* el_yz = new TEllipse(cell->second.wire().center().Z(), cell->second.wire().center().Y(), 
+                              sand_reco::stt::wire_radius + cell->second.driftVelocity() * digit.drift_time);
+        TEllipse* el_xz = new TEllipse(cell->second.wire().center().Z(), cell->second.wire().center().X(), 
+                              sand_reco::stt::wire_radius + cell->second.driftVelocity() * digit.drift_time);
+        el_yz->SetFillStyle(0);
+        el_yz->SetLineWidth(1);
+        el_yz->SetLineColor(1);
+        el_xz->SetFillStyle(0);
+        el_xz->SetLineWidth(1);
+        el_xz->SetLineColor(1);
+        canvas_cluster->cd(1);
+        el_yz->Draw();
+        canvas_cluster->cd(2);
+        el_xz->Draw();
+
+        // Draw hit segments for the cluster
+        for (auto& kk:digit.hindex) {
+          const TG4HitSegment& hseg = ev->SegmentDetectors[digit.det].at(kk);
+          TLine* l_yz = new TLine(hseg.Start.Z(), hseg.Start.Y(), hseg.Stop.Z(), hseg.Stop.Y());
+          TLine* l_xz = new TLine(hseg.Start.Z(), hseg.Start.X(), hseg.Stop.Z(), hseg.Stop.X());
+          l_yz->SetLineColor(1);
+          l_xz->SetLineColor(1);
+          canvas_cluster->cd(1);
+          l_yz->Draw();
+          canvas_cluster->cd(2);
+          l_xz->Draw();
+        }
+        
+        // h_res->Fill(digitId_to_drift_time[d] - digit.drift_time);
       }
+      color++;
+      canvas_cluster->Write();
+      canvas_cluster->Print("clu.pdf","pdf");
+      canvas_cluster->Clear();
+
+      canvas_cluster->Divide(2,1);
+      canvas_cluster->cd(1);
+      h_cluster_yz->Draw();
+      canvas_cluster->cd(2);
+      h_cluster_xz->Draw();
+
     }
     canvas_cluster->Print("clu.pdf)","pdf");
     h_minima1000->Write();
@@ -0,0 +1,382 @@
+#include "SANDRecoLeastSquares.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+// in place Cholesky decomposition of the n x n symmetric matrix a: the
+// lower triangle is replaced by L, with a = L L^T
+bool cholesky(double* a, unsigned int n)
+{
+    for (auto j = 0u; j < n; j++) {
+        double d = a[j * n + j];
+        for (auto k = 0u; k < j; k++) d -= a[j * n + k] * a[j * n + k];
+        if (!(d > 0.)) return false;
+        d = std::sqrt(d);
+        a[j * n + j] = d;
+        for (auto i = j + 1; i < n; i++) {
+            double s = a[i * n + j];
+            for (auto k = 0u; k < j; k++) s -= a[i * n + k] * a[j * n + k];
+            a[i * n + j] = s / d;
+        }
+    }
+    return true;
+}
+
+// solve L L^T x = b, x holds b on input
+void cholesky_solve(const double* l, unsigned int n, double* x)
+{
+    for (auto i = 0u; i < n; i++) {
+        for (auto k = 0u; k < i; k++) x[i] -= l[i * n + k] * x[k];
+        x[i] /= l[i * n + i];
+    }
+    for (int i = n - 1; i >= 0; i--) {
+        for (int k = i + 1; k < int(n); k++) x[i] -= l[k * n + i] * x[k];
+        x[i] /= l[i * n + i];
+    }
+}
+
+double sum_of_squares(const std::vector<double>& v, unsigned int n)
+{
+    double s = 0.;
+    for (auto i = 0u; i < n; i++) s += v[i] * v[i];
+    return s;
+}
+}  // namespace
+
+// ENGINE______________________________________________________________________
+
+void SANDRecoLeastSquares::Resize(unsigned int n_parameters)
+{
+    if (_fixed.size() >= n_parameters) return;
+    _fixed.resize(n_parameters, 0);
+    _lower.resize(n_parameters, -HUGE_VAL);
+    _upper.resize(n_parameters, HUGE_VAL);
+}
+
+void SANDRecoLeastSquares::FixParameter(unsigned int i)
+{
+    Resize(i + 1);
+    _fixed[i] = 1;
+}
+
+void SANDRecoLeastSquares::SetParameterLimits(unsigned int i, double lower, double upper)
+{
+    Resize(i + 1);
+    _lower[i] = lower;
+    _upper[i] = upper;
+}
+
+void SANDRecoLeastSquares::ReleaseParameters()
+{
+    std::fill(_fixed.begin(), _fixed.end(), 0);
+    std::fill(_lower.begin(), _lower.end(), -HUGE_VAL);
+    std::fill(_upper.begin(), _upper.end(), HUGE_VAL);
+}
+
+void SANDRecoLeastSquares::Clamp(std::vector<double>& parameters) const
+{
+    for (auto i = 0u; i < parameters.size(); i++)
+        parameters[i] = std::min(std::max(parameters[i], _lower[i]), _upper[i]);
+}
+
+void SANDRecoLeastSquares::Normal(unsigned int n_residuals, unsigned int n_parameters)
+{
+    // alpha = J^T J and beta = J^T r restricted to the free parameters
+    const unsigned int n = _free.size();
+    std::fill(_alpha.begin(), _alpha.end(), 0.);
+    std::fill(_beta.begin(), _beta.end(), 0.);
+    for (auto r = 0u; r < n_residuals; r++) {
+        const double* row = &_jacobian[r * n_parameters];
+        for (auto a = 0u; a < n; a++) {
+            double ja = row[_free[a]];
+            if (ja == 0.) continue;
+            _beta[a] += ja * _residuals[r];
+            for (auto b = 0u; b <= a; b++) _alpha[a * n + b] += ja * row[_free[b]];
+        }
+    }
+    for (auto a = 0u; a < n; a++)
+        for (auto b = 0u; b < a; b++) _alpha[b * n + a] = _alpha[a * n + b];
+}
+
+bool SANDRecoLeastSquares::Solve(unsigned int n, double lambda)
+{
+    // Marquardt damping: the diagonal is scaled by (1 + lambda)
+    std::copy(_alpha.begin(), _alpha.end(), _matrix.begin());
+    for (auto a = 0u; a < n; a++) {
+        double& d = _matrix[a * n + a];
+        d = d > 0. ? d * (1. + lambda) : lambda;
+    }
+    if (!cholesky(_matrix.data(), n)) return false;
+    for (auto a = 0u; a < n; a++) _step[a] = -_beta[a];
+    cholesky_solve(_matrix.data(), n, _step.data());
+    return true;
+}
+
+bool SANDRecoLeastSquares::Invert(unsigned int n)
+{
+    // only the diagonal of the covariance (alpha^-1) is needed: it is
+    // left in _step
+    std::copy(_alpha.begin(), _alpha.end(), _matrix.begin());
+    if (!cholesky(_matrix.data(), n)) return false;
+    for (auto a = 0u; a < n; a++) {
+        std::fill(_beta.begin(), _beta.end(), 0.);
+        _beta[a] = 1.;
+        cholesky_solve(_matrix.data(), n, _beta.data());
+        _step[a] = _beta[a];
+    }
+    return true;
+}
+
+bool SANDRecoLeastSquares::Minimize(const SANDRecoLeastSquaresModel& model,
+                                    std::vector<double>& parameters,
+                                    SANDRecoLeastSquaresResult& result)
+{
+    const unsigned int n_parameters = model.NParameters();
+    const unsigned int n_residuals = model.NResiduals();
+
+    result = SANDRecoLeastSquaresResult();
+    result.errors.assign(n_parameters, 0.);
+
+    parameters.resize(n_parameters);
+    Resize(n_parameters);
+    _free.clear();
+    for (auto i = 0u; i < n_parameters; i++)
+        if (!_fixed[i]) _free.push_back(i);
+    const unsigned int n = _free.size();
+
+    if (_residuals.size() < n_residuals) {
+        _residuals.resize(n_residuals);
+        _trial_residuals.resize(n_residuals);
+    }
+    if (_jacobian.size() < n_residuals * n_parameters) {
+        _jacobian.resize(n_residuals * n_parameters);
+        _trial_jacobian.resize(n_residuals * n_parameters);
+    }
+    _trial.resize(n_parameters);
+    _alpha.resize(n * n);
+    _matrix.resize(n * n);
+    _beta.resize(n);
+    _step.resize(n);
+
+    Clamp(parameters);
+    model.Evaluate(parameters.data(), _residuals.data(), _jacobian.data());
+    double chi2 = sum_of_squares(_residuals, n_residuals);
+    result.chi2 = chi2;
+    if (!std::isfinite(chi2)) return false;
+
+    double lambda = 1E-3;
+    for (int iter = 0; iter < _max_iterations && n > 0; iter++) {
+        result.n_iterations = iter + 1;
+        Normal(n_residuals, n_parameters);
+
+        // increase the damping until the step decreases the chi2
+        bool accepted = false;
+        double trial_chi2 = chi2;
+        for (; lambda < 1E10; lambda *= 10.) {
+            if (!Solve(n, lambda)) continue;
+            std::copy(parameters.begin(), parameters.end(), _trial.begin());
+            for (auto a = 0u; a < n; a++) _trial[_free[a]] += _step[a];
+            Clamp(_trial);
+            model.Evaluate(_trial.data(), _trial_residuals.data(), _trial_jacobian.data());
+            trial_chi2 = sum_of_squares(_trial_residuals, n_residuals);
+            if (std::isfinite(trial_chi2) && trial_chi2 <= chi2) {
+                accepted = true;
+                break;
+            }
+        }
+
+        // no step along the gradient decreases the chi2: at the minimum
+        // within the numerical precision
+        if (!accepted) {
+            result.converged = true;
+            break;
+        }
+
+        double max_step = 0.;
+        for (auto a = 0u; a < n; a++) {
+            auto i = _free[a];
+            max_step = std::max(max_step, std::fabs(_trial[i] - parameters[i]) /
+                                              (std::fabs(parameters[i]) + 1.));
+        }
+        double dchi2 = chi2 - trial_chi2;
+
+        std::copy(_trial.begin(), _trial.end(), parameters.begin());
+        _residuals.swap(_trial_residuals);
+        _jacobian.swap(_trial_jacobian);
+        chi2 = trial_chi2;
+        lambda = std::max(lambda * 0.1, 1E-12);
+
+        if (dchi2 <= _tolerance * (1. + chi2) || max_step <= _tolerance) {
+            result.converged = true;
+            break;
+        }
+    }
+    if (n == 0) result.converged = true;
+
+    result.chi2 = chi2;
+    result.status = result.converged ? 0 : 4;
+
+    // parabolic errors from the curvature at the minimum, not defined
+    // for an underdetermined model (a valley of minima)
+    Normal(n_residuals, n_parameters);
+    if (n_residuals >= n && Invert(n))
+        for (auto a = 0u; a < n; a++) result.errors[_free[a]] = std::sqrt(_step[a]);
+
+    return result.converged;
+}
+
+// MODELS______________________________________________________________________
+
+void SANDRecoDriftCircleModel::Evaluate(const double* p, double* residuals,
+                                        double* jacobian) const
+{
+    const double zc = p[0];
+    const double yc = p[1];
+    const double R = p[2];
+
+    for (auto i = 0u; i < wires_.size(); i++) {
+        const auto& wire = *wires_[i];
+        double dz = zc - wire.z;
+        double dy = yc - wire.y;
+        double d = std::sqrt(dz * dz + dy * dy);
+
+        // r_estimated = |d - R|
+        double sign = d >= R ? 1. : -1.;
+        double r_estimated = sign * (d - R);
+        double r_observed = wire.drift_time_measured * sand_reco::stt::v_drift;
+        residuals[i] = (r_estimated - r_observed) / sigma_;
+
+        double* row = &jacobian[i * 3];
+        row[0] = d > 0. ? sign * dz / d / sigma_ : 0.;
+        row[1] = d > 0. ? sign * dy / d / sigma_ : 0.;
+        row[2] = -sign / sigma_;
+    }
+}
+
+void SANDRecoDriftLineModel::Evaluate(const double* p, double* residuals,
+                                      double* jacobian) const
+{
+    const double m = p[0];
+    const double q = p[1];
+    const double norm = std::sqrt(1. + m * m);
+
+    for (auto i = 0u; i < wires_.size(); i++) {
+        const auto& wire = *wires_[i];
+        // r_estimated = |m x - z + q| / sqrt(1 + m^2)
+        double u = m * wire.x - wire.z + q;
+        double sign = u >= 0. ? 1. : -1.;
+        double r_estimated = sign * u / norm;
+        double r_observed = wire.drift_time_measured * sand_reco::stt::v_drift;
+        residuals[i] = (r_estimated - r_observed) / sigma_;
+
+        double* row = &jacobian[i * 2];
+        row[0] = sign * (wire.x - u * m / (norm * norm)) / norm / sigma_;
+        row[1] = sign / norm / sigma_;
+    }
+}
+
+void SANDRecoDriftSinModel::Evaluate(const double* p, double* residuals,
+                                     double* jacobian) const
+{
+    const double A = p[0];
+    const double B = p[1];
+    const double C = p[2];
+    const double D = p[3];
+
+    for (auto i = 0u; i < wires_.size(); i++) {
+        const auto& wire = *wires_[i];
+
+        // foot point: zero of g(x) = (x - x_w) + (f(x) - z_w) f'(x)
+        double x = wire.x;
+        for (int iter = 0; iter < 20; iter++) {
+            double s = std::sin(B * x + C);
+            double c = std::cos(B * x + C);
+            double f = A * s + D;
+            double f1 = A * B * c;
+            double f2 = -A * B * B * s;
+            double g = (x - wire.x) + (f - wire.z) * f1;
+            double g1 = 1. + f1 * f1 + (f - wire.z) * f2;
+            if (!(g1 > 0.)) g1 = 1. + f1 * f1;
+            double dx = g / g1;
+            x -= dx;
+            if (std::fabs(dx) < 1E-6) break;
+        }
+
+        double s = std::sin(B * x + C);
+        double c = std::cos(B * x + C);
+        double dz = A * s + D - wire.z;
+        double d = std::sqrt((x - wire.x) * (x - wire.x) + dz * dz);
+
+        double r_observed = wire.drift_time_measured * sand_reco::stt::v_drift;
+        residuals[i] = (d - r_observed) / sigma_;
+
+        // the foot point is stationary: only the explicit dependence of
+        // f on the parameters contributes
+        double w = d > 0. ? dz / d / sigma_ : 0.;
+        double* row = &jacobian[i * 4];
+        row[0] = w * s;
+        row[1] = w * A * x * c;
+        row[2] = w * A * c;
+        row[3] = w;
+    }
+}
+
+void SANDRecoDriftHelixModel::Evaluate(const double* p, double* residuals,
+                                       double* jacobian) const
+{
+    const double R = p[0];
+    const double dip = p[1];
+    const double Phi0 = p[2];
+    const int h = p[3];
+
+    Helix helix(R, dip, Phi0, h, {p[4], p[5], p[6]});
+
+    RecoUtils::GetMinImpactParameters(helix, wire_arrays_, impact_parameters_.data(),
+                                      s_.data(), t_.data());
+
+    for (auto i = 0u; i < wires_.size(); i++) {
+        const auto& wire = wires_[i];
+        double* row = &jacobian[i * 7];
+        std::fill(row, row + 7, 0.);
+
+        double r_estimated = impact_parameters_[i];
+        double r_true = wire.drift_time * sand_reco::stt::v_drift;
+        residuals[i] = (r_estimated - r_true) / sigma_;
+
+        if (r_estimated >= 1e6 || !(r_estimated > 0.)) continue;
+
+        // unit vector from the wire to the helix at the closest approach:
+        // the derivatives of the distance are its projections on the
+        // derivatives of the helix point at fixed s
+        double s = s_[i];
+        TVector3 wire_point(wire_arrays_.ax[i] + t_[i] * wire_arrays_.dx[i],
+                            wire_arrays_.ay[i] + t_[i] * wire_arrays_.dy[i],
+                            wire_arrays_.az[i] + t_[i] * wire_arrays_.dz[i]);
+        TVector3 n = (helix.GetPointAt(s) - wire_point) * (1. / r_estimated);
+
+        double phi = Phi0 + h * s * cos(dip) / R;
+        double sin_phi = sin(phi);
+        double cos_phi = cos(phi);
+        double hs = h * s;
+
+        // d(x, y, z)/d(R, dip, Phi0)
+        double dR[3] = {0.,
+                        sin_phi - sin(Phi0) - cos_phi * hs * cos(dip) / R,
+                        cos_phi - cos(Phi0) + sin_phi * hs * cos(dip) / R};
+        double ddip[3] = {-s * cos(dip),
+                          -cos_phi * hs * sin(dip),
+                          sin_phi * hs * sin(dip)};
+        double dPhi0[3] = {0.,
+                           R * (cos_phi - cos(Phi0)),
+                           -R * (sin_phi - sin(Phi0))};
+
+        row[0] = (n.X() * dR[0] + n.Y() * dR[1] + n.Z() * dR[2]) / sigma_;
+        row[1] = (n.X() * ddip[0] + n.Y() * ddip[1] + n.Z() * ddip[2]) / sigma_;
+        row[2] = (n.X() * dPhi0[0] + n.Y() * dPhi0[1] + n.Z() * dPhi0[2]) / sigma_;
+        row[4] = n.X() / sigma_;
+        row[5] = n.Y() / sigma_;
+        row[6] = n.Z() / sigma_;
+    }
+}
@@ -1,4 +1,5 @@
 #include "SANDRecoUtils.h"
+#include "SANDRecoLeastSquares.h"
 #include <numeric>
 
 SANDGeoManager geo_manager;
@@ -165,46 +166,198 @@ double RecoUtils::GetImpactParameter(const Helix& helix, const Line& line, doubl
     return (helix_point - line_point).Mag();
 }
 
+namespace
+{
+// helix of Helix in the form used by the closest approach kernel:
+// x = x0 - s sin(dip), y = yc + R sin(phi), z = zc + R cos(phi)
+// with phi = Phi0 + k s
+struct HelixKernel
+{
+    double R;
+    double k;
+    double Phi0;
+    double sin_dip;
+    double x0;
+    double yc;
+    double zc;
+
+    explicit HelixKernel(const Helix& helix)
+        : R(helix.R()), k(helix.h() * cos(helix.dip()) / helix.R()),
+          Phi0(helix.Phi0()), sin_dip(sin(helix.dip())), x0(helix.x0().X()),
+          yc(helix.Center().Y()), zc(helix.Center().X()) {}
+
+    // s of the helix crossing the plane z on the acos branch used by
+    // Helix::SetHelixRangeFromDigit (nearest point if it does not reach it)
+    double ReferenceS(double z) const
+    {
+        double c = (z - zc) / R;
+        c = c > 1. ? 1. : (c < -1. ? -1. : c);
+        return k != 0. ? (acos(c) - Phi0) / k : 0.;
+    }
+};
+
+/*
+    Closest approach of the helix to the line a + t d (d unit vector).
+    The seed is the closest point of the projection of the line on the
+    bending plane (exact for wires along x), on the turn of the helix
+    nearest to s_ref, then a few Newton steps on the 3D distance.
+    Returns the distance; s is the helix parameter and t the distance of
+    the line point from a along d
+*/
+inline double closest_approach(const HelixKernel& hk, double ax, double ay,
+                               double az, double dx, double dy, double dz,
+                               double s_ref, double& s, double& t)
+{
+    const double two_pi = 2. * M_PI;
+
+    // projection on the bending plane (z, y)
+    double pz = dz;
+    double py = dy;
+    double pn = sqrt(pz * pz + py * py);
+    double phi;
+    double phi_ref = hk.Phi0 + hk.k * s_ref;
+    if (pn < 1E-9) {
+        phi = atan2(ay - hk.yc, az - hk.zc);
+        phi += two_pi * std::round((phi_ref - phi) / two_pi);
+    } else {
+        pz /= pn;
+        py /= pn;
+        // foot of the circle center on the projected line
+        double u0 = (hk.zc - az) * pz + (hk.yc - ay) * py;
+        double fz = az + u0 * pz;
+        double fy = ay + u0 * py;
+        double h2 = (fz - hk.zc) * (fz - hk.zc) + (fy - hk.yc) * (fy - hk.yc);
+        if (h2 < hk.R * hk.R) {
+            // two crossings: take the one nearest to the reference
+            double du = sqrt(hk.R * hk.R - h2);
+            double phi1 = atan2(fy + du * py - hk.yc, fz + du * pz - hk.zc);
+            double phi2 = atan2(fy - du * py - hk.yc, fz - du * pz - hk.zc);
+            phi1 += two_pi * std::round((phi_ref - phi1) / two_pi);
+            phi2 += two_pi * std::round((phi_ref - phi2) / two_pi);
+            phi = fabs(phi1 - phi_ref) < fabs(phi2 - phi_ref) ? phi1 : phi2;
+        } else {
+            phi = atan2(fy - hk.yc, fz - hk.zc);
+            phi += two_pi * std::round((phi_ref - phi) / two_pi);
+        }
+    }
+    s = hk.k != 0. ? (phi - hk.Phi0) / hk.k : s_ref;
+
+    // Newton on f(s) = |w_perp|^2 / 2, w = H(s) - a
+    double wx = 0., wy = 0., wz = 0., wd = 0.;
+    for (int iter = 0; iter < 10; iter++) {
+        double ph = hk.Phi0 + hk.k * s;
+        double sp = sin(ph);
+        double cp = cos(ph);
+        wx = hk.x0 - s * hk.sin_dip - ax;
+        wy = hk.yc + hk.R * sp - ay;
+        wz = hk.zc + hk.R * cp - az;
+        wd = wx * dx + wy * dy + wz * dz;
+
+        // first and second derivatives of the helix point
+        double d1x = -hk.sin_dip;
+        double d1y = hk.R * hk.k * cp;
+        double d1z = -hk.R * hk.k * sp;
+        double d2y = -hk.R * hk.k * hk.k * sp;
+        double d2z = -hk.R * hk.k * hk.k * cp;
+        double d1d = d1x * dx + d1y * dy + d1z * dz;
+
+        double g = wx * d1x + wy * d1y + wz * d1z - wd * d1d;
+        double d1perp2 = d1x * d1x + d1y * d1y + d1z * d1z - d1d * d1d;
+        double g1 = d1perp2 + (wy - wd * dy) * d2y + (wz - wd * dz) * d2z;
+        if (!(g1 > 0.)) g1 = d1perp2;
+        if (!(g1 > 0.)) break;
+
+        double ds = -g / g1;
+        s += ds;
+        if (fabs(ds) < 1E-6) break;
+    }
+
+    double ph = hk.Phi0 + hk.k * s;
+    wx = hk.x0 - s * hk.sin_dip - ax;
+    wy = hk.yc + hk.R * sin(ph) - ay;
+    wz = hk.zc + hk.R * cos(ph) - az;
+    t = wx * dx + wy * dy + wz * dz;
+    double qx = wx - t * dx;
+    double qy = wy - t * dy;
+    double qz = wz - t * dz;
+    return sqrt(qx * qx + qy * qy + qz * qz);
+}
+}  // namespace
+
 double RecoUtils::GetMinImpactParameter(const Helix& helix, const Line& line, double& s_min, double& t_min, bool& HasMinimized){
     /* given an helix and a wire line, find the impact parameter
        s_min and t_min are the parameter of the helix and line 
        that five the point on the helix and on the line corresponding
-       to the impact parameter */
-   
-    // sample the helix in the drift plane
-    const int nof_helix_sampling_points = 1000;
-
-    auto s_step = (helix.UpLim() - helix.LowLim()) / nof_helix_sampling_points;
-
-    // initialize the impact parameter
-    double impact_parameter = 1e6;
+       to the impact parameter. The helix range (SetHelixRangeFromDigit)
+       selects the turn of the helix; the impact parameter is 1e6 if the
+       closest point is outside the line range */
+    HelixKernel hk(helix);
+
+    auto v = line.GetDirectionVector();
+    double v_mag = v.Mag();
+    double s_ref = (helix.UpLim() > helix.LowLim())
+                       ? 0.5 * (helix.UpLim() + helix.LowLim())
+                       : hk.ReferenceS(line.az());
+
+    double s, t;
+    double impact_parameter = closest_approach(hk, line.ax(), line.ay(), line.az(),
+                                               v.X() / v_mag, v.Y() / v_mag, v.Z() / v_mag,
+                                               s_ref, s, t);
+
+    // is within SAND x range
+    if(fabs(t) > line.GetLineLength()/2.) return 1e6;
+
+    s_min = s;
+    t_min = t / v_mag;
+    HasMinimized = 1;
+    return impact_parameter;
+}
 
-    for (auto i = 0u; i < nof_helix_sampling_points; i++)
+void RecoUtils::GetMinImpactParameters(const Helix& helix, const WireArrays& wires,
+                                       double* impact_parameters, double* s, double* t){
+    /*
+        GetMinImpactParameter for all the wires of a track. Each wire
+        selects the turn of the helix crossing its z plane. Wires
+        whose closest point is outside their length get 1e6
+    */
+    HelixKernel hk(helix);
+
+    const double* ax = wires.ax.data();
+    const double* ay = wires.ay.data();
+    const double* az = wires.az.data();
+    const double* dx = wires.dx.data();
+    const double* dy = wires.dy.data();
+    const double* dz = wires.dz.data();
+    const double* half_length = wires.half_length.data();
+    const unsigned int n = wires.Size();
+
+    for (auto i = 0u; i < n; i++)
     {
-        auto s_i = helix.LowLim() + s_step * i;
-
-        double t_i = -999;
-
-        auto dist2wire = RecoUtils::GetDistHelix2Line(helix, s_i, line, t_i);
-        // if(dist2wire < impact_parameter)
-        //     std::cout << "t_i : "                     << fabs(t_i) 
-        //               << ", "                         << ((line.GetPointAt(t_i)-line.GetLinePointX0()).Mag())
-        //               << ", line.GetLineLength()/2. " << line.GetLineLength()/2.
-        //               << ", "                         << (fabs(t_i)<=line.GetLineLength()/2.)
-        //               << ", "                         << ((dist2wire < impact_parameter)&&((line.GetPointAt(t_i)-line.GetLinePointX0()).Mag()))
-        //               <<"\n";
-    
-        if((dist2wire < impact_parameter) && 
-           ((line.GetPointAt(t_i)-line.GetLinePointX0()).Mag()<=line.GetLineLength()/2.) // is within SAND x range
-           )
-        {
-            impact_parameter = dist2wire;
-            s_min = s_i;
-            t_min = t_i;
-        }
+        double d = closest_approach(hk, ax[i], ay[i], az[i], dx[i], dy[i], dz[i],
+                                    hk.ReferenceS(az[i]), s[i], t[i]);
+        impact_parameters[i] = fabs(t[i]) > half_length[i] ? 1e6 : d;
     }
-    if(s_min!=-999) HasMinimized=1;
-    return impact_parameter;
+}
+
+void WireArrays::Add(const dg_wire& wire){
+    // horizontal wires along x, vertical along y (as GetLineFromWire)
+    ax.push_back(wire.x);
+    ay.push_back(wire.y);
+    az.push_back(wire.z);
+    dx.push_back(wire.hor ? 1. : 0.);
+    dy.push_back(wire.hor ? 0. : 1.);
+    dz.push_back(0.);
+    half_length.push_back(0.5 * wire.wire_length);
+}
+
+void WireArrays::Clear(){
+    ax.clear();
+    ay.clear();
+    az.clear();
+    dx.clear();
+    dy.clear();
+    dz.clear();
+    half_length.clear();
 }
 
 double RecoUtils::NewtonRaphson2D(TF1* f, TF1* fprime, double& x_guess, 
@@ -477,26 +630,19 @@ Line2D RecoUtils::WiresLinearFit(const std::vector<dg_wire*>& wires){
         z.push_back(wire->z);
     }
    }
-    // Create a TGraph object and fill it with the data
-    TGraph* graph = new TGraph(z.size(), &x[0], &z[0]);
-
-    // Define a linear function with parameters p0 (slope) and p1 (intercept)
-    TF1* linearFit = new TF1("linearFit", "[0]*x + [1]");
-
-    // Perform the fit using chi-square minimization method
-    graph->Fit(linearFit, "Q"); // "Q" option suppresses the fit statistics output
-
-    // Retrieve fit parameters
-    double slope = linearFit->GetParameter(0);
-    double intercept = linearFit->GetParameter(1);
-
-    // Visualize the fit
-    // TCanvas *c1 = new TCanvas("c1", "Linear Fit", 800, 600);
-    // graph->Draw("AP");
-    // linearFit->Draw("same");
-
-    // Optionally save the plot and parameters to a file
-    // c1->SaveAs("linear_fit.png");
+    // least squares line z = slope * x + intercept, solved in closed form
+    // (the TGraph + TF1 fit was leaked at each call and is not thread safe)
+    double n = x.size();
+    double sx = 0., sz = 0., sxx = 0., sxz = 0.;
+    for(auto k = 0u; k < x.size(); k++){
+        sx += x[k];
+        sz += z[k];
+        sxx += x[k] * x[k];
+        sxz += x[k] * z[k];
+    }
+    double den = n * sxx - sx * sx;
+    double slope = den != 0. ? (n * sxz - sx * sz) / den : 0.;
+    double intercept = n > 0. ? (sz - slope * sx) / n : 0.;
 
     // Print out the fit parameters
     Line2D fitted_line(slope, intercept);
@@ -588,42 +734,41 @@ Helix RecoUtils::GetHelixFromCircleLine(const Circle& circle,
     return Helix(circle.R(), dip_angle, Phi0, helicity, vertex);
 }
 
-const double* RecoUtils::GetHelixParameters(const Helix& helix_initial_guess, int& TMinuitStatus)
+std::vector<double> RecoUtils::GetHelixParameters(const Helix& helix_initial_guess, int& TMinuitStatus)
 {
-    ROOT::Math::Functor functor(&RecoUtils::FunctorNLL, 7);
-
-    ROOT::Math::Minimizer* minimizer = ROOT::Math::Factory::CreateMinimizer("Minuit", "Migrad");
-
-    minimizer->SetPrintLevel(4);
-
-    // minimizer->SetMaxIterations(100);
-    // minimizer->SetMaxFunctionCalls(100);
-
-    minimizer->SetFunction(functor);
-
-    // helix params
-    // SetLimitedVariable       (ivar, name,   val,  step,  low,   up)
-    minimizer->SetLimitedVariable(0,    "R",    helix_initial_guess.R(), 100,  100,     1e5);
-    minimizer->SetLimitedVariable(1,    "dip",  helix_initial_guess.dip(), 0.01,  -1.6,  1.6);
-    // minimizer->SetLimitedVariable(2,    "Phi0", helix_initial_guess.Phi0(), 0.01,  -3.14, 3.14);
-    // minimizer->SetLimitedVariable(3,    "h",    helix_initial_guess.h(), 0.01,  -1.1,  1.1);
-    minimizer->SetLimitedVariable(4,    "x0_x", helix_initial_guess.x0().X(), 1,  -1800, 1800);
-    // minimizer->SetLimitedVariable(5,    "x0_y", helix_initial_guess.x0().Y(), 1,  -4500, -300);
-    // minimizer->SetLimitedVariable(6,    "x0_z", helix_initial_guess.x0().Z(), 1,  21500, 26000);
-
-    // minimizer->SetFixedVariable(0,    "R",    helix_initial_guess.R());
-    // minimizer->SetFixedVariable(1,    "dip",    helix_initial_guess.dip());
-    minimizer->SetFixedVariable(2,    "Phi0",    helix_initial_guess.Phi0());
-    minimizer->SetFixedVariable(3,    "h",    helix_initial_guess.h());
-    // minimizer->SetFixedVariable(4,    "x0_x",    helix_initial_guess.x0().X());
-    minimizer->SetFixedVariable(5,    "x0_y",    helix_initial_guess.x0().Y());
-    minimizer->SetFixedVariable(6,    "x0_z",    helix_initial_guess.x0().Z());
-
-    minimizer->Minimize();
-    minimizer->PrintResults();
+    return RecoUtils::GetHelixParameters(helix_initial_guess, *event_digits, TMinuitStatus);
+}
 
-    TMinuitStatus      = minimizer->Status();  
-    const double* pars = minimizer->X();
+std::vector<double> RecoUtils::GetHelixParameters(const Helix& helix_initial_guess,
+                                                  const std::vector<dg_wire>& digits,
+                                                  int& TMinuitStatus)
+{
+    // the fitter keeps its workspace between the calls of a thread
+    static thread_local SANDRecoLeastSquares fitter;
+
+    std::vector<double> pars = {helix_initial_guess.R(),
+                                helix_initial_guess.dip(),
+                                helix_initial_guess.Phi0(),
+                                double(helix_initial_guess.h()),
+                                helix_initial_guess.x0().X(),
+                                helix_initial_guess.x0().Y(),
+                                helix_initial_guess.x0().Z()};
+
+    // helix params: R, dip and x0_x free
+    fitter.ReleaseParameters();
+    fitter.SetParameterLimits(0, 100, 1e5);
+    fitter.SetParameterLimits(1, -1.6, 1.6);
+    fitter.FixParameter(2);
+    fitter.FixParameter(3);
+    fitter.SetParameterLimits(4, -1800, 1800);
+    fitter.FixParameter(5);
+    fitter.FixParameter(6);
+
+    SANDRecoDriftHelixModel model(digits, 0.2); // 200 mu_m = 0.2 mm
+    SANDRecoLeastSquaresResult result;
+    fitter.Minimize(model, pars, result);
+
+    TMinuitStatus = result.status;
 
     return pars;
 }
@@ -10,12 +10,7 @@ SANDTrackerCell::SANDTrackerCell(const SANDTrackerCell& cell)
   _id = cell._id;
   _width = cell._width;
   _height = cell._height;
+  _rotated_wire_position = cell._rotated_wire_position;
+  _adjacent_begin = cell._adjacent_begin;
+  _adjacent_end = cell._adjacent_end;
 }
-
-void SANDTrackerCell::addAdjacentCell(SANDTrackerCell* adj_cell)
-{
-  if (std::find(_adjacent_cells.begin(), _adjacent_cells.end(), adj_cell) 
-      == _adjacent_cells.end()) {
-    _adjacent_cells.push_back(adj_cell);
-  }
-}
\ No newline at end of file
@@ -7,18 +7,16 @@
 
 #include <numeric>
 
-SANDTrackerClusterID SANDTrackerCluster::fCounter(0);
-
-SANDTrackerCluster::SANDTrackerCluster(const SANDGeoManager* sand_geo, 
+SANDTrackerCluster::SANDTrackerCluster(SANDTrackerClusterID id, const SANDGeoManager* sand_geo, 
           std::vector<SANDTrackerDigitID> &digits, plane_iterator plane)
-    : fId(fCounter++), fDigits(digits)
+    : fId(id), fDigits(digits)
 {
   _sand_geo = sand_geo;
   fPlane = plane;
 }
 
-SANDTrackerCluster::SANDTrackerCluster(const SANDGeoManager* sand_geo, std::vector<SANDTrackerDigitID> &digits)
-    : fId(fCounter++), fDigits(digits)
+SANDTrackerCluster::SANDTrackerCluster(SANDTrackerClusterID id, const SANDGeoManager* sand_geo, std::vector<SANDTrackerDigitID> &digits)
+    : fId(id), fDigits(digits)
 {
   _sand_geo = sand_geo;
   fPlane = _sand_geo->get_plane_info(SANDTrackerCellID(digits[0]()));
@@ -35,10 +33,10 @@ void SANDTrackerCluster::GetExtendedCluster(int offset)
 {
 
   // To Do: add case for triplet clusters, not only plane ones
+  // the digit id is the cell id
   std::vector<ulong> ids;
   for (auto i = 0u; i < fDigits.size(); i++) {
-    auto d = SANDTrackerDigitCollection::GetDigit(fDigits.at(i));
-    ids.push_back(d.did);
+    ids.push_back(fDigits.at(i)());
   }
 
   std::sort(ids.begin(), ids.end());
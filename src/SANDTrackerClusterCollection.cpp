@@ -3,31 +3,49 @@
 
 #include "utils.h"
 
-void SANDTrackerClusterCollection::ClusterProximityInPlane(const std::vector<SANDTrackerDigit>& digits) {
-  std::map<SANDTrackerPlaneIndex, std::vector<SANDTrackerDigitID>> fMapDigits;
-  for (auto& dg : digits) {
-    SANDTrackerPlaneID plane_global_id;
-    SANDTrackerCellID cell_local_id;
-    _sand_geo->decode_cell_id(dg.did, plane_global_id, cell_local_id);
-    fMapDigits[_sand_geo->GetPlaneIndex(plane_global_id)].push_back(SANDTrackerDigitID(dg.did));
+void SANDTrackerClusterCollection::ClusterProximityInPlane(const SANDTrackerDigitCollection& digits) {
+  // digits grouped by dense plane index
+  std::vector<std::vector<SANDTrackerDigitID>> fDigitsInPlane(_sand_geo->get_planes().size());
+  for (auto& dg : digits.GetDigits()) {
+    auto cell_index = _sand_geo->get_cell_index(SANDTrackerCellID(dg.did));
+    fDigitsInPlane[_sand_geo->get_cell_plane_index(cell_index)()].push_back(SANDTrackerDigitID(dg.did));
   }
 
-  for (auto& p:fMapDigits) {
-    std::sort(p.second.begin(), p.second.end(), [](SANDTrackerDigitID a, SANDTrackerDigitID b)
+  for (auto i = 0u; i < fDigitsInPlane.size(); i++) {
+    auto& plane_digits = fDigitsInPlane[i];
+    if (plane_digits.empty()) continue;
+    std::sort(plane_digits.begin(), plane_digits.end(), [](SANDTrackerDigitID a, SANDTrackerDigitID b)
                                   { return a() > b(); });
-    containers.push_back(new SANDTrackerClustersInPlane(_sand_geo, SANDTrackerClustersContainerID(p.first()), p.second));
+    containers.push_back(new SANDTrackerClustersInPlane(_sand_geo, digits, SANDTrackerClustersContainerID(i), plane_digits));
   }
 }
 
-void SANDTrackerClusterCollection::ClusterCellAdjacency(const std::vector<SANDTrackerDigit>& digits) {
+void SANDTrackerClusterCollection::ClusterCellAdjacency(const SANDTrackerDigitCollection& digits) {
   std::vector<SANDTrackerDigitID> digitIds;
-  for (auto& dg : digits) {
+  for (auto& dg : digits.GetDigits()) {
     digitIds.push_back(SANDTrackerDigitID(dg.did));
   }
-  containers.push_back(new SANDTrackerClustersByProximity(_sand_geo, SANDTrackerClustersContainerID(0), digitIds));
+  containers.push_back(new SANDTrackerClustersByProximity(_sand_geo, digits, SANDTrackerClustersContainerID(0), digitIds));
 }
 
-SANDTrackerClusterCollection::SANDTrackerClusterCollection(const SANDGeoManager* sand_geo, const std::vector<SANDTrackerDigit>& digits, ClusteringMethod clu_method)
+void SANDTrackerClusterCollection::ClusterConnectedComponents(const SANDTrackerDigitCollection& digits) {
+  std::vector<SANDTrackerDigitID> digitIds;
+  for (auto& dg : digits.GetDigits()) {
+    digitIds.push_back(SANDTrackerDigitID(dg.did));
+  }
+  containers.push_back(new SANDTrackerClustersByProximity(_sand_geo, digits, SANDTrackerClustersContainerID(0), digitIds,
+                                                          SANDTrackerClustersByProximity::Mode::kConnectedComponents));
+}
+
+void SANDTrackerClusterCollection::ClusterCellularAutomaton(const SANDTrackerDigitCollection& digits) {
+  std::vector<SANDTrackerDigitID> digitIds;
+  for (auto& dg : digits.GetDigits()) {
+    digitIds.push_back(SANDTrackerDigitID(dg.did));
+  }
+  containers.push_back(new SANDTrackerClustersByCellularAutomaton(_sand_geo, digits, SANDTrackerClustersContainerID(0), digitIds));
+}
+
+SANDTrackerClusterCollection::SANDTrackerClusterCollection(const SANDGeoManager* sand_geo, const SANDTrackerDigitCollection& digits, ClusteringMethod clu_method)
 {
   _sand_geo = sand_geo;
 
@@ -37,6 +55,12 @@ SANDTrackerClusterCollection::SANDTrackerClusterCollection(const SANDGeoManager*
   if (clu_method == ClusteringMethod::kCellAdjacency) {
     ClusterCellAdjacency(digits);
   }
+  if (clu_method == ClusteringMethod::kConnectedComponents) {
+    ClusterConnectedComponents(digits);
+  }
+  if (clu_method == ClusteringMethod::kCellularAutomaton) {
+    ClusterCellularAutomaton(digits);
+  }
 }
 
 // get number of available dg_tubes
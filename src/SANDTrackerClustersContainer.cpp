@@ -2,83 +2,328 @@
 
 #include "SANDTrackerUtils.h"
 
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <limits>
+#include <numeric>
+#include <stdexcept>
+
 // get digit coordinate according to the plane
 inline TVector2 ClustersContainer::GetDigitCoord(const SANDTrackerDigit *dg) const
 {
-  auto plane = _sand_geo->get_plane_info(SANDTrackerCellID(dg->did));
-  return getSandGeoManager()->GlobalToRotated(TVector2(dg->x, dg->y), *plane);
+  auto cell_index = _sand_geo->get_cell_index(SANDTrackerCellID(dg->did));
+  const auto& plane = _sand_geo->get_planes()[_sand_geo->get_cell_plane_index(cell_index)()];
+  return plane.globalToRotated(TVector2(dg->x, dg->y));
 }
 
-bool SANDTrackerClustersByProximity::IsPermutation(const std::vector<SANDTrackerDigitID>& clu)
+const SANDTrackerCluster &ClustersContainer::GetNearestCluster(double x, double y) const
 {
-  for (auto& cluster:GetClusters()) {
-    // Notice: this is O(n^2). is there a better way? i.e sort
-    if (std::is_permutation(clu.begin(), clu.end(), cluster.GetDigits().begin())) {
-      return true;
+  TVector2 pos(x, y);
+  int nearest = -1;
+  double best = std::numeric_limits<double>::max();
+  for (auto c = 0u; c < fClusters.size(); c++) {
+    for (const auto& id : fClusters[c].GetDigits()) {
+      double d2 = (pos - GetDigitCoord(&getDigitCollection().GetDigit(id))).Mod2();
+      if (d2 < best) {
+        best = d2;
+        nearest = c;
+      }
     }
   }
-  return false;
+  if (nearest < 0)
+    throw std::out_of_range("ClustersContainer: no clusters in the container");
+  return fClusters[nearest];
 }
 
-void SANDTrackerClustersByProximity::findCluster(std::vector<SANDTrackerDigitID>& current_cluster, 
-                                                 std::map<SANDTrackerCellID, SANDTrackerDigitID>::iterator it, 
-                                                 std::map<SANDTrackerCellID, SANDTrackerDigitID>& fMap, 
-                                                 int cluster_size) {
-
-    for (auto next_it = fMap.begin(); next_it != fMap.end(); next_it++) {
-      
-      const auto& next_cell = getSandGeoManager()->get_cell_info(next_it->first);
-      if (std::find(current_cluster.begin(), current_cluster.end(), next_it->first) 
-            != current_cluster.end()) {
-        continue;
-      }
+namespace
+{
+// fired cells, ordered by dense cell index, and their adjacency (CSR)
+struct FiredCellGraph {
+  std::vector<unsigned long> cells;
+  std::vector<SANDTrackerDigitID> digits;
+  std::vector<int> offsets;
+  std::vector<int> neighbours;
+};
 
-      int adjacent_count = 0;
-      for (const auto& digit : current_cluster) {
-        const auto& cluster_cell = getSandGeoManager()->get_cell_info(SANDTrackerCellID(digit()));
+void BuildFiredCellGraph(const SANDGeoManager* sand_geo,
+                         const std::vector<SANDTrackerDigitID>& digits,
+                         FiredCellGraph& graph)
+{
+  std::vector<std::pair<unsigned long, SANDTrackerDigitID>> fired;
+  fired.reserve(digits.size());
+  for (const auto& d : digits)
+    fired.push_back({sand_geo->get_cell_index(SANDTrackerCellID(d()))(), d});
+  std::sort(fired.begin(), fired.end(),
+            [](const std::pair<unsigned long, SANDTrackerDigitID>& a,
+               const std::pair<unsigned long, SANDTrackerDigitID>& b) { return a.first < b.first; });
+  // a cell is fired once
+  fired.erase(std::unique(fired.begin(), fired.end(),
+                          [](const std::pair<unsigned long, SANDTrackerDigitID>& a,
+                             const std::pair<unsigned long, SANDTrackerDigitID>& b) { return a.first == b.first; }),
+              fired.end());
 
-        if (cluster_cell->second.isAdjacent(next_cell->first)) {
-          adjacent_count++;
-        }
-      }
-      if (adjacent_count == 0) {
-        continue;
-      }
+  const int n = fired.size();
+  for (const auto& f : fired) {
+    graph.cells.push_back(f.first);
+    graph.digits.push_back(f.second);
+  }
 
-      current_cluster.push_back(next_it->second);
+  auto find_fired = [&graph](unsigned long cell) {
+    auto it = std::lower_bound(graph.cells.begin(), graph.cells.end(), cell);
+    return (it == graph.cells.end() || *it != cell) ? -1 : int(it - graph.cells.begin());
+  };
 
-      if (current_cluster.size() == cluster_size) {
-        if (!IsPermutation(current_cluster)) {
-          AddCluster(SANDTrackerCluster(getSandGeoManager(), current_cluster));
-        }
-        current_cluster.pop_back();
-      } else {
-        findCluster(current_cluster, next_it, fMap, cluster_size);
-      }
+  // adjacency made symmetric
+  std::vector<std::pair<int, int>> edges;
+  for (int i = 0; i < n; i++) {
+    auto cell_index = SANDTrackerCellIndex(graph.cells[i]);
+    for (auto adj = sand_geo->get_adjacent_cells_begin(cell_index);
+         adj != sand_geo->get_adjacent_cells_end(cell_index); ++adj) {
+      int j = find_fired((*adj)());
+      if (j < 0 || j == i) continue;
+      edges.push_back({i, j});
+      edges.push_back({j, i});
     }
-    current_cluster.pop_back();
+  }
+  std::sort(edges.begin(), edges.end());
+  edges.erase(std::unique(edges.begin(), edges.end()), edges.end());
+
+  graph.offsets.assign(n + 1, 0);
+  for (const auto& e : edges) graph.offsets[e.first + 1]++;
+  for (int i = 0; i < n; i++) graph.offsets[i + 1] += graph.offsets[i];
+  graph.neighbours.resize(edges.size());
+  for (auto k = 0u; k < edges.size(); k++) graph.neighbours[k] = edges[k].second;
 }
+}  // namespace
 
 void SANDTrackerClustersByProximity::Clusterize(const std::vector<SANDTrackerDigitID>& digits)
 {
-  if (digits.size() > 0) {
-    std::map<SANDTrackerCellID, SANDTrackerDigitID> fMap;
-    std::for_each(digits.begin(), digits.end(), [&fMap](const SANDTrackerDigitID &d) {
-      fMap[SANDTrackerCellID(d())] = d;
-    });
+  if (digits.empty()) return;
+
+  FiredCellGraph graph;
+  BuildFiredCellGraph(getSandGeoManager(), digits, graph);
+  const int n = graph.cells.size();
+
+  std::vector<SANDTrackerDigitID> clu;
 
-    int cluster_size = 3;
-    for (auto it = fMap.begin(); it != fMap.end(); it++) {
-      std::vector<SANDTrackerDigitID> current_cluster = {it->second};
-      findCluster(current_cluster, it, fMap, cluster_size);
+  if (_mode == Mode::kConnectedComponents) {
+    // breadth first visit, each cell and adjacency visited once
+    std::vector<bool> visited(n, false);
+    std::vector<int> component;
+    for (int root = 0; root < n; root++) {
+      if (visited[root]) continue;
+      visited[root] = true;
+      component.assign(1, root);
+      for (auto k = 0u; k < component.size(); k++) {
+        int v = component[k];
+        for (int e = graph.offsets[v]; e < graph.offsets[v + 1]; e++) {
+          int u = graph.neighbours[e];
+          if (visited[u]) continue;
+          visited[u] = true;
+          component.push_back(u);
+        }
+      }
+      std::sort(component.begin(), component.end());
+      clu.clear();
+      for (auto v : component) clu.push_back(graph.digits[v]);
+      AddCluster(SANDTrackerCluster(NewClusterId(), getSandGeoManager(), clu));
     }
+    return;
+  }
+
+  /*
+    Connected subsets of _cluster_size cells, each once (ESU algorithm,
+    S. Wernicke, 2006): a subset is only grown from its lowest cell
+    (root), with the cells after the root that are adjacent to the last
+    added cell and not to the cells already in the subset. 
+    covered[u] counts the cells of the subset u is or is adjacent to
+  */
+  const unsigned int k = _cluster_size;
+  if (k == 0) return;
+
+  std::vector<int> covered(n, 0);
+  std::vector<int> subset;
+  std::vector<std::vector<int>> extensions(k);
+  std::vector<int> sorted_subset;
+
+  auto cover = [&](int v, int increment) {
+    covered[v] += increment;
+    for (int e = graph.offsets[v]; e < graph.offsets[v + 1]; e++)
+      covered[graph.neighbours[e]] += increment;
+  };
+
+  // extensions[depth] holds the candidates of the subset of depth + 1 cells
+  std::function<void(unsigned int, int)> extend = [&](unsigned int depth, int root) {
+    if (subset.size() == k) {
+      sorted_subset = subset;
+      std::sort(sorted_subset.begin(), sorted_subset.end());
+      clu.clear();
+      for (auto v : sorted_subset) clu.push_back(graph.digits[v]);
+      AddCluster(SANDTrackerCluster(NewClusterId(), getSandGeoManager(), clu));
+      return;
+    }
+    auto& extension = extensions[depth];
+    while (!extension.empty()) {
+      int w = extension.back();
+      extension.pop_back();
+
+      auto& next = extensions[depth + 1];
+      next = extension;
+      for (int e = graph.offsets[w]; e < graph.offsets[w + 1]; e++) {
+        int u = graph.neighbours[e];
+        if (u > root && covered[u] == 0) next.push_back(u);
+      }
+
+      subset.push_back(w);
+      cover(w, 1);
+      extend(depth + 1, root);
+      cover(w, -1);
+      subset.pop_back();
+    }
+  };
+
+  for (int root = 0; root < n; root++) {
+    subset.assign(1, root);
+    cover(root, 1);
+    extensions[0].clear();
+    for (int e = graph.offsets[root]; e < graph.offsets[root + 1]; e++)
+      if (graph.neighbours[e] > root) extensions[0].push_back(graph.neighbours[e]);
+    extend(0, root);
+    cover(root, -1);
   }
 }
 
-const SANDTrackerCluster &SANDTrackerClustersByProximity::GetNearestCluster(double x, double y) const
+void SANDTrackerClustersByCellularAutomaton::Clusterize(const std::vector<SANDTrackerDigitID>& digits)
 {
-  // To Do: yes
-  return SANDTrackerCluster();
+  const auto* sand_geo = getSandGeoManager();
+
+  // fired cells ordered by dense cell index, with the wire position along
+  // the coordinate measured by their plane
+  struct FiredCell {
+    unsigned long cell;
+    unsigned long plane;
+    SANDTrackerDigitID digit;
+    double z;
+    double t;
+    double cos_rot;
+    double sin_rot;
+  };
+  std::vector<FiredCell> fired;
+  fired.reserve(digits.size());
+  for (const auto& d : digits) {
+    auto cell_index = sand_geo->get_cell_index(SANDTrackerCellID(d()));
+    auto plane_index = sand_geo->get_cell_plane_index(cell_index);
+    const auto& plane = sand_geo->get_planes()[plane_index()];
+    const auto& center = sand_geo->get_cell(cell_index).wire().center();
+    fired.push_back({cell_index(), plane_index(), d, center.Z(),
+                     -plane.getSinRotation() * center.X() + plane.getCosRotation() * center.Y(),
+                     plane.getCosRotation(), plane.getSinRotation()});
+  }
+  std::sort(fired.begin(), fired.end(),
+            [](const FiredCell& a, const FiredCell& b) { return a.cell < b.cell; });
+
+  auto find_fired = [&fired](unsigned long cell) {
+    auto it = std::lower_bound(fired.begin(), fired.end(), cell,
+                               [](const FiredCell& f, unsigned long c) { return f.cell < c; });
+    return (it == fired.end() || it->cell != cell) ? -1 : int(it - fired.begin());
+  };
+
+  // segments from the upstream to the downstream cell. Planes are ordered
+  // by z, so the plane index gives the direction
+  std::vector<int> seg_from;
+  std::vector<int> seg_to;
+  std::vector<double> seg_angle;
+  for (int i = 0; i < int(fired.size()); i++) {
+    auto cell_index = SANDTrackerCellIndex(fired[i].cell);
+    for (auto adj = sand_geo->get_adjacent_cells_begin(cell_index);
+         adj != sand_geo->get_adjacent_cells_end(cell_index); ++adj) {
+      int j = find_fired((*adj)());
+      if (j < 0 || fired[j].plane <= fired[i].plane) continue;
+      if (std::fabs(fired[j].cos_rot - fired[i].cos_rot) +
+          std::fabs(fired[j].sin_rot - fired[i].sin_rot) > 1E-6) continue;
+      seg_from.push_back(i);
+      seg_to.push_back(j);
+      seg_angle.push_back(std::atan2(fired[j].t - fired[i].t, fired[j].z - fired[i].z));
+    }
+  }
+  const int nseg = seg_from.size();
+
+  // segments ending on each fired cell, CSR
+  std::vector<int> in_offsets(fired.size() + 1, 0);
+  for (int s = 0; s < nseg; s++) in_offsets[seg_to[s] + 1]++;
+  for (unsigned int i = 0; i < fired.size(); i++) in_offsets[i + 1] += in_offsets[i];
+  std::vector<int> in_segments(nseg);
+  {
+    std::vector<int> pos(in_offsets.begin(), in_offsets.end() - 1);
+    for (int s = 0; s < nseg; s++) in_segments[pos[seg_to[s]]++] = s;
+  }
+
+  auto compatible = [&](int inner, int outer) {
+    return std::fabs(seg_angle[outer] - seg_angle[inner]) < _max_angle;
+  };
+
+  // evolution. The segment graph is acyclic: processing the segments by
+  // increasing z of their first cell, the inner neighbours of a segment
+  // have their final state when it is reached and one pass gives the
+  // states the iterative automaton converges to
+  std::vector<int> order(nseg);
+  for (int s = 0; s < nseg; s++) order[s] = s;
+  std::stable_sort(order.begin(), order.end(), [&](int a, int b) {
+    return fired[seg_from[a]].plane < fired[seg_from[b]].plane;
+  });
+
+  std::vector<int> state(nseg, 1);
+  for (auto s : order) {
+    int from = seg_from[s];
+    for (int k = in_offsets[from]; k < in_offsets[from + 1]; k++) {
+      int inner = in_segments[k];
+      if (compatible(inner, s)) state[s] = std::max(state[s], state[inner] + 1);
+    }
+  }
+
+  // extraction of the chains, longest first; each cell belongs to one
+  // chain at most
+  std::stable_sort(order.begin(), order.end(),
+                   [&state](int a, int b) { return state[a] > state[b]; });
+
+  std::vector<bool> used(fired.size(), false);
+  std::vector<int> chain;
+  for (auto s : order) {
+    if (state[s] + 1 < int(_min_cells)) break;
+    if (used[seg_from[s]] || used[seg_to[s]]) continue;
+
+    chain.clear();
+    chain.push_back(seg_to[s]);
+    chain.push_back(seg_from[s]);
+    int current = s;
+    while (true) {
+      // inner neighbour continuing the chain with the smallest change of
+      // direction
+      int best = -1;
+      int from = seg_from[current];
+      for (int k = in_offsets[from]; k < in_offsets[from + 1]; k++) {
+        int inner = in_segments[k];
+        if (state[inner] != state[current] - 1 || used[seg_from[inner]] ||
+            !compatible(inner, current)) continue;
+        if (best < 0 || std::fabs(seg_angle[inner] - seg_angle[current]) <
+                        std::fabs(seg_angle[best] - seg_angle[current]))
+          best = inner;
+      }
+      if (best < 0) break;
+      chain.push_back(seg_from[best]);
+      current = best;
+    }
+    if (chain.size() < _min_cells) continue;
+
+    // upstream first
+    std::vector<SANDTrackerDigitID> clu;
+    for (auto it = chain.rbegin(); it != chain.rend(); ++it) {
+      used[*it] = true;
+      clu.push_back(fired[*it].digit);
+    }
+    AddCluster(SANDTrackerCluster(NewClusterId(), sand_geo, clu));
+  }
 }
 
 void SANDTrackerClustersInPlane::Clusterize(const std::vector<SANDTrackerDigitID>& digits)
@@ -98,34 +343,97 @@ void SANDTrackerClustersInPlane::Clusterize(const std::vector<SANDTrackerDigitID
                                 SANDTrackerCellID(clu.back()()))) {
         clu.push_back(fThisTube->second);
       } else {
-        AddCluster(SANDTrackerCluster(getSandGeoManager(), clu, fPlane));
+        AddCluster(SANDTrackerCluster(NewClusterId(), getSandGeoManager(), clu, fPlane));
         clu.clear();
         clu.push_back(fThisTube->second);
       }
       fThisTube++;
     }
-    AddCluster(SANDTrackerCluster(getSandGeoManager(), clu, fPlane));
+    AddCluster(SANDTrackerCluster(NewClusterId(), getSandGeoManager(), clu, fPlane));
   }
 }
 
-const SANDTrackerCluster &SANDTrackerClustersInPlane::GetNearestCluster(double x, double y) const
+void SANDTrackerClustersInPlane::BuildIndex()
 {
-  std::vector<double> dist;
-  TVector2 pos(x, y);
+  struct IndexedDigit {
+    double y;
+    double x;
+    unsigned int cluster;
+  };
+  std::vector<IndexedDigit> indexed;
+  const auto& clusters = GetClusters();
+  for (auto c = 0u; c < clusters.size(); c++) {
+    for (const auto& id : clusters[c].GetDigits()) {
+      const auto& dg = getDigitCollection().GetDigit(id);
+      auto rotated = fPlane->globalToRotated(TVector2(dg.x, dg.y));
+      indexed.push_back({rotated.Y(), rotated.X(), c});
+    }
+  }
+  std::sort(indexed.begin(), indexed.end(),
+            [](const IndexedDigit& a, const IndexedDigit& b) { return a.y < b.y; });
+
+  fDigitY.resize(indexed.size());
+  fDigitX.resize(indexed.size());
+  fDigitCluster.resize(indexed.size());
+  for (auto i = 0u; i < indexed.size(); i++) {
+    fDigitY[i] = indexed[i].y;
+    fDigitX[i] = indexed[i].x;
+    fDigitCluster[i] = indexed[i].cluster;
+  }
+}
+
+// walk outwards from start, the first digit with transverse coordinate
+// >= y, and stop on each side as soon as the transverse distance alone is
+// larger than the best distance. Ties go to the first cluster
+int SANDTrackerClustersInPlane::NearestClusterIndex(double x, double y, std::size_t start) const
+{
+  int cluster = -1;
+  double best = std::numeric_limits<double>::max();
 
-  for (auto const &cl : GetClusters()) {
-    std::vector<double> dx;
-    std::for_each(
-        cl.GetDigits().cbegin(), cl.GetDigits().cend(),
-        [this, &dx, pos](const SANDTrackerDigitID &id) {
-          dx.push_back(
-            (pos - this->GetDigitCoord(&SANDTrackerDigitCollection::GetDigit(id))).Mod());
-        });
+  auto test = [&](std::size_t i) {
+    double dy = fDigitY[i] - y;
+    if (dy * dy > best) return false;
+    double dx = fDigitX[i] - x;
+    double d2 = dx * dx + dy * dy;
+    if (d2 < best || (d2 == best && int(fDigitCluster[i]) < cluster)) {
+      best = d2;
+      cluster = fDigitCluster[i];
+    }
+    return true;
+  };
 
-    dist.push_back(*std::min_element(dx.begin(), dx.end()));
+  const std::size_t n = fDigitY.size();
+  std::size_t up = start;
+  std::size_t down = start;
+  while (up < n || down > 0) {
+    if (up < n) up = test(up) ? up + 1 : n;
+    if (down > 0) down = test(down - 1) ? down - 1 : 0;
   }
+  return cluster;
+}
 
-  return GetClusters().at(
-      std::distance(dist.begin(), std::min_element(dist.begin(), dist.end())));
+const SANDTrackerCluster &SANDTrackerClustersInPlane::GetNearestCluster(double x, double y) const
+{
+  auto start = std::lower_bound(fDigitY.begin(), fDigitY.end(), y) - fDigitY.begin();
+  int cluster = NearestClusterIndex(x, y, start);
+  if (cluster < 0)
+    throw std::out_of_range("SANDTrackerClustersInPlane: no clusters in the plane");
+  return GetClusters()[cluster];
+}
+
+void SANDTrackerClustersInPlane::GetNearestClusters(std::size_t n, const double* x, const double* y, int* clusters) const
+{
+  // positions in increasing y, so that the start of the search only moves
+  // forward
+  std::vector<std::size_t> order(n);
+  std::iota(order.begin(), order.end(), 0);
+  std::sort(order.begin(), order.end(),
+            [y](std::size_t a, std::size_t b) { return y[a] < y[b]; });
+
+  std::size_t start = 0;
+  for (auto q : order) {
+    while (start < fDigitY.size() && fDigitY[start] < y[q]) start++;
+    clusters[q] = NearestClusterIndex(x[q], y[q], start);
+  }
 }
 
@@ -1,5 +1,35 @@
 #include "SANDTrackerDigitCollection.h"
 
-std::vector<SANDTrackerDigit> SANDTrackerDigitCollection::SANDfgTrackerDigits;
+#include <algorithm>
+#include <stdexcept>
 
-SANDTrackerDigitMap SANDTrackerDigitCollection::fgMapDigit;
\ No newline at end of file
+void SANDTrackerDigitCollection::Fill(const std::vector<SANDTrackerDigit>& digits,
+                                      const SANDGeoManager* sand_geo)
+{
+  _digits = &digits;
+  _id_to_index.clear();
+  _id_to_index.reserve(digits.size());
+  _digit_cell_index.clear();
+  for (auto i = 0u; i < digits.size(); i++) {
+    auto did = static_cast<unsigned long>(digits[i].did);
+    _id_to_index.push_back({did, SANDTrackerDigitIndex(i)});
+    if (sand_geo)
+      _digit_cell_index.push_back(sand_geo->get_cell_index(SANDTrackerCellID(did)));
+  }
+  // repeated ids by decreasing index: GetDigitIndex finds the last one
+  std::sort(_id_to_index.begin(), _id_to_index.end(),
+            [](const std::pair<unsigned long, SANDTrackerDigitIndex>& a,
+               const std::pair<unsigned long, SANDTrackerDigitIndex>& b) {
+              return a.first < b.first || (a.first == b.first && a.second() > b.second());
+            });
+}
+
+SANDTrackerDigitIndex SANDTrackerDigitCollection::GetDigitIndex(const SANDTrackerDigitID &id) const
+{
+  auto it = std::lower_bound(_id_to_index.begin(), _id_to_index.end(), id(),
+                             [](const std::pair<unsigned long, SANDTrackerDigitIndex>& p,
+                                unsigned long did) { return p.first < did; });
+  if (it == _id_to_index.end() || it->first != id())
+    throw std::out_of_range("SANDTrackerDigitCollection: digit not found");
+  return it->second;
+}
@@ -0,0 +1,245 @@
+#include "SANDTrackerHough.h"
+
+#include <algorithm>
+#include <cmath>
+#include <queue>
+#include <utility>
+
+namespace
+{
+// impact parameters of the circles with curvature kappa tangent to a drift
+// circle of radius r. (wt, wn) is the drift circle center in the frame of
+// the track direction at the perigee (t, n = t rotated by +90 deg); the
+// circle center is on the n side for positive curvature. Written to be
+// stable for kappa -> 0, where it gives the tangent lines wn +/- r
+int tangent_impacts(double wt, double wn, double r, double kappa, double* d)
+{
+  int n = 0;
+  double abs_kappa = std::fabs(kappa);
+  double sign_kappa = kappa >= 0. ? 1. : -1.;
+  for (int sigma = -1; sigma <= 1; sigma += 2) {
+    double a = 1. + sigma * abs_kappa * r;
+    double root = a * a - kappa * kappa * wt * wt;
+    if (root < 0.) continue;
+    d[n++] = wn + (sign_kappa * sigma * 2. * r + kappa * (r * r - wt * wt)) /
+                      (1. + std::sqrt(root));
+    // a single tangent for a wire without drift radius
+    if (r == 0.) break;
+  }
+  return n;
+}
+
+// signed distance of (wt, wn) from the circle (kappa, d), same frame as
+// above
+double circle_distance(double wt, double wn, double kappa, double d)
+{
+  double dn = wn - d;
+  double a = 0.5 * kappa * (wt * wt + dn * dn) - dn;
+  double b = 1. + 2. * kappa * a;
+  if (b < 0.) return 1E9;
+  return 2. * a / (1. + std::sqrt(b));
+}
+}  // namespace
+
+void SANDTrackerHough::Find(std::vector<Point>& points, int n_curvature,
+                            double max_curvature,
+                            std::vector<std::vector<int> >& groups) const
+{
+  if (points.size() < _min_digits) return;
+
+  // reference point: the center of gravity of the digits
+  double u0 = 0., v0 = 0.;
+  for (const auto& p : points) {
+    u0 += p.u;
+    v0 += p.v;
+  }
+  u0 /= points.size();
+  v0 /= points.size();
+
+  double max_distance = 0.;
+  for (auto& p : points) {
+    p.u -= u0;
+    p.v -= v0;
+    max_distance = std::max(max_distance, std::sqrt(p.u * p.u + p.v * p.v) + p.r);
+  }
+
+  const double w = _impact_bin_width;
+  const int n_d = 2 * int(std::ceil(max_distance / w)) + 2;
+  const double d_min = -0.5 * n_d * w;
+  const int n_phi = _n_phi;
+  const std::size_t row_size = n_d;
+
+  // tracks going downstream only: phi in [-pi/2, pi/2)
+  const double dphi = M_PI / n_phi;
+  std::vector<double> cos_phi(n_phi), sin_phi(n_phi), kappa(n_curvature);
+  for (int i = 0; i < n_phi; i++) {
+    cos_phi[i] = std::cos(-0.5 * M_PI + (i + 0.5) * dphi);
+    sin_phi[i] = std::sin(-0.5 * M_PI + (i + 0.5) * dphi);
+  }
+  for (int k = 0; k < n_curvature; k++)
+    kappa[k] = n_curvature > 1
+                   ? -max_curvature + 2. * max_curvature * k / (n_curvature - 1)
+                   : 0.;
+
+  // flat accumulator, impact parameter contiguous: the votes of a set of
+  // digits for a given (curvature, phi) fall in the same row
+  std::vector<uint16_t> acc(n_curvature * n_phi * row_size, 0);
+
+  // maximum of each (curvature, phi) row (first position in case of
+  // ties) and a queue of the rows by decreasing maximum. Votes are only
+  // removed after the filling, so the maximum of a row whose peak bin is
+  // lowered is flagged stale and kept as an upper bound: the row is scanned
+  // again only if it reaches the top of the queue
+  const int n_rows = n_curvature * n_phi;
+  std::vector<int> row_max(n_rows, 0);
+  std::vector<uint16_t> row_bound(n_rows, 0);
+  std::vector<char> row_stale(n_rows, 0);
+  // (bound, -row): highest bound first, then lowest row
+  std::priority_queue<std::pair<int, int> > rows;
+  auto scan_row = [&](int r) {
+    const uint16_t* row = &acc[r * row_size];
+    row_max[r] = std::max_element(row, row + row_size) - row;
+    row_bound[r] = row[row_max[r]];
+    row_stale[r] = 0;
+    rows.push(std::make_pair(row_bound[r], -r));
+  };
+
+  // each tangent votes for its bin and the two neighbours; the ranges of
+  // the tangents of the same digit are merged so that a digit votes at
+  // most once per bin
+  auto vote = [&](const std::vector<int>& selected, bool add) {
+    for (int k = 0; k < n_curvature; k++) {
+      for (int ph = 0; ph < n_phi; ph++) {
+        uint16_t* row = &acc[(k * n_phi + ph) * row_size];
+        bool max_lowered = false;
+        for (auto i : selected) {
+          const auto& p = points[i];
+          double wt = p.u * cos_phi[ph] + p.v * sin_phi[ph];
+          double wn = -p.u * sin_phi[ph] + p.v * cos_phi[ph];
+          double d[2];
+          int nsol = tangent_impacts(wt, wn, p.r, kappa[k], d);
+
+          int lo[2], hi[2];
+          for (int s = 0; s < nsol; s++) {
+            int b = int(std::floor((d[s] - d_min) / w));
+            lo[s] = std::max(b - 1, 0);
+            hi[s] = std::min(b + 1, n_d - 1);
+          }
+          if (nsol == 2 && lo[1] <= hi[0] + 1 && lo[0] <= hi[1] + 1) {
+            lo[0] = std::min(lo[0], lo[1]);
+            hi[0] = std::max(hi[0], hi[1]);
+            nsol = 1;
+          }
+          for (int s = 0; s < nsol; s++)
+            for (int b = lo[s]; b <= hi[s]; b++) {
+              if (add)
+                row[b]++;
+              else if (row[b] > 0) {
+                row[b]--;
+                if (b == row_max[k * n_phi + ph]) max_lowered = true;
+              }
+            }
+        }
+        if (max_lowered) row_stale[k * n_phi + ph] = 1;
+      }
+    }
+  };
+
+  std::vector<int> selected(points.size());
+  for (unsigned int i = 0; i < points.size(); i++) selected[i] = i;
+  vote(selected, true);
+  for (int r = 0; r < n_rows; r++) scan_row(r);
+
+  std::vector<bool> used(points.size(), false);
+  const double tolerance = 1.5 * w;
+
+  while (!rows.empty()) {
+    int r = -rows.top().second;
+    if (rows.top().first != row_bound[r]) {
+      // outdated entry
+      rows.pop();
+      continue;
+    }
+    if (row_stale[r]) {
+      rows.pop();
+      scan_row(r);
+      continue;
+    }
+    uint16_t* peak = &acc[r * row_size + row_max[r]];
+    if (*peak < _min_digits) break;
+
+    int b = row_max[r];
+    int ph = r % n_phi;
+    int k = r / n_phi;
+    double d = d_min + (b + 0.5) * w;
+
+    selected.clear();
+    for (unsigned int i = 0; i < points.size(); i++) {
+      if (used[i]) continue;
+      const auto& p = points[i];
+      double wt = p.u * cos_phi[ph] + p.v * sin_phi[ph];
+      double wn = -p.u * sin_phi[ph] + p.v * cos_phi[ph];
+      double dist = circle_distance(wt, wn, kappa[k], d);
+      if (std::fabs(std::fabs(dist) - p.r) < tolerance) selected.push_back(i);
+    }
+
+    if (selected.size() < _min_digits) {
+      // peak made of digits already assigned to other candidates
+      *peak = 0;
+      row_stale[r] = 1;
+      continue;
+    }
+
+    vote(selected, false);
+
+    std::vector<int> group;
+    for (auto i : selected) {
+      used[i] = true;
+      group.push_back(points[i].digit);
+    }
+    groups.push_back(std::move(group));
+  }
+
+  std::stable_sort(groups.begin(), groups.end(),
+                   [](const std::vector<int>& a, const std::vector<int>& b) {
+                     return a.size() > b.size();
+                   });
+}
+
+void SANDTrackerHough::FindTracks(const std::vector<dg_wire>& digits,
+                                  const std::vector<double>& radii,
+                                  std::vector<std::vector<int> >& groupsY,
+                                  std::vector<std::vector<int> >& groupsX) const
+{
+  groupsY.clear();
+  groupsX.clear();
+
+  std::vector<Point> pointsY;
+  std::vector<Point> pointsX;
+  for (unsigned int i = 0; i < digits.size(); i++) {
+    const auto& d = digits[i];
+    double r = radii.empty() ? 0. : radii[i];
+    if (!(r > 0.) || !std::isfinite(r)) r = 0.;
+    if (d.hor)
+      pointsY.push_back({int(i), d.z, d.y, r});
+    else
+      pointsX.push_back({int(i), d.z, d.x, r});
+  }
+
+  Find(pointsY, _n_curvature, _max_curvature, groupsY);
+  Find(pointsX, 1, 0., groupsX);
+}
+
+std::vector<double> SANDTrackerHough::DriftRadii(
+    const std::vector<dg_wire>& digits, double v_drift)
+{
+  std::vector<double> radii;
+  radii.reserve(digits.size());
+  for (const auto& d : digits) {
+    double t_ref = d.det == "Straw" ? d.t0 : d.t_hit;
+    double r = 0.;
+    if (d.tdc < 1E9 && t_ref < 1E9) r = std::max(0., (d.tdc - t_ref) * v_drift);
+    radii.push_back(r);
+  }
+  return radii;
+}
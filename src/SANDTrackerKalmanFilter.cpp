@@ -0,0 +1,313 @@
+#include "SANDTrackerKalmanFilter.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+// curvature constant: GeV / (T mm)
+const double kappa = SANDTrackerUtils::GetRadiusInMMToMomentumInGeVConstant() * 1E-3;
+
+// covariance of the seed: the seed only fixes the linearization point
+const double seed_sigma_pos = 100.;  // mm
+const double seed_sigma_slope = 1.;
+const double seed_sigma_qop = 10.;   // 1/GeV
+
+// derivatives of (x, y, tx, ty) with respect to z in a field along x
+void derivatives(const double* s, double qop, double bx, double* d)
+{
+  double tx = s[2];
+  double ty = s[3];
+  double kqb = kappa * qop * bx * sqrt(1. + tx * tx + ty * ty);
+  d[0] = tx;
+  d[1] = ty;
+  d[2] = kqb * tx * ty;
+  d[3] = kqb * (1. + ty * ty);
+}
+
+// derivative with respect to z of the jacobian j (4 x 3, row major) of
+// (x, y, tx, ty) with respect to (tx, ty, q/p) at the start of the
+// transport: dj/dz = A j + B, A and B being the derivatives of the
+// equations of motion with respect to the state and to q/p
+void jacobian_derivatives(const double* s, double qop, double bx,
+                          const double* j, double* dj)
+{
+  double tx = s[2];
+  double ty = s[3];
+  double n2 = 1. + tx * tx + ty * ty;
+  double kb = kappa * bx * sqrt(n2);
+  double kqb = kb * qop;
+
+  double a22 = kqb * ty * (1. + tx * tx / n2);
+  double a23 = kqb * tx * (1. + ty * ty / n2);
+  double a32 = kqb * (1. + ty * ty) * tx / n2;
+  double a33 = kqb * ty * (2. + (1. + ty * ty) / n2);
+  double b2 = kb * tx * ty;
+  double b3 = kb * (1. + ty * ty);
+
+  for (int c = 0; c < 3; c++) {
+    dj[c] = j[6 + c];
+    dj[3 + c] = j[9 + c];
+    dj[6 + c] = a22 * j[6 + c] + a23 * j[9 + c];
+    dj[9 + c] = a32 * j[6 + c] + a33 * j[9 + c];
+  }
+  dj[8] += b2;
+  dj[11] += b3;
+}
+}  // namespace
+
+void SANDTrackerKalmanFilter::Transport(
+    SANDTrackerKFStateVector& state, double dz,
+    SANDTrackerKFStateCovarianceMatrix* jacobian) const
+{
+  if (jacobian) *jacobian = SANDTrackerKFStateCovarianceMatrix::Identity();
+  if (dz == 0.) return;
+
+  const double bx = SANDTrackerUtils::GetMagneticField();
+  const double qop = state(4);
+  int nsteps = std::max(1, int(ceil(fabs(dz) / _max_step)));
+  double h = dz / nsteps;
+
+  double s[4] = {state(0), state(1), state(2), state(3)};
+  double k1[4], k2[4], k3[4], k4[4], tmp[4];
+
+  // the jacobian follows the same Runge-Kutta stages as the state, so
+  // that it is the derivative of the transport actually done
+  double j[12] = {0., 0., 0., 0., 0., 0., 1., 0., 0., 0., 1., 0.};
+  double l1[12], l2[12], l3[12], l4[12], jtmp[12];
+
+  for (int n = 0; n < nsteps; n++) {
+    derivatives(s, qop, bx, k1);
+    if (jacobian) jacobian_derivatives(s, qop, bx, j, l1);
+    for (int i = 0; i < 4; i++) tmp[i] = s[i] + 0.5 * h * k1[i];
+    derivatives(tmp, qop, bx, k2);
+    if (jacobian) {
+      for (int i = 0; i < 12; i++) jtmp[i] = j[i] + 0.5 * h * l1[i];
+      jacobian_derivatives(tmp, qop, bx, jtmp, l2);
+    }
+    for (int i = 0; i < 4; i++) tmp[i] = s[i] + 0.5 * h * k2[i];
+    derivatives(tmp, qop, bx, k3);
+    if (jacobian) {
+      for (int i = 0; i < 12; i++) jtmp[i] = j[i] + 0.5 * h * l2[i];
+      jacobian_derivatives(tmp, qop, bx, jtmp, l3);
+    }
+    for (int i = 0; i < 4; i++) tmp[i] = s[i] + h * k3[i];
+    derivatives(tmp, qop, bx, k4);
+    if (jacobian) {
+      for (int i = 0; i < 12; i++) jtmp[i] = j[i] + h * l3[i];
+      jacobian_derivatives(tmp, qop, bx, jtmp, l4);
+      for (int i = 0; i < 12; i++)
+        j[i] += h / 6. * (l1[i] + 2. * l2[i] + 2. * l3[i] + l4[i]);
+    }
+    for (int i = 0; i < 4; i++)
+      s[i] += h / 6. * (k1[i] + 2. * k2[i] + 2. * k3[i] + k4[i]);
+  }
+
+  for (int i = 0; i < 4; i++) state(i) = s[i];
+
+  // x and y do not enter the equations of motion and q/p is constant:
+  // only the columns of tx, ty and q/p differ from the identity
+  if (jacobian)
+    for (int i = 0; i < 4; i++)
+      for (int c = 0; c < 3; c++) (*jacobian)(i, 2 + c) = j[3 * i + c];
+}
+
+void SANDTrackerKalmanFilter::Propagate(
+    const SANDTrackerKFStateVector& state, double z_from, double z_to,
+    SANDTrackerKFStateVector& out,
+    SANDTrackerKFStateCovarianceMatrix* jacobian) const
+{
+  out = state;
+  Transport(out, z_to - z_from, jacobian);
+}
+
+SANDTrackerKFStateCovarianceMatrix SANDTrackerKalmanFilter::MultipleScattering(
+    const SANDTrackerKFStateVector& state) const
+{
+  SANDTrackerKFStateCovarianceMatrix q;
+  if (_plane_x0 <= 0.) return q;
+
+  double tx = state(2);
+  double ty = state(3);
+  double n2 = 1. + tx * tx + ty * ty;
+
+  double p = fabs(state(4)) > 1. / _max_momentum ? 1. / fabs(state(4))
+                                                 : _max_momentum;
+  double beta = p / sqrt(p * p + _mass * _mass);
+  double theta0 = SANDTrackerUtils::GetMCSSigmaAngleFromMomentumInMeV(
+      p * 1E3, beta, _plane_x0 * sqrt(n2));
+  double var = theta0 * theta0 * n2;
+
+  q(2, 2) = var * (1. + tx * tx);
+  q(3, 3) = var * (1. + ty * ty);
+  q(2, 3) = var * tx * ty;
+  q(3, 2) = q(2, 3);
+  return q;
+}
+
+void SANDTrackerKalmanFilter::Seed(const std::vector<SANDTrackerKFSite>& sites,
+                                   SANDTrackerKFStateVector& state) const
+{
+  // straight line through the first and the last measurement of each view
+  const SANDTrackerKFSite* first[2] = {nullptr, nullptr};
+  const SANDTrackerKFSite* last[2] = {nullptr, nullptr};
+  for (const auto& site : sites) {
+    int view = site.hor ? 1 : 0;
+    if (!first[view]) first[view] = &site;
+    last[view] = &site;
+  }
+
+  double z0 = sites.front().z;
+  for (int view = 0; view < 2; view++) {
+    double dz = last[view]->z - first[view]->z;
+    double slope = dz != 0. ? (last[view]->measurement -
+                               first[view]->measurement) / dz
+                            : 0.;
+    state(view) = first[view]->measurement + slope * (z0 - first[view]->z);
+    state(view + 2) = slope;
+  }
+  state(4) = 0.;
+}
+
+bool SANDTrackerKalmanFilter::Filter(std::vector<SANDTrackerKFSite>& sites,
+                                     const SANDTrackerKFStateVector& seed,
+                                     bool use_reference, double& chi2) const
+{
+  SANDTrackerKFStateVector state = seed;
+  SANDTrackerKFStateCovarianceMatrix cov;
+  cov(0, 0) = cov(1, 1) = seed_sigma_pos * seed_sigma_pos;
+  cov(2, 2) = cov(3, 3) = seed_sigma_slope * seed_sigma_slope;
+  cov(4, 4) = seed_sigma_qop * seed_sigma_qop;
+
+  chi2 = 0.;
+  double z = sites.front().z;
+  // smoothed state of the previous iteration at the previous site
+  SANDTrackerKFStateVector reference = sites.front().smoothed;
+
+  for (auto& site : sites) {
+    if (site.z != z) {
+      if (use_reference) {
+        // transport linearized around the smoothed trajectory of the
+        // previous iteration, the states of the first sites being too
+        // far from the track (q/p above all) before many measurements
+        SANDTrackerKFStateCovarianceMatrix noisy = cov + MultipleScattering(reference);
+        SANDTrackerKFStateVector reference_predicted;
+        Propagate(reference, z, site.z, reference_predicted, &site.jacobian);
+        site.predicted = reference_predicted + site.jacobian * (state - reference);
+        site.predicted_cov = site.jacobian * noisy * site.jacobian.T();
+      } else {
+        // scattering in the plane of the previous site
+        SANDTrackerKFStateCovarianceMatrix noisy = cov + MultipleScattering(state);
+        Propagate(state, z, site.z, site.predicted, &site.jacobian);
+        site.predicted_cov = site.jacobian * noisy * site.jacobian.T();
+      }
+      site.predicted_cov.Symmetrize();
+    } else {
+      site.predicted = state;
+      site.predicted_cov = cov;
+      site.jacobian = SANDTrackerKFStateCovarianceMatrix::Identity();
+    }
+
+    // one dimensional measurement of x or y: the gain is a column of the
+    // predicted covariance
+    int m = site.hor ? 1 : 0;
+    double residual = site.measurement - site.predicted(m);
+    double s = site.sigma * site.sigma + site.predicted_cov(m, m);
+    if (!(s > 0.)) return false;
+
+    SANDTrackerKFStateVector gain;
+    for (int i = 0; i < 5; i++) gain(i) = site.predicted_cov(i, m) / s;
+
+    site.filtered = site.predicted + gain * residual;
+    site.filtered_cov = site.predicted_cov;
+    for (int i = 0; i < 5; i++)
+      for (int j = 0; j < 5; j++)
+        site.filtered_cov(i, j) -= gain(i) * site.predicted_cov(m, j);
+    site.filtered_cov.Symmetrize();
+
+    site.chi2 = residual * residual / s;
+    chi2 += site.chi2;
+
+    state = site.filtered;
+    cov = site.filtered_cov;
+    z = site.z;
+    reference = site.smoothed;
+  }
+  return true;
+}
+
+bool SANDTrackerKalmanFilter::Smooth(std::vector<SANDTrackerKFSite>& sites) const
+{
+  auto& last = sites.back();
+  last.smoothed = last.filtered;
+  last.smoothed_cov = last.filtered_cov;
+
+  for (int k = int(sites.size()) - 2; k >= 0; k--) {
+    auto& site = sites[k];
+    const auto& next = sites[k + 1];
+
+    SANDTrackerKFStateCovarianceMatrix inv;
+    if (!next.predicted_cov.Invert(inv)) return false;
+
+    auto a = site.filtered_cov * next.jacobian.T() * inv;
+    site.smoothed = site.filtered + a * (next.smoothed - next.predicted);
+    site.smoothed_cov =
+        site.filtered_cov + a * (next.smoothed_cov - next.predicted_cov) * a.T();
+    site.smoothed_cov.Symmetrize();
+  }
+
+  for (auto& site : sites) {
+    int m = site.hor ? 1 : 0;
+    site.residual = site.measurement - site.smoothed(m);
+    double var = site.sigma * site.sigma - site.smoothed_cov(m, m);
+    site.residual_sigma = var > 0. ? sqrt(var) : 0.;
+  }
+  return true;
+}
+
+bool SANDTrackerKalmanFilter::Fit(const std::vector<dg_wire>& digits,
+                                  SANDTrackerKFResult& result) const
+{
+  result.ok = false;
+  result.chi2 = 0.;
+  result.ndf = 0;
+  result.sites.clear();
+
+  int nview[2] = {0, 0};
+  result.sites.reserve(digits.size());
+  for (unsigned int i = 0; i < digits.size(); i++) {
+    SANDTrackerKFSite site;
+    site.digit = i;
+    site.hor = digits[i].hor;
+    site.z = digits[i].z;
+    site.measurement = site.hor ? digits[i].y : digits[i].x;
+    site.sigma = _sigma_pos;
+    result.sites.push_back(site);
+    nview[site.hor ? 1 : 0]++;
+  }
+
+  // two measurements for the straight line in the xz view, three for the
+  // circle in the yz view
+  if (nview[0] < 2 || nview[1] < 3) return false;
+
+  std::stable_sort(result.sites.begin(), result.sites.end(),
+                   [](const SANDTrackerKFSite& a, const SANDTrackerKFSite& b) {
+                     return a.z < b.z;
+                   });
+
+  // each iteration restarts from the smoothed state at the first site and,
+  // after the first one, linearizes the transport around the smoothed
+  // trajectory of the previous iteration (iterated smoother, i.e.
+  // Gauss-Newton steps of the least squares fit of the whole track)
+  SANDTrackerKFStateVector seed;
+  Seed(result.sites, seed);
+  for (int iter = 0; iter < _n_iterations; iter++) {
+    if (!Filter(result.sites, seed, iter > 0, result.chi2)) return false;
+    if (!Smooth(result.sites)) return false;
+    seed = result.sites.front().smoothed;
+  }
+
+  result.ndf = int(result.sites.size()) - 5;
+  result.ok = true;
+  return true;
+}
@@ -1,6 +1,7 @@
 #include "SANDTrackerPlane.h"
 
 #include <iostream>
+#include <cmath>
 
 std::map<SANDTrackerCellID, SANDTrackerCell>::iterator SANDTrackerPlane::getCell(SANDTrackerCellID index)
 {
@@ -31,6 +32,38 @@ const std::map<SANDTrackerCellID, SANDTrackerCell>::const_iterator SANDTrackerPl
 
 
 
+void SANDTrackerPlane::globalToRotated(std::size_t n, const double* x, const double* y, 
+                                       double* rx, double* ry) const
+{
+  const double px = _position.X();
+  const double py = _position.Y();
+  for (std::size_t i = 0; i < n; i++) {
+    double lx = x[i] - px;
+    double ly = y[i] - py;
+    rx[i] =  lx * _cos_rotation + ly * _sin_rotation;
+    ry[i] = -lx * _sin_rotation + ly * _cos_rotation;
+  }
+}
+
+void SANDTrackerPlane::rotatedToGlobal(std::size_t n, const double* rx, const double* ry, 
+                                       double* x, double* y) const
+{
+  const double px = _position.X();
+  const double py = _position.Y();
+  for (std::size_t i = 0; i < n; i++) {
+    x[i] = rx[i] * _cos_rotation - ry[i] * _sin_rotation + px;
+    y[i] = rx[i] * _sin_rotation + ry[i] * _cos_rotation + py;
+  }
+}
+
+void SANDTrackerPlane::computeRotatedWirePositions()
+{
+  for (auto& id_cell : _id_to_cell_map) {
+    const auto& center = id_cell.second.wire().center();
+    id_cell.second.rotatedWirePosition(globalToRotated(TVector2(center.X(), center.Y())));
+  }
+}
+
 void SANDTrackerPlane::computePlaneVertices()
 {
   _vertices.push_back(TVector2( _dimension.X() / 2,  _dimension.Y() / 2));
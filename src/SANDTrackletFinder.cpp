@@ -1,5 +1,7 @@
 #include "SANDTrackletFinder.h"
 
+#include <cmath>
+
 double MinimizingFunction(const double* params, const SANDTrackerCluster& cluster, const std::map<SANDTrackerDigitID, double>& digitId_to_drift_time)
 {
   double dx = cos(params[2]);
@@ -149,18 +151,109 @@ void TrackletFinder::ComputeDriftTime()
 
     TVector3 closest_point = leftend + t * r;
     double wire_time = (closest_point - leftend).Mag() / sand_reco::stt::v_signal_inwire;
-    _digitId_to_drift_time[digit_id] = _digit_collection->GetDigit(digit_id).tdc - _digit_collection->GetDigit(digit_id).t_hit - wire_time;
+    const auto& digit = _digit_collection->GetDigit(digit_id);
+    _digitId_to_drift_time[digit_id] = digit.tdc - digit.t_hit - wire_time;
+  }
+}
+
+namespace
+{
+// drift circle of a digit: wire center, unit wire direction, drift radius
+struct TrackletWire {
+  double cx, cy, cz;
+  double wx, wy, wz;
+  double radius;
+};
+
+/*
+  Residuals d - r of MinimizingFunction, d being the distance of the
+  tracklet from each wire, and their analytic derivatives.
+  p = (x, y, theta_xz, theta_yz), the tracklet starts at (x, y, z) with
+  direction (cos theta_xz, sin theta_yz, sin theta_xz)
+*/
+class SANDTrackletModel : public SANDRecoLeastSquaresModel
+{
+  public:
+    SANDTrackletModel(const std::vector<TrackletWire>& wires, double z)
+      : wires_(wires), z_(z) {}
+
+    unsigned int NParameters() const override {return 4;};
+    unsigned int NResiduals() const override {return wires_.size();};
+    // jacobian may be null
+    void Evaluate(const double* p, double* residuals,
+                  double* jacobian) const override;
+
+  private:
+    const std::vector<TrackletWire>& wires_;
+    double z_;
+};
+
+void SANDTrackletModel::Evaluate(const double* p, double* residuals,
+                                 double* jacobian) const
+{
+  const double ux = cos(p[2]), uy = sin(p[3]), uz = sin(p[2]);
+  // derivatives of the direction: d/dtheta_xz = (-uz, 0, ux), d/dtheta_yz = (0, cos, 0)
+  const double uy_b = cos(p[3]);
+
+  for (auto i = 0u; i < wires_.size(); i++) {
+    const auto& w = wires_[i];
+    double Dx = w.cx - p[0], Dy = w.cy - p[1], Dz = w.cz - z_;
+    // normal to the wire and the tracklet
+    double nx = w.wy * uz - w.wz * uy;
+    double ny = w.wz * ux - w.wx * uz;
+    double nz = w.wx * uy - w.wy * ux;
+    double m2 = nx * nx + ny * ny + nz * nz;
+    double* row = jacobian ? jacobian + 4 * i : nullptr;
+
+    if (m2 < 1E-24) {
+      // tracklet parallel to the wire: distance of the starting point
+      double t = Dx * w.wx + Dy * w.wy + Dz * w.wz;
+      double ex = Dx - t * w.wx, ey = Dy - t * w.wy, ez = Dz - t * w.wz;
+      double d = sqrt(ex * ex + ey * ey + ez * ez);
+      residuals[i] = d - w.radius;
+      if (row) {
+        row[0] = d > 0. ? -ex / d : 0.;
+        row[1] = d > 0. ? -ey / d : 0.;
+        row[2] = 0.;
+        row[3] = 0.;
+      }
+      continue;
+    }
+
+    double m = sqrt(m2);
+    double s = nx * Dx + ny * Dy + nz * Dz;
+    double sign = s >= 0. ? 1. : -1.;
+    residuals[i] = fabs(s) / m - w.radius;
+
+    if (!row) continue;
+    row[0] = -sign * nx / m;
+    row[1] = -sign * ny / m;
+    // n_a = w x du/dtheta_xz, n_b = w x du/dtheta_yz
+    double nax = w.wy * ux, nay = -w.wz * uz - w.wx * ux, naz = w.wy * uz;
+    double nbx = -w.wz * uy_b, nbz = w.wx * uy_b;
+    double s_a = nax * Dx + nay * Dy + naz * Dz;
+    double s_b = nbx * Dx + nbz * Dz;
+    double m_a = (nx * nax + ny * nay + nz * naz) / m;
+    double m_b = (nx * nbx + nz * nbz) / m;
+    row[2] = sign * s_a / m - fabs(s) * m_a / m2;
+    row[3] = sign * s_b / m - fabs(s) * m_b / m2;
   }
 }
+}  // namespace
 
 std::vector<TVectorD> TrackletFinder::FindTracklets()
 {
+  /*
+    Coarse to fine search of the minima of MinimizingFunction:
+    the function is scanned on a 4D grid, the best local minima
+    of the grid are refined with a Levenberg-Marquardt fit and
+    the refined minima that coincide are merged
+  */
   std::vector<TVectorD> minima;
 
-  auto minimizer = ROOT::Math::Factory::CreateMinimizer("Minuit", "");
-  minimizer->SetMaxFunctionCalls(100000); 
-  minimizer->SetMaxIterations(100000);
-  minimizer->SetTolerance(1e-9);
+  // the state of the previous cluster, if any
+  _cells_intersections.clear();
+  _digitId_to_drift_time.clear();
 
   ComputeCellsIntersections();
   ComputeDriftTime();
@@ -172,63 +265,117 @@ std::vector<TVectorD> TrackletFinder::FindTracklets()
   GetScanningAreaVertices();
   SetTrajectory(_mean_point_3d, TVector3(0,0,1));
 
-  auto digitId_to_drift_time = _digitId_to_drift_time;
-  auto cluster = _cluster;
-  ROOT::Math::Functor functor_cells([&digitId_to_drift_time, &cluster](const double* params) { return MinimizingFunction(params, cluster, digitId_to_drift_time); }, 4);
-  
-  minimizer->SetFunction(functor_cells);
+  // the drift circles are looked up once for all the evaluations
+  std::vector<TrackletWire> wires;
+  auto sand_geo = _cluster.getSandGeoManager();
+  for (const auto& digitId_and_time : _digitId_to_drift_time) {
+    auto cell = sand_geo->get_cell_info(SANDTrackerCellID(digitId_and_time.first()))->second;
+    TVector3 center = cell.wire().center();
+    TVector3 direction = cell.wire().getDirection().Unit();
+    wires.push_back({center.X(), center.Y(), center.Z(),
+                     direction.X(), direction.Y(), direction.Z(),
+                     cell.driftVelocity() * digitId_and_time.second});
+  }
+  SANDTrackletModel model(wires, _cluster.GetZ());
     
   double theta_xz = atan(_trajectory.getDirection().Z() / _trajectory.getDirection().X());
   double theta_yz = atan(_trajectory.getDirection().Y() / _trajectory.getDirection().Z());
   double theta_width = M_PI_4;
 
-  // std::cout << _cells_intersections[1].X() << " " << _cells_intersections[0].X() << std::endl;
-  // std::cout << _cells_intersections[1].Y() << " " << _cells_intersections[0].Y() << std::endl;
+  // scanned region, the refinement can move 200 mm outside the scanning area
+  const double grid_min[4]   = {_cells_intersections[0].X(), _cells_intersections[0].Y(),
+                                theta_xz - theta_width, theta_yz - theta_width};
+  const double grid_max[4]   = {_cells_intersections[1].X(), _cells_intersections[1].Y(),
+                                theta_xz + theta_width, theta_yz + theta_width};
+  const double lower_limit[4] = {grid_min[0] - 200, grid_min[1] - 200, grid_min[2], grid_min[3]};
+  const double upper_limit[4] = {grid_max[0] + 200, grid_max[1] + 200, grid_max[2], grid_max[3]};
+
+  const int n = std::max(_grid_subdivisions, 1) + 1;
+  const int n_points = n * n * n * n;
+  auto grid_point = [&](int index, double* p) {
+    for (int a = 3; a >= 0; a--) {
+      p[a] = grid_min[a] + (index % n) * (grid_max[a] - grid_min[a]) / (n - 1);
+      index /= n;
+    }
+  };
+
+  // coarse scan
+  std::vector<double> values(n_points);
+  std::vector<double> residuals(wires.size());
+  for (int index = 0; index < n_points; index++) {
+    double p[4];
+    grid_point(index, p);
+    model.Evaluate(p, residuals.data(), nullptr);
+    double sum = 0.;
+    for (auto r : residuals) sum += r * r;
+    values[index] = std::isfinite(sum) ? sum : 1E30;
+  }
 
-  double x_width = _cells_intersections[1].X() - _cells_intersections[0].X();
-  double y_width = _cells_intersections[1].Y() - _cells_intersections[0].Y();
-  
-  int subdivisions = 3;
-  double x_sub_width = x_width / subdivisions;
-  double y_sub_width = y_width / subdivisions;
-  double theta_sub_width = theta_width / subdivisions;
-
-  std::vector<TVectorD> sampling_points;
-  for (int i = 0; i <= subdivisions; i++) {
-    for (int j = 0; j <= subdivisions; j++) {
-      for (int k = 0; k <= subdivisions; k++) {
-        for (int z = 0; z <= subdivisions; z++) {
-          TVectorD point(4);
-
-          point[0] = _cells_intersections[0].X() + i * x_sub_width;
-          point[1] = _cells_intersections[0].Y() + j * y_sub_width;
-          point[2] = theta_xz - theta_width + k * theta_sub_width;
-          point[3] = theta_yz - theta_width + z * theta_sub_width;
-
-          sampling_points.push_back(point);
+  // basins: grid points lower than all their 80 neighbours (ties go to
+  // the first index)
+  std::vector<int> seeds;
+  for (int index = 0; index < n_points; index++) {
+    int c[4] = {index / (n * n * n), (index / (n * n)) % n, (index / n) % n, index % n};
+    bool is_minimum = true;
+    for (int k = 0; k < 81 && is_minimum; k++) {
+      if (k == 40) continue; // the point itself
+      int neighbour = 0;
+      int offset = k;
+      for (int a = 0; a < 4; a++) {
+        int ca = c[a] + offset % 3 - 1;
+        offset /= 3;
+        if (ca < 0 || ca >= n) {
+          neighbour = -1;
+          break;
         }
+        neighbour = neighbour * n + ca;
       }
-    }  
+      if (neighbour < 0) continue;
+      if (values[neighbour] < values[index] ||
+          (values[neighbour] == values[index] && neighbour < index))
+        is_minimum = false;
+    }
+    if (is_minimum) seeds.push_back(index);
   }
-  // std::cout << "SAMPLING SIZE: " << sampling_points.size() << std::endl;
-  for (uint i = 0; i < sampling_points.size(); i++) {
-    double starting_point[4] = {sampling_points[i][0], sampling_points[i][1], sampling_points[i][2], sampling_points[i][3]};
-    minimizer->SetLimitedVariable(0, "px", starting_point[0], 0.01, _cells_intersections[0].X() - 200, _cells_intersections[1].X() + 200);
-    minimizer->SetLimitedVariable(1, "py", starting_point[1], 0.01, _cells_intersections[0].Y() - 200, _cells_intersections[1].Y() + 200);
-    minimizer->SetLimitedVariable(2, "dx", starting_point[2], 0.001, theta_xz - theta_width, theta_xz + theta_width);
-    minimizer->SetLimitedVariable(3, "dy", starting_point[3], 0.001, theta_yz - theta_width, theta_yz + theta_width);
-
-    minimizer->Minimize();
-    const double *xs = minimizer->X();
+  std::sort(seeds.begin(), seeds.end(),
+            [&values](int a, int b) { return values[a] < values[b]; });
+  if (seeds.size() > _max_seeds) seeds.resize(_max_seeds);
+
+  // refinement
+  _fitter.ReleaseParameters();
+  _fitter.SetTolerance(1E-9);
+  for (int a = 0; a < 4; a++) _fitter.SetParameterLimits(a, lower_limit[a], upper_limit[a]);
+
+  std::vector<double> pars(4);
+  SANDRecoLeastSquaresResult result;
+  for (auto index : seeds) {
+    grid_point(index, pars.data());
+    _fitter.Minimize(model, pars, result);
+    if (!std::isfinite(result.chi2)) continue;
     TVectorD min(5);
-    min[0] = xs[0];
-    min[1] = xs[1];
-    min[2] = xs[2];
-    min[3] = xs[3];
-    min[4] = minimizer->MinValue();
+    min[0] = pars[0];
+    min[1] = pars[1];
+    min[2] = pars[2];
+    min[3] = pars[3];
+    min[4] = result.chi2;
     minima.push_back(min);
   }
-  return minima;
+
+  // merge the seeds that fell in the same minimum
+  std::sort(minima.begin(), minima.end(),
+            [](const TVectorD& v1, const TVectorD& v2){ return v1[4] < v2[4]; });
+  std::vector<TVectorD> distinct_minima;
+  for (const auto& min : minima) {
+    bool is_duplicate = std::any_of(distinct_minima.begin(), distinct_minima.end(),
+        [&](const TVectorD& other) {
+          return fabs(min[0] - other[0]) < _merge_position &&
+                 fabs(min[1] - other[1]) < _merge_position &&
+                 fabs(min[2] - other[2]) < _merge_angle &&
+                 fabs(min[3] - other[3]) < _merge_angle;
+        });
+    if (!is_duplicate) distinct_minima.push_back(min);
+  }
+  return distinct_minima;
 }
 
 void TrackletFinder::Clear()
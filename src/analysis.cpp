@@ -745,11 +745,18 @@ void Analyze(const char* fMc, const char* fIn)
   TTree* gRooTracker = (TTree*)ftrue.Get("DetSimPassThru/gRooTracker");
   TGeoManager* geo = (TGeoManager*)f.Get("EDepSimGeometry");
 
-  tReco->AddFriend(tTrueMC);
-  tReco->AddFriend(gRooTracker);
-
+  // the input trees are read separately, each with only the branches used
+  // below: the hit segments of the truth and all the GENIE pass-through
+  // branches but the primary momenta and pdg codes are never read
   TTree* t = tReco;
 
+  unsigned int found = 0;
+  tTrueMC->SetBranchStatus("SegmentDetectors*", 0, &found);
+  gRooTracker->SetBranchStatus("*", 0);
+  gRooTracker->SetBranchStatus("StdHepN", 1);
+  gRooTracker->SetBranchStatus("StdHepP4", 1);
+  gRooTracker->SetBranchStatus("StdHepPdg", 1);
+
   std::vector<track>* vec_tr = new std::vector<track>;
   std::vector<cluster>* vec_cl = new std::vector<cluster>;
 
@@ -759,11 +766,11 @@ void Analyze(const char* fMc, const char* fIn)
   int part_pdg[kMaxStdHepN];
 
   TG4Event* ev = new TG4Event;
-  t->SetBranchAddress("Event", &ev);
+  tTrueMC->SetBranchAddress("Event", &ev);
   t->SetBranchAddress("track", &vec_tr);
   t->SetBranchAddress("cluster", &vec_cl);
-  t->SetBranchAddress("StdHepP4", part_mom);
-  t->SetBranchAddress("StdHepPdg", part_pdg);
+  gRooTracker->SetBranchAddress("StdHepP4", part_mom);
+  gRooTracker->SetBranchAddress("StdHepPdg", part_pdg);
 
   std::map<int, particle> map_part;
 
@@ -782,6 +789,8 @@ void Analyze(const char* fMc, const char* fIn)
               << "%]" << std::flush;
 
     t->GetEntry(i);
+    tTrueMC->GetEntry(i);
+    gRooTracker->GetEntry(i);
     map_part.clear();
     evt.particles.clear();
 
@@ -3,27 +3,39 @@
 #include "SANDDigitizationFLUKA.h"
 
 #include <iostream>
+#include <stdexcept>
 
 void help_digit()
 {
   std::cout << "usage: Digitize <MC file> <digit file> [detsim_type] "
-               "[ecal_digi_mode]\n";
+               "[ecal_digi_mode] [-j <nthreads>] [-seed <run seed>] "
+               "[-full_pe] [-rebuild_geo_cache]\n";
   std::cout << "    - detsim_type: 'detsim_type::edepsim' (default) \n";
   std::cout << "                   'detsim_type::fluka' \n";
   std::cout
       << "    - ecal_digi_mode: 'ecal_digi_mode::const_fract' (default) \n";
   std::cout << "                      'ecal_digi_mode::fixed_thresh' \n";
+  std::cout << "    - nthreads: number of events digitized in parallel "
+               "(default 1, edepsim only)\n";
+  std::cout << "    - run seed: seed of the random streams (default 0, "
+               "edepsim only)\n";
+  std::cout << "    - full_pe: store the full list of photo-electrons of the "
+               "ECAL signals (debug)\n";
+  std::cout << "    - rebuild_geo_cache: ignore the geometry cache "
+               "(sand_geo_cache_<hash>.bin in $SAND_GEO_CACHE_DIR or in the "
+               "current directory) and rebuild it\n";
 }
 
 int main(int argc, char* argv[])
 {
-  if (argc < 3 || argc > 6) {
+  if (argc < 3 || argc > 12) {
     help_digit();
     return -1;
   }
 
   auto detsim_type = digitization::DETSIM_TYPE::kEdepsim;
   auto ecal_digi_mode = digitization::ECAL_digi_mode::const_fract;
+  int nthreads = 1;
 
   for (int i = 3; i < argc; i++) {
     if (strcmp(argv[i], "detsim_type::fluka") == 0) {
@@ -31,6 +43,14 @@ int main(int argc, char* argv[])
     } else if (strcmp(argv[i], "ecal_digi_mode::fixed_thresh") == 0) {
       ecal_digi_mode = digitization::ECAL_digi_mode::fixed_thresh;
       sand_reco::ecal::acquisition::fixed_thresh_pe = atof(argv[++i]);
+    } else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+      nthreads = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "-seed") == 0 && i + 1 < argc) {
+      digitization::run_seed = strtoul(argv[++i], nullptr, 10);
+    } else if (strcmp(argv[i], "-full_pe") == 0) {
+      digitization::store_photo_electrons = true;
+    } else if (strcmp(argv[i], "-rebuild_geo_cache") == 0) {
+      SANDGeoManager::SetRebuildGeoCache(true);
     }
   }
 
@@ -41,9 +61,17 @@ int main(int argc, char* argv[])
                     ? "ECAL_digi_mode: constant fraction\n"
                     : "ECAL_digi_mode: fixed threshold\n");
 
-  if (detsim_type == digitization::DETSIM_TYPE::kEdepsim) {
-    digitization::edep_sim::digitize(argv[1], argv[2], ecal_digi_mode);
-  } else {
-    digitization::fluka::digitize(argv[1], argv[2], ecal_digi_mode);
+  try {
+    if (detsim_type == digitization::DETSIM_TYPE::kEdepsim) {
+      digitization::edep_sim::digitize(argv[1], argv[2], ecal_digi_mode,
+                                       nthreads);
+    } else {
+      if (nthreads > 1)
+        std::cout << "WARNING: -j not supported for FLUKA, running serially\n";
+      digitization::fluka::digitize(argv[1], argv[2], ecal_digi_mode);
+    }
+  } catch (const std::exception& e) {
+    std::cout << "ERROR: " << e.what() << std::endl;
+    return 1;
   }
 }
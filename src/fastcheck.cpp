@@ -5,9 +5,11 @@
 #include <TH1D.h>
 #include <TH2D.h>
 #include <TROOT.h>
+#include <TStreamerInfo.h>
 #include <TString.h>
 #include <TTree.h>
 
+#include <cstring>
 #include <iostream>
 
 void help()
@@ -33,6 +35,23 @@ void print(TCanvas& c, TString fout, TTree* t, const char* var, TCut sel,
   c.SaveAs(fout.Data());
 }
 
+// true if the class was written in the file with the given data member
+bool has_member(TFile& f, const char* class_name, const char* member)
+{
+  bool found = false;
+  TList* infos = f.GetStreamerInfoList();
+  if (!infos) return false;
+  TIter next(infos);
+  while (TObject* obj = next()) {
+    auto info = dynamic_cast<TStreamerInfo*>(obj);
+    if (info && strcmp(info->GetName(), class_name) == 0 &&
+        info->GetElements()->FindObject(member))
+      found = true;
+  }
+  delete infos;
+  return found;
+}
+
 int main(int argc, char* argv[])
 {
   gROOT->SetBatch(true);
@@ -196,11 +215,17 @@ int main(int argc, char* argv[])
     c.SaveAs(fout.Data());
     c.SetLogz(false);
 
+    // files digitized before pe_count have the full photo-electron list
+    bool has_pe_count = has_member(fin, "dg_ps", "pe_count");
     c.SetLogy(true);
-    print(c, fout, tDigit, "TMath::Log10(dg_cell.ps1.@photo_el.size())", "", "",
-          "cells; log_{10}(#p.e.)");
-    print(c, fout, tDigit, "TMath::Log10(dg_cell.ps2.@photo_el.size())", "", "",
-          "cells; log_{10}(#p.e.)");
+    print(c, fout, tDigit,
+          has_pe_count ? "TMath::Log10(dg_cell.ps1.pe_count)"
+                       : "TMath::Log10(dg_cell.ps1.@photo_el.size())",
+          "", "", "cells; log_{10}(#p.e.)");
+    print(c, fout, tDigit,
+          has_pe_count ? "TMath::Log10(dg_cell.ps2.pe_count)"
+                       : "TMath::Log10(dg_cell.ps2.@photo_el.size())",
+          "", "", "cells; log_{10}(#p.e.)");
     //     print(c, fout, tDigit, "TMath::Log10(dg_cell.ps1.photo_el.time)", "",
     //     "",
     //           "cells; log_{10}(p.e. time1/ns)");
@@ -4,14 +4,24 @@
 #include <TGeoBBox.h>
 #include <TGeoManager.h>
 #include <TH1D.h>
-#include <TRandom3.h>
+#include <TROOT.h>
 
 #include "TG4Event.h"
 #include "TG4HitSegment.h"
 
 #include <algorithm>
+#include <condition_variable>
+#include <exception>
 #include <iostream>
-
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+#include "SANDCounterRNG.h"
+#include "SANDTrackerHough.h"
+#include "SANDTrackerKalmanFilter.h"
 #include "struct.h"
 #include "utils.h"
 #include <iomanip>
@@ -98,38 +108,95 @@ bool findNearDigX(int& idx, double exp_x, std::vector<dg_wire>& vd, double xvtx)
   return found;
 }
 
-bool ishitok(TG4Event* ev, int trackid, TG4HitSegment hit, double postol = 5.,
-             double angtol = 0.3)
+// per-event truth index for the truth-assisted track finding, built once
+// per event:
+// - the trajectory points of each track id, stored as contiguous segments
+//   with their bounding box
+// - for each primary id, the (digit, hit segment) pairs of its hits in
+//   digit order
+struct TruthIndex {
+  struct Segment {
+    double x1, y1, z1;
+    double x2, y2, z2;
+    double min[3];
+    double max[3];
+  };
+  std::vector<Segment> segments;
+  // track id -> [first, last) in segments
+  std::unordered_map<int, std::pair<std::size_t, std::size_t>> track_segments;
+
+  struct DigitHit {
+    unsigned int digit;
+    int hit;
+  };
+  std::unordered_map<int, std::vector<DigitHit>> primary_hits;
+};
+
+void BuildTruthIndex(TG4Event* ev, const std::vector<dg_wire>* vec_digi,
+                     std::string const& trackerType, TruthIndex& index)
 {
-  double x = 0.5 * (hit.Start.X() + hit.Stop.X());
-  double y = 0.5 * (hit.Start.Y() + hit.Stop.Y());
-  double z = 0.5 * (hit.Start.Z() + hit.Stop.Z());
-
-  for (unsigned int jj = 0; jj < ev->Trajectories.size(); jj++) {
-    // if(ev->Trajectories[jj].TrackId == hit.PrimaryId)
-    if (ev->Trajectories[jj].TrackId == trackid) {
-      for (unsigned int kk = 0; kk < ev->Trajectories[jj].Points.size() - 1;
-           kk++) {
-        double dpos =
-            mindist(ev->Trajectories[jj].Points[kk].Position.X(),
-                    ev->Trajectories[jj].Points[kk].Position.Y(),
-                    ev->Trajectories[jj].Points[kk].Position.Z(),
-                    ev->Trajectories[jj].Points[kk + 1].Position.X(),
-                    ev->Trajectories[jj].Points[kk + 1].Position.Y(),
-                    ev->Trajectories[jj].Points[kk + 1].Position.Z(), x, y, z);
-        double dang =
-            angle(ev->Trajectories[jj].Points[kk + 1].Position.X() -
-                      ev->Trajectories[jj].Points[kk].Position.X(),
-                  ev->Trajectories[jj].Points[kk + 1].Position.Y() -
-                      ev->Trajectories[jj].Points[kk].Position.Y(),
-                  ev->Trajectories[jj].Points[kk + 1].Position.Z() -
-                      ev->Trajectories[jj].Points[kk].Position.Z(),
-                  hit.Stop.X() - hit.Start.X(), hit.Stop.Y() - hit.Start.Y(),
-                  hit.Stop.Z() - hit.Start.Z());
-
-        if (dpos < postol && dang < angtol) return true;
+  index.segments.clear();
+  index.track_segments.clear();
+  index.primary_hits.clear();
+
+  // trajectories with the same track id are stored next to each other
+  std::map<int, std::vector<unsigned int>> trajectories_by_id;
+  for (unsigned int j = 0; j < ev->Trajectories.size(); j++)
+    trajectories_by_id[ev->Trajectories[j].TrackId].push_back(j);
+
+  for (const auto& id_traj : trajectories_by_id) {
+    std::size_t first = index.segments.size();
+    for (auto j : id_traj.second) {
+      const auto& points = ev->Trajectories[j].Points;
+      for (unsigned int kk = 0; kk + 1 < points.size(); kk++) {
+        const auto& p1 = points[kk].Position;
+        const auto& p2 = points[kk + 1].Position;
+        TruthIndex::Segment seg{p1.X(), p1.Y(), p1.Z(), p2.X(), p2.Y(), p2.Z(),
+                                {std::min(p1.X(), p2.X()), std::min(p1.Y(), p2.Y()),
+                                 std::min(p1.Z(), p2.Z())},
+                                {std::max(p1.X(), p2.X()), std::max(p1.Y(), p2.Y()),
+                                 std::max(p1.Z(), p2.Z())}};
+        index.segments.push_back(seg);
       }
     }
+    index.track_segments[id_traj.first] = {first, index.segments.size()};
+  }
+
+  const auto& hits = ev->SegmentDetectors[trackerType.c_str()];
+  for (unsigned int k = 0; k < vec_digi->size(); k++) {
+    for (auto h : vec_digi->at(k).hindex) {
+      index.primary_hits[hits.at(h).PrimaryId].push_back({k, h});
+    }
+  }
+}
+
+bool ishitok(const TruthIndex& index, int trackid, const TG4HitSegment& hit,
+             double postol = 5., double angtol = 0.3)
+{
+  auto range = index.track_segments.find(trackid);
+  if (range == index.track_segments.end()) return false;
+
+  double p[3] = {0.5 * (hit.Start.X() + hit.Stop.X()),
+                 0.5 * (hit.Start.Y() + hit.Stop.Y()),
+                 0.5 * (hit.Start.Z() + hit.Stop.Z())};
+
+  for (auto kk = range->second.first; kk < range->second.second; kk++) {
+    const auto& seg = index.segments[kk];
+
+    // the distance to the segment is not smaller than the one to its box
+    bool near = true;
+    for (int c = 0; c < 3 && near; c++)
+      near = p[c] > seg.min[c] - postol && p[c] < seg.max[c] + postol;
+    if (!near) continue;
+
+    double dpos = mindist(seg.x1, seg.y1, seg.z1, seg.x2, seg.y2, seg.z2, p[0],
+                          p[1], p[2]);
+    double dang = angle(seg.x2 - seg.x1, seg.y2 - seg.y1, seg.z2 - seg.z1,
+                        hit.Stop.X() - hit.Start.X(),
+                        hit.Stop.Y() - hit.Start.Y(),
+                        hit.Stop.Z() - hit.Start.Z());
+
+    if (dpos < postol && dang < angtol) return true;
   }
   return false;
 }
@@ -453,13 +520,21 @@ enum class TrackFilter {
   only_primaries
 };
 
+// seed of the random streams of the truth based track finding, one stream
+// per event and trajectory: the result does not depend on the threads
+const uint64_t track_finding_seed = 0;
+
 void TrackFind(TG4Event* ev, std::vector<dg_wire>* vec_digi,
-               std::vector<track>& vec_tr,
+               std::vector<track>& vec_tr, int event_index,
                std::string const trackerType = "Straw",
                TrackFilter const track_filter = TrackFilter::all_tracks)
 {
   vec_tr.clear();
 
+  TruthIndex index;
+  BuildTruthIndex(ev, vec_digi, trackerType, index);
+  const auto& hits = ev->SegmentDetectors[trackerType.c_str()];
+
   // for(unsigned int j = 0; j < ev->Primaries[0].Particles.size(); j++)
   for (unsigned int j = 0; j < ev->Trajectories.size(); j++) {
     // exclude not primaries particles
@@ -474,22 +549,29 @@ void TrackFind(TG4Event* ev, std::vector<dg_wire>* vec_digi,
 
     tr.tid = ev->Trajectories.at(j).TrackId;
 
-    TRandom3 rand(0);
+    auto primary_hits = index.primary_hits.find(tr.tid);
+    if (primary_hits == index.primary_hits.end()) continue;
+    const auto& digit_hits = primary_hits->second;
+
+    SANDCounterRNG rand(track_finding_seed, event_index,
+                        SANDCounterRNG::Subsystem::kTrackFinding, tr.tid);
 
     std::map<double, dg_wire> time_ordered_XZdigit;
     std::map<double, dg_wire> time_ordered_YZdigit;
 
-    for (unsigned int k = 0; k < vec_digi->size(); k++) {
+    // hits of this primary, grouped by digit
+    for (auto first = digit_hits.begin(); first != digit_hits.end(); ) {
+      unsigned int k = first->digit;
+      auto last = first;
+      while (last != digit_hits.end() && last->digit == k) last++;
 
       std::vector<TG4HitSegment> vhits;
 
-      for (unsigned int m = 0; m < vec_digi->at(k).hindex.size(); m++) {
-        const TG4HitSegment& hseg = ev->SegmentDetectors[trackerType.c_str()]
-                                        .at(vec_digi->at(k).hindex.at(m));
-
-        if (hseg.PrimaryId == tr.tid)
-          if (ishitok(ev, tr.tid, hseg)) vhits.push_back(hseg);
+      for (auto dh = first; dh != last; dh++) {
+        const TG4HitSegment& hseg = hits.at(dh->hit);
+        if (ishitok(index, tr.tid, hseg)) vhits.push_back(hseg);
       }
+      first = last;
 
       if (vhits.size() > 0u) {
         std::sort(vhits.begin(), vhits.end(),
@@ -861,6 +943,41 @@ void TrackFind(std::vector<track>& tracks, std::vector<dg_wire> digits,
   mergeXYTracks(clustersX, clustersY, tracks, dn_tol, dz_tol);
 }
 
+// truth free track finding: the candidates of the Hough transform in the
+// two views are merged as in the full mode track finding
+void TrackFind(std::vector<track>& tracks, const std::vector<dg_wire>& digits,
+               unsigned int mindigtr, const double dn_tol, const double dz_tol)
+{
+  // drift_time_measured is not filled in this chain: radii from the tdc
+  std::vector<double> radii =
+      SANDTrackerHough::DriftRadii(digits, sand_reco::stt::v_drift);
+
+  SANDTrackerHough hough;
+  hough.SetMinDigits(mindigtr + 1);
+
+  std::vector<std::vector<int> > groupsY;
+  std::vector<std::vector<int> > groupsX;
+  hough.FindTracks(digits, radii, groupsY, groupsX);
+
+  // groups are already ordered by size
+  std::vector<std::vector<dg_wire> > clustersY(groupsY.size());
+  std::vector<std::vector<dg_wire> > clustersX(groupsX.size());
+
+  for (unsigned int jj = 0; jj < groupsY.size(); jj++) {
+    for (auto i : groupsY[jj]) clustersY[jj].push_back(digits[i]);
+    std::sort(clustersY[jj].begin(), clustersY[jj].end(),
+              sand_reco::stt::isDigUpstream);
+  }
+
+  for (unsigned int jj = 0; jj < groupsX.size(); jj++) {
+    for (auto i : groupsX[jj]) clustersX[jj].push_back(digits[i]);
+    std::sort(clustersX[jj].begin(), clustersX[jj].end(),
+              sand_reco::stt::isDigUpstream);
+  }
+
+  mergeXYTracks(clustersX, clustersY, tracks, dn_tol, dz_tol);
+}
+
 void TrackFit(std::vector<track>& vec_tr)
 {
 
@@ -1117,6 +1234,66 @@ void TrackFit(std::vector<track>& tracks, std::vector<double>& binning,
   fillPosAndTime(tracks);
 }
 
+// express the smoothed state at the first site as the circle in the yz
+// view and the line in the (rho, x) view used by the other fits
+void fillInfoKalmanFit(const SANDTrackerKFResult& result,
+                       const std::vector<dg_wire>& digits, track& tr)
+{
+  const auto& first = result.sites.front();
+  const auto& state = first.smoothed;
+
+  double qop = state(4);
+  double tx = state(2);
+  double ty = state(3);
+  double n = TMath::Sqrt(1. + tx * tx + ty * ty);
+  double uz = 1. / TMath::Sqrt(1. + ty * ty);
+  double uy = ty * uz;
+
+  tr.x0 = state(0);
+  tr.y0 = state(1);
+  tr.z0 = first.z;
+  tr.t0 = digits[first.digit].tdc;
+
+  // sites are ordered by z: a positive q/p in a field along +x turns the
+  // track counterclockwise as seen from positive x
+  double pyz = TMath::Abs(qop) > 0. ? TMath::Sqrt(1. + ty * ty) / n /
+                                          TMath::Abs(qop)
+                                    : 1E9;
+  tr.r = SANDTrackerUtils::GetRadiusInMMFromPerpMomentumInGeV(pyz);
+  tr.h = qop * SANDTrackerUtils::GetMagneticField() > 0. ? -1 : 1;
+  tr.zc = tr.z0 + tr.h * tr.r * uy;
+  tr.yc = tr.y0 - tr.h * tr.r * uz;
+  tr.ysig = evalYSign(tr);
+
+  // rho is measured along the direction at the first site
+  tr.b = tx * uz;
+  tr.a = tr.x0 - tr.b * (tr.z0 * uz + tr.y0 * uy);
+
+  tr.ret_cr = 0;
+  tr.ret_ln = 0;
+  tr.chi2_cr = result.chi2 / result.ndf;
+  tr.chi2_ln = tr.chi2_cr;
+}
+
+// Kalman filter fit of the tracks; the tracks where the filter fails keep
+// the result of the circle and linear fits
+void KalmanTrackFit(std::vector<track>& vec_tr)
+{
+  SANDTrackerKalmanFilter kf;
+  SANDTrackerKFResult result;
+  std::vector<dg_wire> digits;
+
+  for (auto& tr : vec_tr) {
+    digits.clear();
+    digits.insert(digits.end(), tr.clX.begin(), tr.clX.end());
+    digits.insert(digits.end(), tr.clY.begin(), tr.clY.end());
+
+    if (!kf.Fit(digits, result) || result.ndf <= 0) continue;
+
+    fillInfoKalmanFit(result, digits, tr);
+  }
+}
+
 bool IsContiguous(const dg_cell& c1, const dg_cell& c2)
 {
   if (c1.mod == c2.mod) {
@@ -1177,6 +1354,85 @@ void PreCluster(std::vector<dg_cell>* vec_cell, std::vector<cluster>& vec_precl)
   // std::cout << vec_precl.size() << std::endl;
 }
 
+// ECAL clustering on the cell neighbour graph of SANDGeoManager: fired
+// neighbour cells with compatible times are joined (union-find). Cells with
+// times further apart than max_dt are not joined, so that overlapping
+// showers separated in time end in different clusters
+namespace
+{
+int find_root(std::vector<int>& parent, int i)
+{
+  while (parent[i] != i) {
+    parent[i] = parent[parent[i]];
+    i = parent[i];
+  }
+  return i;
+}
+}  // namespace
+
+void GraphClustering(const SANDGeoManager& sand_geo,
+                     std::vector<dg_cell>* vec_cell,
+                     std::vector<cluster>& vec_cl, double max_dt = 5.)
+{
+  const double cell_max_dt = 30.;  // ns -> dt > 30. ns is unphysical
+
+  const int ncells = vec_cell->size();
+
+  // good cells: signal on both sides and compatible tdc
+  std::vector<double> time(ncells);
+  std::vector<bool> good(ncells, false);
+  // dense ECAL index -> position in vec_cell
+  std::vector<int> slot(sand_geo.get_n_ecal_cells(), -1);
+  std::vector<int> cell_index(ncells, -1);
+
+  for (int i = 0; i < ncells; i++) {
+    const auto& c = vec_cell->at(i);
+    if (c.ps1.size() == 0 || c.ps2.size() == 0 ||
+        std::abs(c.ps1.at(0).tdc - c.ps2.at(0).tdc) > cell_max_dt)
+      continue;
+    cell_index[i] = sand_geo.get_ecal_cell_index(c.id);
+    if (cell_index[i] < 0) continue;
+    good[i] = true;
+    time[i] = sand_reco::ecal::reco::TfromTDC(c.ps1.at(0).tdc,
+                                              c.ps2.at(0).tdc, c.l);
+    slot[cell_index[i]] = i;
+  }
+
+  std::vector<int> parent(ncells);
+  std::vector<int> size(ncells, 1);
+  for (int i = 0; i < ncells; i++) parent[i] = i;
+
+  for (int i = 0; i < ncells; i++) {
+    if (!good[i]) continue;
+    for (auto nb = sand_geo.get_ecal_neighbours_begin(cell_index[i]);
+         nb != sand_geo.get_ecal_neighbours_end(cell_index[i]); ++nb) {
+      int j = slot[*nb];
+      if (j < 0 || std::abs(time[i] - time[j]) > max_dt) continue;
+
+      int ri = find_root(parent, i);
+      int rj = find_root(parent, j);
+      if (ri == rj) continue;
+      if (size[ri] < size[rj]) std::swap(ri, rj);
+      parent[rj] = ri;
+      size[ri] += size[rj];
+    }
+  }
+
+  // clusters ordered as their first cell in vec_cell
+  std::vector<int> root_to_cluster(ncells, -1);
+  for (int i = 0; i < ncells; i++) {
+    if (!good[i]) continue;
+    int r = find_root(parent, i);
+    if (root_to_cluster[r] < 0) {
+      root_to_cluster[r] = vec_cl.size();
+      cluster cl;
+      cl.tid = -1;
+      vec_cl.push_back(cl);
+    }
+    vec_cl[root_to_cluster[r]].cells.push_back(vec_cell->at(i));
+  }
+}
+
 void Filter(std::vector<cluster>& vec_cl)
 {
   for (unsigned int i = 0; i < vec_cl.size(); i++) {
@@ -1318,6 +1574,21 @@ bool value_comparer(std::map<int, int>::value_type& i1,
   return i1.second < i2.second;
 }
 
+// count the p.e. of the signal per primary: use the hit summary, or the
+// full photo-electron list for files digitized without it
+void CountPrimaryPhotoElectrons(TG4Event* ev, const dg_ps& ps,
+                                std::map<int, int>& hit_pid)
+{
+  const auto& hits = ev->SegmentDetectors["EMCalSci"];
+
+  if (!ps.h_index.empty()) {
+    for (unsigned int j = 0; j < ps.h_index.size(); j++)
+      hit_pid[hits.at(ps.h_index[j]).PrimaryId] += ps.h_multiplicity[j];
+  } else {
+    for (const auto& p : ps.photo_el) hit_pid[hits.at(p.h_index).PrimaryId]++;
+  }
+}
+
 void PidBasedClustering(TG4Event* ev, std::vector<dg_cell>* vec_cell,
                         std::vector<cluster>& vec_cl)
 {
@@ -1331,20 +1602,10 @@ void PidBasedClustering(TG4Event* ev, std::vector<dg_cell>* vec_cell,
     hit_pid.clear();
 
     if (vec_cell->at(i).ps1.size() > 0)
-      for (unsigned int j = 0; j < vec_cell->at(i).ps1.at(0).photo_el.size();
-           j++) {
-        hit_pid[ev->SegmentDetectors["EMCalSci"]
-                    .at(vec_cell->at(i).ps1.at(0).photo_el.at(j).h_index)
-                    .PrimaryId]++;
-      }
+      CountPrimaryPhotoElectrons(ev, vec_cell->at(i).ps1.at(0), hit_pid);
 
     if (vec_cell->at(i).ps2.size() > 0)
-      for (unsigned int j = 0; j < vec_cell->at(i).ps2.at(0).photo_el.size();
-           j++) {
-        hit_pid[ev->SegmentDetectors["EMCalSci"]
-                    .at(vec_cell->at(i).ps2.at(0).photo_el.at(j).h_index)
-                    .PrimaryId]++;
-      }
+      CountPrimaryPhotoElectrons(ev, vec_cell->at(i).ps2.at(0), hit_pid);
 
     pid[i] =
         std::max_element(hit_pid.begin(), hit_pid.end(), value_comparer)->first;
@@ -1615,15 +1876,256 @@ void DetermineModulesPosition(TGeoManager* g, std::vector<double>& binning)
 enum class STT_Mode {
   fast_only_primaries,
   fast,
-  full
+  full,
+  hough
 };
 enum class ECAL_Mode {
-  fast
+  fast,
+  graph
+};
+enum class Fit_Mode {
+  standard,
+  kalman
+};
+
+// reconstruct a single event: tracks from the tracker digits and clusters
+// from the ECAL digits. Only locals are used, so that events can be
+// reconstructed concurrently
+void reconstruct_event(int event_index, TG4Event* ev,
+                       std::vector<dg_wire>* vec_digi,
+                       std::vector<dg_cell>* vec_cell,
+                       std::vector<track>& vec_tr, std::vector<cluster>& vec_cl,
+                       STT_Mode stt_mode, ECAL_Mode ecal_mode,
+                       Fit_Mode fit_mode, std::string const& trackerType,
+                       std::vector<double>& sampling,
+                       const SANDGeoManager* sand_geo)
+{
+  const double epsilon = 0.5;
+  const double tol_phi = 0.1;
+  const double tol_x = 100.;
+  const int tol_mod = 4;
+  const int mindigtr = 3;
+  const double dn_tol = 1.E7;
+  const double dz_tol = 1.E7;
+
+  vec_tr.clear();
+  vec_cl.clear();
+
+  double xvtx_reco, yvtx_reco, zvtx_reco;
+  int VtxType;
+
+  switch (stt_mode) {
+    case STT_Mode::fast_only_primaries:
+      TrackFind(ev, vec_digi, vec_tr, event_index, trackerType,
+                TrackFilter::only_primaries);
+      TrackFit(vec_tr);
+      break;
+    case STT_Mode::fast:
+      TrackFind(ev, vec_digi, vec_tr, event_index, trackerType);
+      TrackFit(vec_tr);
+      break;
+    case STT_Mode::full:
+      VertexFind(xvtx_reco, yvtx_reco, zvtx_reco, VtxType, *vec_digi,
+                 sampling, epsilon);
+      TrackFind(vec_tr, *vec_digi, sampling, xvtx_reco, yvtx_reco, zvtx_reco,
+                tol_phi, tol_x, tol_mod, mindigtr, dn_tol, dz_tol);
+      TrackFit(vec_tr, sampling, xvtx_reco, yvtx_reco, zvtx_reco);
+      break;
+    case STT_Mode::hough:
+      TrackFind(vec_tr, *vec_digi, mindigtr, dn_tol, dz_tol);
+      TrackFit(vec_tr);
+      break;
+  }
+
+  if (fit_mode == Fit_Mode::kalman) KalmanTrackFit(vec_tr);
+
+  switch (ecal_mode) {
+    case ECAL_Mode::fast:
+      // PreCluster(vec_cell, vec_cl);
+      // Filter(vec_cl);
+      PidBasedClustering(ev, vec_cell, vec_cl);
+      Merge(vec_cl);
+      break;
+    case ECAL_Mode::graph:
+      GraphClustering(*sand_geo, vec_cell, vec_cl);
+      Merge(vec_cl);
+      break;
+  }
+}
+
+namespace
+{
+// reconstructed objects of one event waiting to be written
+struct reconstructed_event {
+  std::vector<track> vec_tr;
+  std::vector<cluster> vec_cl;
 };
 
+// max number of reconstructed events kept in memory waiting for the writer
+const int max_events_in_flight_per_thread = 16;
+
+void print_progress(int i, int nev)
+{
+  std::cout << "\b\b\b\b\b" << std::setw(3) << int(double(i) / nev * 100)
+            << "%]" << std::flush;
+}
+
+// the MC truth is used only by the truth assisted modes
+bool needs_truth(STT_Mode stt_mode, ECAL_Mode ecal_mode)
+{
+  return stt_mode == STT_Mode::fast_only_primaries ||
+         stt_mode == STT_Mode::fast || ecal_mode == ECAL_Mode::fast;
+}
+
+// bind the event of EDepSimEvents leaving active only the branches used by
+// the selected modes: the primaries are never used, the trajectories only
+// by the fast track finding. The truth tree is not bound at all, and so
+// never read, when no truth assisted mode is selected
+void set_truth_branches(TTree* tTrueMC, TG4Event*& ev, STT_Mode stt_mode,
+                        ECAL_Mode ecal_mode)
+{
+  if (!needs_truth(stt_mode, ecal_mode)) return;
+
+  // the found counter avoids the error message for not split files
+  unsigned int found = 0;
+  tTrueMC->SetBranchStatus("Primaries*", 0, &found);
+  if (stt_mode == STT_Mode::full || stt_mode == STT_Mode::hough)
+    tTrueMC->SetBranchStatus("Trajectories*", 0, &found);
+  tTrueMC->SetBranchAddress("Event", &ev);
+}
+}  // namespace
+
+// event-parallel reconstruction: each worker reads its own copy of the
+// input trees and reconstructs the next available event; the calling thread
+// writes the events in input order so that tReco stays aligned to tDigit
+void reconstruct_parallel(std::string const& fname_hits,
+                          std::string const& fname_digits, STT_Mode stt_mode,
+                          ECAL_Mode ecal_mode, Fit_Mode fit_mode,
+                          std::string const& trackerType,
+                          std::vector<double> const& sampling,
+                          const SANDGeoManager* sand_geo, int nthreads,
+                          int nev, TTree& tout, std::vector<track>& vec_tr,
+                          std::vector<cluster>& vec_cl)
+{
+  ROOT::EnableThreadSafety();
+  // the helper histograms of the track finding are local to each event
+  TH1::AddDirectory(false);
+
+  const int max_in_flight = nthreads * max_events_in_flight_per_thread;
+
+  std::mutex mtx;
+  std::condition_variable cv_done;   // an event has been reconstructed
+  std::condition_variable cv_space;  // an event has been written
+  std::map<int, reconstructed_event> done;
+  int next_event = 0;
+  int next_to_write = 0;
+  bool failed = false;
+  std::string failure;
+
+  const bool read_truth = needs_truth(stt_mode, ecal_mode);
+
+  auto worker = [&]() {
+    TFile f_hits(fname_hits.data(), "READ");
+    TFile f_digits(fname_digits.data(), "READ");
+    TTree* t = (TTree*)f_digits.Get("tDigit");
+    TTree* tTrueMC = (TTree*)f_hits.Get("EDepSimEvents");
+
+    TG4Event* ev = new TG4Event;
+    std::vector<dg_wire>* vec_digi = new std::vector<dg_wire>;
+    std::vector<dg_cell>* vec_cell = new std::vector<dg_cell>;
+    set_truth_branches(tTrueMC, ev, stt_mode, ecal_mode);
+    t->SetBranchAddress("dg_wire", &vec_digi);
+    t->SetBranchAddress("dg_cell", &vec_cell);
+
+    std::vector<double> thread_sampling = sampling;
+
+    while (true) {
+      int i;
+      {
+        std::unique_lock<std::mutex> lock(mtx);
+        cv_space.wait(lock, [&] {
+          return failed || next_event >= nev ||
+                 next_event < next_to_write + max_in_flight;
+        });
+        if (failed || next_event >= nev) break;
+        i = next_event++;
+      }
+
+      reconstructed_event result;
+      try {
+        t->GetEntry(i);
+        if (read_truth) tTrueMC->GetEntry(i);
+        reconstruct_event(i, ev, vec_digi, vec_cell, result.vec_tr,
+                          result.vec_cl, stt_mode, ecal_mode, fit_mode,
+                          trackerType, thread_sampling, sand_geo);
+      } catch (const std::exception& e) {
+        std::lock_guard<std::mutex> lock(mtx);
+        if (!failed)
+          failure = "event " + std::to_string(i) + ": " + e.what();
+        failed = true;
+        cv_done.notify_all();
+        cv_space.notify_all();
+        break;
+      } catch (...) {
+        std::lock_guard<std::mutex> lock(mtx);
+        if (!failed) failure = "event " + std::to_string(i) + ": unknown error";
+        failed = true;
+        cv_done.notify_all();
+        cv_space.notify_all();
+        break;
+      }
+
+      std::lock_guard<std::mutex> lock(mtx);
+      done[i] = std::move(result);
+      cv_done.notify_all();
+    }
+
+    t->ResetBranchAddresses();
+    tTrueMC->ResetBranchAddresses();
+    delete ev;
+    delete vec_digi;
+    delete vec_cell;
+    f_digits.Close();
+    f_hits.Close();
+  };
+
+  std::vector<std::thread> workers;
+  for (int k = 0; k < nthreads; k++) workers.emplace_back(worker);
+
+  // ordered writer
+  for (; next_to_write < nev; ) {
+    reconstructed_event result;
+    {
+      std::unique_lock<std::mutex> lock(mtx);
+      cv_done.wait(lock,
+                   [&] { return failed || done.count(next_to_write) > 0; });
+      if (failed) break;
+      auto it = done.find(next_to_write);
+      result = std::move(it->second);
+      done.erase(it);
+    }
+
+    print_progress(next_to_write, nev);
+
+    vec_tr.swap(result.vec_tr);
+    vec_cl.swap(result.vec_cl);
+    tout.Fill();
+
+    std::lock_guard<std::mutex> lock(mtx);
+    next_to_write++;
+    cv_space.notify_all();
+  }
+
+  for (auto& w : workers) w.join();
+
+  if (failed)
+    throw std::runtime_error("reconstruct_parallel: reconstruction failed at " +
+                             failure);
+}
+
 void Reconstruct(std::string const& fname_hits, std::string const& fname_digits,
                  std::string const& fname_out, STT_Mode stt_mode,
-                 ECAL_Mode ecal_mode)
+                 ECAL_Mode ecal_mode, Fit_Mode fit_mode, int nthreads = 1)
 {
   std::cout << "Reconstruct\ninput hits: " << fname_hits
             << "\ninput digits: " << fname_digits
@@ -1633,22 +2135,20 @@ void Reconstruct(std::string const& fname_hits, std::string const& fname_digits,
   TFile f_digits(fname_digits.data(), "READ");
   TFile f_out(fname_out.data(), "UPDATE");
 
-  if (f_hits.IsZombie() || f_digits.IsZombie() || f_out.IsZombie()) {
-    std::cout << "Error in opening file\n";
-    exit(1);
-  }
+  if (f_hits.IsZombie() || f_digits.IsZombie() || f_out.IsZombie())
+    throw std::runtime_error("Reconstruct: error in opening file");
 
   TTree* tTrueMC = (TTree*)f_hits.Get("EDepSimEvents");
   TGeoManager* geo = (TGeoManager*)f_hits.Get("EDepSimGeometry");
   TTree* tDigit = (TTree*)f_digits.Get("tDigit");
 
-  if (tTrueMC == nullptr || geo == nullptr || tDigit == nullptr) {
-    std::cout << "Error in retrieving objects from root file: "
-              << (tTrueMC == nullptr ? "EDepSimEvents " : "")
-              << (geo == nullptr ? "EDepSimGeometry " : "")
-              << (tDigit == nullptr ? "tDigit " : "") << '\n';
-    exit(-1);
-  }
+  if (tTrueMC == nullptr || geo == nullptr || tDigit == nullptr)
+    throw std::runtime_error(
+        std::string("Reconstruct: error in retrieving objects from root "
+                    "file: ") +
+        (tTrueMC == nullptr ? "EDepSimEvents " : "") +
+        (geo == nullptr ? "EDepSimGeometry " : "") +
+        (tDigit == nullptr ? "tDigit " : ""));
 
   std::string trackerType = "";
 
@@ -1659,21 +2159,26 @@ void Reconstruct(std::string const& fname_hits, std::string const& fname_digits,
     std::cout << "\n--- Drift based simulation ---\n";
     trackerType = "DriftVolume";
   } else {
-    std::cout << "Error in retriving volume information from Geo Manager, "
-                 "exiting...\n";
-    exit(-1);
+    throw std::runtime_error(
+        "Reconstruct: error in retrieving volume information from Geo "
+        "Manager");
   }
 
   std::vector<double> sampling;
 
   DetermineModulesPosition(geo, sampling);
 
-  tDigit->AddFriend(tTrueMC);
+  // ECAL neighbour table for the graph clustering
+  SANDGeoManager sand_geo;
+  if (ecal_mode == ECAL_Mode::graph) sand_geo.init(geo);
 
   TTree* t = tDigit;
 
+  // the truth is read only if requested by the selected modes
+  const bool read_truth = needs_truth(stt_mode, ecal_mode);
+
   TG4Event* ev = new TG4Event;
-  t->SetBranchAddress("Event", &ev);
+  set_truth_branches(tTrueMC, ev, stt_mode, ecal_mode);
 
   std::vector<dg_wire>* vec_digi = new std::vector<dg_wire>;
   std::vector<dg_cell>* vec_cell = new std::vector<dg_cell>;
@@ -1689,62 +2194,35 @@ void Reconstruct(std::string const& fname_hits, std::string const& fname_digits,
   tout.Branch("cluster", "std::vector<cluster>", &vec_cl);
 
   const int nev = t->GetEntries();
-  const double epsilon = 0.5;
-  const double tol_phi = 0.1;
-  const double tol_x = 100.;
-  const int tol_mod = 4;
-  const int mindigtr = 3;
-  const double dn_tol = 1.E7;
-  const double dz_tol = 1.E7;
 
   std::cout << "Events: " << nev << " [";
   std::cout << std::setw(3) << int(0) << "%]" << std::flush;
 
-  for (int i = 0; i < nev; i++) {
-    std::cout << "\b\b\b\b\b" << std::setw(3) << int(double(i) / nev * 100)
-              << "%]" << std::flush;
-
-    t->GetEntry(i);
-
-    vec_tr.clear();
-    vec_cl.clear();
-
-    double xvtx_reco, yvtx_reco, zvtx_reco;
-    int VtxType;
-
-    std::vector<dg_wire> clustersY;
-    std::vector<dg_wire> clustersX;
+  // on failure the events reconstructed so far are still written, then
+  // the error goes up to main
+  std::exception_ptr error;
+  try {
+    if (nthreads > 1) {
+      reconstruct_parallel(fname_hits, fname_digits, stt_mode, ecal_mode,
+                           fit_mode, trackerType, sampling, &sand_geo,
+                           nthreads, nev, tout, vec_tr, vec_cl);
+    } else {
+      for (int i = 0; i < nev; i++) {
+        print_progress(i, nev);
 
-    switch (stt_mode) {
-      case STT_Mode::fast_only_primaries:
-        TrackFind(ev, vec_digi, vec_tr, trackerType,
-                  TrackFilter::only_primaries);
-        TrackFit(vec_tr);
-        break;
-      case STT_Mode::fast:
-        TrackFind(ev, vec_digi, vec_tr, trackerType);
-        TrackFit(vec_tr);
-        break;
-      case STT_Mode::full:
-        VertexFind(xvtx_reco, yvtx_reco, zvtx_reco, VtxType, *vec_digi,
-                   sampling, epsilon);
-        TrackFind(vec_tr, *vec_digi, sampling, xvtx_reco, yvtx_reco, zvtx_reco,
-                  tol_phi, tol_x, tol_mod, mindigtr, dn_tol, dz_tol);
-        TrackFit(vec_tr, sampling, xvtx_reco, yvtx_reco, zvtx_reco);
-        break;
-    }
+        t->GetEntry(i);
+        if (read_truth) tTrueMC->GetEntry(i);
 
-    switch (ecal_mode) {
-      case ECAL_Mode::fast:
-        // PreCluster(vec_cell, vec_cl);
-        // Filter(vec_cl);
-        PidBasedClustering(ev, vec_cell, vec_cl);
-        Merge(vec_cl);
-        break;
+        reconstruct_event(i, ev, vec_digi, vec_cell, vec_tr, vec_cl,
+                          stt_mode, ecal_mode, fit_mode, trackerType,
+                          sampling, &sand_geo);
+        tout.Fill();
+      }
     }
-    tout.Fill();
+    std::cout << "\b\b\b\b\b" << std::setw(3) << 100 << "%]" << std::flush;
+  } catch (...) {
+    error = std::current_exception();
   }
-  std::cout << "\b\b\b\b\b" << std::setw(3) << 100 << "%]" << std::flush;
   std::cout << std::endl;
 
   vec_tr.clear();
@@ -1759,37 +2237,81 @@ void Reconstruct(std::string const& fname_hits, std::string const& fname_digits,
   f_out.cd();
   tout.Write("", TObject::kOverwrite);
   f_out.Close();
+
+  if (error) std::rethrow_exception(error);
 }
 
 void help_reco()
 {
-  std::cout
-      << "usage: Reconstruct hit_file digit_file output_file [stt_mode]\n";
+  std::cout << "usage: Reconstruct hit_file digit_file output_file [stt_mode] "
+               "[ecal_mode] [fit_mode] [-j <nthreads>] [-rebuild_geo_cache]\n";
   std::cout << "    - stt_mode: 'stt_mode::fast_only_primaries' (default) \n";
   std::cout << "                'stt_mode::fast' \n";
   std::cout << "                'stt_mode::full' \n";
+  std::cout << "                'stt_mode::hough' \n";
+  std::cout << "    - ecal_mode: 'ecal_mode::fast' (default, truth based) \n";
+  std::cout << "                 'ecal_mode::graph' \n";
+  std::cout << "    - fit_mode: 'fit_mode::standard' (default, circle and "
+               "line fits) \n";
+  std::cout << "                'fit_mode::kalman' \n";
+  std::cout << "    - nthreads: number of events reconstructed in parallel "
+               "(default 1)\n";
+  std::cout << "    - rebuild_geo_cache: ignore the geometry cache "
+               "(sand_geo_cache_<hash>.bin in $SAND_GEO_CACHE_DIR or in the "
+               "current directory) and rebuild it\n";
 }
 
 int main(int argc, char* argv[])
 {
   // boost::program_options wuold be great here....
 
-  if (argc < 4 || argc > 6) {
+  if (argc < 4 || argc > 10) {
     help_reco();
     return -1;
   }
 
   auto stt_mode = STT_Mode::fast_only_primaries;
-  if (argc > 4 && strcmp(argv[4], "stt_mode::full") == 0) {
-    stt_mode = STT_Mode::full;
+  auto ecal_mode = ECAL_Mode::fast;
+  auto fit_mode = Fit_Mode::standard;
+  int nthreads = 1;
+  for (int i = 4; i < argc; i++) {
+    if (strcmp(argv[i], "stt_mode::full") == 0) {
+      stt_mode = STT_Mode::full;
+    } else if (strcmp(argv[i], "stt_mode::hough") == 0) {
+      stt_mode = STT_Mode::hough;
+    } else if (strcmp(argv[i], "stt_mode::fast") == 0) {
+      stt_mode = STT_Mode::fast;
+    } else if (strcmp(argv[i], "ecal_mode::graph") == 0) {
+      ecal_mode = ECAL_Mode::graph;
+    } else if (strcmp(argv[i], "fit_mode::kalman") == 0) {
+      fit_mode = Fit_Mode::kalman;
+    } else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+      nthreads = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "-rebuild_geo_cache") == 0) {
+      SANDGeoManager::SetRebuildGeoCache(true);
+    }
+  }
+
+  if (stt_mode == STT_Mode::full) {
     std::cout << "STT_Mode: full\n";
-  } else if (argc > 4 && strcmp(argv[4], "stt_mode::fast") == 0) {
-    stt_mode = STT_Mode::fast;
+  } else if (stt_mode == STT_Mode::fast) {
     std::cout << "STT_Mode: fast\n";
+  } else if (stt_mode == STT_Mode::hough) {
+    std::cout << "STT_Mode: hough\n";
   } else {
     std::cout << "STT_Mode: fast_only_primaries\n";
   }
-
-  Reconstruct(argv[1], argv[2], argv[3], stt_mode, ECAL_Mode::fast);
+  std::cout << (ecal_mode == ECAL_Mode::graph ? "ECAL_Mode: graph\n"
+                                              : "ECAL_Mode: fast\n");
+  std::cout << (fit_mode == Fit_Mode::kalman ? "Fit_Mode: kalman\n"
+                                             : "Fit_Mode: standard\n");
+
+  try {
+    Reconstruct(argv[1], argv[2], argv[3], stt_mode, ecal_mode, fit_mode,
+                nthreads);
+  } catch (const std::exception& e) {
+    std::cout << "ERROR: " << e.what() << std::endl;
+    return 1;
+  }
   return 0;
 }
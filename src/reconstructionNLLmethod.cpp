@@ -1,9 +1,17 @@
+#include <algorithm>
+#include <condition_variable>
 #include <iostream>
 #include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
 #include <TAxis.h>
 #include <TRandom3.h>
 
 #include "SANDRecoUtils.h"
+#include "SANDRecoLeastSquares.h"
+#include "SANDTrackerHough.h"
 
 #include "TFile.h"
 #include "TTree.h"
@@ -13,6 +21,9 @@
 #include "TLegend.h"
 #include "TG4Event.h"
 #include "TH1D.h"
+#include "TROOT.h"
+#include "TDatabasePDG.h"
+#include "TParticlePDG.h"
 #include "TG4HitSegment.h"
 
 /*
@@ -39,10 +50,27 @@ bool _DEBUG_ = false;
 
 bool USE_NON_SMEARED_TRACK = false;
 
+bool USE_HOUGH_PATTERN_RECO = false;
+
+// fit all the charged primaries instead of the first trajectory only
+bool FIT_ALL_PRIMARIES = false;
+
+// number of threads fitting the tracks
+unsigned int NOF_THREADS = 1;
+
+// max number of tracks waiting to be written, per thread
+const unsigned int MAX_TRACKS_IN_FLIGHT_PER_THREAD = 8;
+
 unsigned int MIN_NOF_XZ_HITS = 5;
 
 unsigned int MIN_NOF_ZY_HITS = 5;
 
+// max number of (TDC conversion, fit) cycles per track
+unsigned int MAX_NOF_FIT_CYCLES = 10;
+
+// the cycles stop when no drift radius changes more than this (mm)
+double DRIFT_RADIUS_TOLERANCE = 1e-3;
+
 // CONSTANS____________________________________________________________________
 
 const double SAND_CENTER_X = 0.;
@@ -76,6 +104,8 @@ const double NEUTRINO_INTERACTION_TIME = 1.; // ns
 
 const double LIGHT_VELOCITY = 299.792458; // mm/ns
 
+const double DRIFT_RADIUS_SIGMA = 0.2; // 200 mu_m = 0.2 mm
+
 // GLOBAL VARIABLES____________________________________________________________
 
 TG4Event* evEdep = nullptr;
@@ -84,19 +114,42 @@ TG4Event* evDigit = nullptr;
 
 TGeoManager* geo = nullptr;
 
+/*
+    evEdep, evDigit and event_digits are the input buffers: they are
+    read and used by the main thread only, the fits work on the
+    NLLTrackContext of each track
+*/
 std::vector<dg_wire>* RecoUtils::event_digits = nullptr;
 
-std::vector<TG4HitSegment> event_drift_hits;
+std::vector<Line2D>* track_segments_ZY = nullptr;
 
-// pointer to vertical wires of event_digits
-std::vector<dg_wire*> vertical_fired_wires;
+std::vector<Line2D>* track_segments_XZ = nullptr;
 
-// pointer to horizontal wires of event_digits
-std::vector<dg_wire*> horizontal_fired_wires;
+// serializes the output of the threads
+std::mutex log_mutex;
 
-std::vector<Line2D>* track_segments_ZY = nullptr;
+// TRACK CONTEXT_______________________________________________________________
 
-std::vector<Line2D>* track_segments_XZ = nullptr;
+/*
+    State of the fit of one track: the fired wires selected for it (a copy,
+    the TDC conversion writes into them) split by orientation, the fitter
+    of the thread that processes it and the output. Tracks of the same
+    event and of different events can be fitted concurrently.
+*/
+struct NLLTrackContext
+{
+    unsigned int            edep_event_index = 0;
+    int                     track_id = -1;
+    bool                    KeepThisEvent = false;
+    TG4Trajectory           trajectory;
+    std::vector<dg_wire>    fired_wires;
+    // pointers to the vertical/horizontal wires of fired_wires
+    std::vector<dg_wire*>   vertical_fired_wires;
+    std::vector<dg_wire*>   horizontal_fired_wires;
+    // drift radii fitter, its workspace is reused by the thread
+    SANDRecoLeastSquares*   fitter = nullptr;
+    RecoObject              reco_object;
+};
 
 // COLORS ______________________________________________________________________
 
@@ -106,6 +159,7 @@ Color::Modifier green(Color::FG_GREEN); // opeartions
 Color::Modifier blue(Color::FG_BLUE); // results
 
 void LOG(TString i, const char* out){
+    std::lock_guard<std::mutex> lock(log_mutex);
     if(i.Contains("I")){ // info
         std::cout << green << "[INFO] " << out << def << std::endl;
         std::cout << "\n";
@@ -134,12 +188,15 @@ void help_input(){
               << "-digit <digitization file> "
               << "-wireinfo <WireInfo file> "
               << "-o <fOuptut.root> "
-              << "[signal_propagation] [hit_time] [debug] [track_no_smear]\n";
+              << "[signal_propagation] [hit_time] [hough] [all_primaries] [-j <nthreads>] [debug] [track_no_smear]\n";
     std::cout << "\n";
     std::cout << "<WireInfo file>      : see tests/wireinfo.txt \n";
     // std::cout << "--signal_propagation : include signal_propagation in digitization \n";
     // std::cout << "--hit_time           : include hit time in digitization \n";
     // std::cout << "--track_no_smear     : reconstruct non smeared track (NO E_LOSS NO MCS)\n";
+    std::cout << "--hough              : select the fired wires with the Hough transform instead of the MC truth \n";
+    std::cout << "--all_primaries      : fit all the charged primaries, one entry per track \n";
+    std::cout << "-j <nthreads>        : number of threads fitting the tracks (default 1) \n";
     std::cout << "--debug              : debug mode " << def << std::endl;
 }
 
@@ -178,20 +235,20 @@ void ReadWireInfos(const std::string fInput, std::vector<dg_wire>& wire_infos){
 
 // EVENT SELECTION_____________________________________________________________
 
-std::vector<dg_wire*> SelectWireFiredByTraj(int trj_index){
+std::vector<dg_wire*> SelectWireFiredByTraj(const TG4Event& event,
+                                            std::vector<dg_wire>& digits,
+                                            int trj_index){
 
     std::vector<dg_wire*> selected_wires;
 
-    auto hits = evEdep->SegmentDetectors["DriftVolume"];
+    auto drift_hits = event.SegmentDetectors.find("DriftVolume");
 
-    if (!RecoUtils::event_digits) {
-        // std::cerr << "Error: event_digits is null!" << std::endl;
-        std::cout << "Error: event_digits is null!" << std::endl;
-        return selected_wires;
-    }
+    if (drift_hits == event.SegmentDetectors.end()) return selected_wires;
+
+    const auto& hits = drift_hits->second;
 
     // run over event fired wires
-    for (auto& wire : *RecoUtils::event_digits) {
+    for (auto& wire : digits) {
 
         bool trj_contributed_to_this = true;
 
@@ -203,7 +260,7 @@ std::vector<dg_wire*> SelectWireFiredByTraj(int trj_index){
 
                 // pass only wire whose hits have contrubution
                 // from the trajectory with index traj index
-                if(evEdep->Trajectories[contrib_id].GetTrackId() != trj_index){
+                if(event.Trajectories[contrib_id].GetTrackId() != trj_index){
 
                     trj_contributed_to_this = false;
 
@@ -216,12 +273,39 @@ std::vector<dg_wire*> SelectWireFiredByTraj(int trj_index){
     return selected_wires;
 }
 
-void SplitWiresHorVer(const std::vector<dg_wire*>& wires) {
-    for (auto* wire : wires) {
-        if (wire->hor == 0) {
-            vertical_fired_wires.push_back(wire);
-        } else if (wire->hor == 1) {
-            horizontal_fired_wires.push_back(wire);
+std::vector<dg_wire*> SelectWireFiredByHough(std::vector<dg_wire>& digits){
+
+    std::vector<dg_wire*> selected_wires;
+
+    SANDTrackerHough hough;
+    hough.SetMinDigits(std::min(MIN_NOF_XZ_HITS, MIN_NOF_ZY_HITS));
+
+    std::vector<std::vector<int>> groupsY, groupsX;
+
+    // the signal time along the wire needs a track guess: vote with
+    // radii that neglect it
+    hough.FindTracks(digits,
+                     SANDTrackerHough::DriftRadii(digits, sand_reco::stt::v_drift),
+                     groupsY, groupsX);
+
+    // the muon is assumed to be the largest candidate of each view
+    if(!groupsY.empty()){
+        for(auto i : groupsY.front()) selected_wires.push_back(&digits.at(i));
+    }
+    if(!groupsX.empty()){
+        for(auto i : groupsX.front()) selected_wires.push_back(&digits.at(i));
+    }
+    return selected_wires;
+}
+
+void SplitWiresHorVer(NLLTrackContext& ctx) {
+    ctx.vertical_fired_wires.clear();
+    ctx.horizontal_fired_wires.clear();
+    for (auto& wire : ctx.fired_wires) {
+        if (wire.hor == 0) {
+            ctx.vertical_fired_wires.push_back(&wire);
+        } else if (wire.hor == 1) {
+            ctx.horizontal_fired_wires.push_back(&wire);
         }
     }
 }
@@ -487,19 +571,31 @@ Parameter CreateParam(std::string name,
     return p;
 }
 
-void GetTrackFirstGuess(Circle& circle, Line2D& line){
+void PrintFitResults(const MinuitFitInfos& fit_infos){
+    std::lock_guard<std::mutex> lock(log_mutex);
+    std::cout << fit_infos.Auxiliary_name
+              << " : status " << fit_infos.TMinuitFinalStatus
+              << ", iterations " << fit_infos.NIterations
+              << ", chi2 " << fit_infos.MinValue << "\n";
+    for(const auto& p : fit_infos.fitted_parameters){
+        std::cout << p.name << " = " << p.value << " +/- " << p.error
+                  << (p.fixed_in_fit ? " (fixed)" : "") << "\n";
+    }
+}
+
+void GetTrackFirstGuess(const NLLTrackContext& ctx, Circle& circle, Line2D& line){
     /*
         First Guess for particle trajectory is give by a fit of the 
         wires coordinates (circle fit in the ZY bending plane and
         linear fit on the XZ plane)
     */
     LOG("i", "Track First Guess : fitting wire coordinates on XZ PLANE");
-    line = RecoUtils::WiresLinearFit(vertical_fired_wires);
+    line = RecoUtils::WiresLinearFit(ctx.vertical_fired_wires);
     LOG("R", TString::Format("first guess : Slope (m) = %f, Intercept (q) =  %f", 
                             line.m(), line.q()).Data());
 
     LOG("i", "Track First Guess : fitting wire coordinates on ZY PLANE");
-    circle = RecoUtils::WiresCircleFit(horizontal_fired_wires);
+    circle = RecoUtils::WiresCircleFit(ctx.horizontal_fired_wires);
     LOG("R", TString::Format("first guess : Center = (%f, %f), R =  %f", 
                             circle.center_x(), circle.center_y(), circle.R()).Data());
     
@@ -530,19 +626,21 @@ dg_wire FindClosestZWire(const dg_wire& input_wire,
     return closest;
 }
 
-double GetMissingCoordinate(dg_wire& horizontal_wire, const Line2D& track_guess){
+double GetMissingCoordinate(const NLLTrackContext&, dg_wire& horizontal_wire, const Line2D& track_guess){
     // get horizontal wire x coordinate from line first guess
     return track_guess.GetXFromY(horizontal_wire.z);
 }
 
-double GetMissingCoordinate(dg_wire& vertical_wire, const Circle& track_guess){
+double GetMissingCoordinate(const NLLTrackContext& ctx, dg_wire& vertical_wire, const Circle& track_guess){
     // get vertical wire y coordinate from circle first guess
-    // circle intersect the vertical wire in two points
-    double y1 = track_guess.GetUpperSemiCircle()->Eval(vertical_wire.z);
-    double y2 = track_guess.GetLowerSemiCircle()->Eval(vertical_wire.z);
+    // circle intersect the vertical wire in two points (nan if it does not)
+    double dz = vertical_wire.z - track_guess.center_x();
+    double dy = sqrt(track_guess.R() * track_guess.R() - dz * dz);
+    double y1 = track_guess.center_y() + dy;
+    double y2 = track_guess.center_y() - dy;
     // to decide which one of the two is the one we are looking for
     // consider the closest horizontal fired wires
-    dg_wire closest_horizontal = FindClosestZWire(vertical_wire, horizontal_fired_wires);
+    dg_wire closest_horizontal = FindClosestZWire(vertical_wire, ctx.horizontal_fired_wires);
     if(fabs(closest_horizontal.y - y1) < fabs(closest_horizontal.y - y2)){
         return y1;
     }else{
@@ -551,7 +649,7 @@ double GetMissingCoordinate(dg_wire& vertical_wire, const Circle& track_guess){
 }
 
 template<typename T>
-void TDC2ImpactPar(dg_wire& wire, const T& track_guess){
+void TDC2ImpactPar(const NLLTrackContext& ctx, dg_wire& wire, const T& track_guess){
     /*
         Covert the measure TDC into a impact
         parameter (distance track - wire) that
@@ -570,14 +668,14 @@ void TDC2ImpactPar(dg_wire& wire, const T& track_guess){
         the closest (vertical / horizontal) fired wire in space.
     */
         if(wire.hor==true){ // horizontal
-            double x_coordinate = GetMissingCoordinate(wire, track_guess);
+            double x_coordinate = GetMissingCoordinate(ctx, wire, track_guess);
             if(std::isnan(x_coordinate)) x_coordinate = wire.y;
             TVector3 signal_origin_on_wire = {x_coordinate, wire.y, wire.z};
             wire.missing_coordinate = x_coordinate;
             Line wire_line = RecoUtils::GetLineFromWire(wire);
             wire.signal_time_measured = (signal_origin_on_wire - wire_line.GetLineUpperLimit()).Mag() / sand_reco::stt::v_signal_inwire;
         }else{ // vertical
-            double y_coordinate = GetMissingCoordinate(wire, track_guess);
+            double y_coordinate = GetMissingCoordinate(ctx, wire, track_guess);
             if(std::isnan(y_coordinate)) y_coordinate = wire.y; 
             TVector3 signal_origin_on_wire = {wire.x, y_coordinate, wire.z};
             wire.missing_coordinate = y_coordinate;
@@ -589,7 +687,7 @@ void TDC2ImpactPar(dg_wire& wire, const T& track_guess){
 }
 
 template<typename T>
-void TDC2DriftDistance(std::vector<dg_wire*>& fired_wires, const T& first_guess){
+void TDC2DriftDistance(const NLLTrackContext& ctx, std::vector<dg_wire*>& fired_wires, const T& first_guess){
     /*
         Convert the observed TDC into a drift distance
         for each fired_wires. Store the infos in the wire
@@ -600,11 +698,10 @@ void TDC2DriftDistance(std::vector<dg_wire*>& fired_wires, const T& first_guess)
     */
    for (auto& wire : fired_wires)
    {
-        TDC2ImpactPar(*wire, first_guess);
+        TDC2ImpactPar(ctx, *wire, first_guess);
         if(_DEBUG_){
-            std::cout << "wire id " << wire->did << " is horizontal : " << wire->hor <<"\n";
-            LOG("R", TString::Format("SIGNAL time: true %f, measured %f", wire->signal_time, wire->signal_time_measured).Data());
-            std::cout << "\n";
+            LOG("R", TString::Format("wire id %ld is horizontal : %d, SIGNAL time: true %f, measured %f",
+                                     wire->did, wire->hor, wire->signal_time, wire->signal_time_measured).Data());
         }
    }
 }
@@ -664,35 +761,8 @@ double GetImpactParamiterCircle(Circle c, const dg_wire& wire){
     return  c.Distance2Point(wire_center);
 }
 
-double FunctorNLL_Circle(const double* p){
-    
-    double zc = p[0];
-    double yc = p[1];
-    double R = p[2];
-
-    double nll         = 0.;
-    const double sigma = 0.2; // 200 mu_m = 0.2 mm
-
-    Circle c(zc, yc, R);
-
-    double i = 1;
-    for(auto& wire : horizontal_fired_wires){
-
-        // r_estimated = impact parameter estimated as distance sin function - wire
-        double r_estimated = GetImpactParamiterCircle(c, *wire);
-
-        // r_observed = impact parameter from the observed tdc
-        double r_observed = wire->drift_time_measured * sand_reco::stt::v_drift;
-
-        nll += (r_estimated - r_observed) * (r_estimated - r_observed) / (sigma * sigma);
-
-        i++;
-    }
-    // return nll/(horizontal_fired_wires.size());
-    return nll;
-}
-
-Circle FitZYDriftCircles(Circle& first_guess,
+Circle FitZYDriftCircles(NLLTrackContext& ctx,
+                      Circle& first_guess,
                       MinuitFitInfos& fit_infos){
     /*
         Fit observed TDCs on ZY plane with a Circle.
@@ -703,45 +773,29 @@ Circle FitZYDriftCircles(Circle& first_guess,
     double zc = first_guess.center_x();
     double yc = first_guess.center_y();
     double R = first_guess.R();
- 
-    ROOT::Math::Functor functor(&FunctorNLL_Circle, 3);
-    
-    ROOT::Math::Minimizer* minimizer = ROOT::Math::Factory::CreateMinimizer("Minuit", "Migrad");
-
-    minimizer->SetFunction(functor);
-
-    // zc
-    minimizer->SetVariable(0, "zc", zc, 5);
-    // yc
-    minimizer->SetVariable(1, "yc", yc, 5);
-    // R
-    minimizer->SetVariable(2, "R", R, 200); // 200 mm -> 35 MeV difference
 
-    // minimization settings
-    if(_DEBUG_) minimizer->SetPrintLevel(4);
+    SANDRecoDriftCircleModel model(ctx.horizontal_fired_wires, DRIFT_RADIUS_SIGMA);
+    std::vector<double> pars = {zc, yc, R};
+    SANDRecoLeastSquaresResult result;
 
-    // start minimization
-    minimizer->Minimize();
+    ctx.fitter->ReleaseParameters();
+    ctx.fitter->Minimize(model, pars, result);
 
-    // retrieve result of the minimization and errors
-    const double* pars = minimizer->X();
-    const double* parsErrors = minimizer->Errors();
-    
     // fill output object fit_infos
-    Parameter center_z = CreateParam("zc", 0, false, zc, pars[0], parsErrors[0]);
-    Parameter center_y = CreateParam("yc", 1, false, yc, pars[1], parsErrors[1]);
-    Parameter radius   = CreateParam("R", 2, false, R, pars[2], parsErrors[2]);
+    Parameter center_z = CreateParam("zc", 0, false, zc, pars[0], result.errors[0]);
+    Parameter center_y = CreateParam("yc", 1, false, yc, pars[1], result.errors[1]);
+    Parameter radius   = CreateParam("R", 2, false, R, pars[2], result.errors[2]);
     fit_infos.Auxiliary_name = "Circular_fit_ZY";
     fit_infos.fitted_parameters = {center_z, center_y, radius};
-    fit_infos.TMinuitFinalStatus = minimizer->Status();
-    fit_infos.NIterations = minimizer->NIterations();
-    fit_infos.MinValue = minimizer->MinValue();
+    fit_infos.TMinuitFinalStatus = result.status;
+    fit_infos.NIterations = result.n_iterations;
+    fit_infos.MinValue = result.chi2;
 
     // track from final fit
     Circle c_reco(center_z.value, center_y.value, radius.value);
 
     // print results of the minimization
-    minimizer->PrintResults();
+    if(_DEBUG_) PrintFitResults(fit_infos);
 
     return c_reco;
 }
@@ -749,38 +803,8 @@ Circle FitZYDriftCircles(Circle& first_guess,
 // FITTING ON XZ PLANE_________________________________________________________
 
 // linear fit
-double FunctorNLL_Line(const double* p){
-    double m = p[0];
-    double q = p[1];
-
-    Line2D test_line(m, q);
-    
-    double nll = 0.;
-    double sigma = 0.2;
-    double i = 1;
-
-    for(auto& wire : vertical_fired_wires){
-
-        // r_estimated = impact parameter estimated as 2D distance line - wire
-        double r_estimated = test_line.Distance2Point({wire->x, wire->z});
-
-        // r_observed = impact parameter from the observed tdc
-        double r_observed = wire->drift_time_measured * sand_reco::stt::v_drift;
-
-        nll += (r_estimated - r_observed) * (r_estimated - r_observed) / (sigma * sigma);
-
-        // std::cout << "wire id : " << wire.did
-        //           << ", impact par : true " << wire.drift_time * sand_reco::stt::v_drift
-        //           << ", r_observed : " << r_observed
-        //           << ", r_estimated : " << r_estimated << "\n";
-
-        i++;
-    }
-    // return sqrt(nll)/(vertical_fired_wires.size());
-    return nll;
-}
-
-Line2D FitXZDriftCircles(Line2D first_guess,
+Line2D FitXZDriftCircles(NLLTrackContext& ctx,
+                       Line2D first_guess,
                        MinuitFitInfos& fit_infos){
     /*
         Fit observed TDCs on XZ plane with a Line.
@@ -789,164 +813,48 @@ Line2D FitXZDriftCircles(Line2D first_guess,
         - m : slope
         - q : intercept
     */
-    ROOT::Math::Functor functor(&FunctorNLL_Line, 2);
-
-    ROOT::Math::Minimizer* minimizer = ROOT::Math::Factory::CreateMinimizer("Minuit", "Migrad");
-
-    minimizer->SetFunction(functor);
-
-    minimizer->SetVariable(0, "m", first_guess.m(), 0.001);
-    
-    minimizer->SetVariable(1, "q", first_guess.q(), 1.);
-
-    // minimization settings
-    if(_DEBUG_) minimizer->SetPrintLevel(4);
+    SANDRecoDriftLineModel model(ctx.vertical_fired_wires, DRIFT_RADIUS_SIGMA);
+    std::vector<double> pars = {first_guess.m(), first_guess.q()};
+    SANDRecoLeastSquaresResult result;
 
-    minimizer->Minimize();
-
-    // retrieve result of the minimization and errors
-    const double* pars = minimizer->X();
-    const double* parsErrors = minimizer->Errors();
+    ctx.fitter->ReleaseParameters();
+    ctx.fitter->Minimize(model, pars, result);
 
     // fill output object fit_infos
-    Parameter m = CreateParam("m", 0, false, first_guess.m(), pars[0], parsErrors[0]);
-    Parameter q = CreateParam("q", 1, false, first_guess.q(), pars[1], parsErrors[1]);
+    Parameter m = CreateParam("m", 0, false, first_guess.m(), pars[0], result.errors[0]);
+    Parameter q = CreateParam("q", 1, false, first_guess.q(), pars[1], result.errors[1]);
     fit_infos.Auxiliary_name = "Linear_fit_XZ";
     fit_infos.fitted_parameters = {m, q};
-    fit_infos.TMinuitFinalStatus = minimizer->Status();
-    fit_infos.NIterations = minimizer->NIterations();
-    fit_infos.MinValue = minimizer->MinValue();
+    fit_infos.TMinuitFinalStatus = result.status;
+    fit_infos.NIterations = result.n_iterations;
+    fit_infos.MinValue = result.chi2;
     
     // print results of the minimization
-    minimizer->PrintResults();
+    if(_DEBUG_) PrintFitResults(fit_infos);
 
     Line2D l(m.value, q.value);
 
     return l;
 }
 
-void FitDriftCircles(Circle& circle_ZY_plane, 
+void FitDriftCircles(NLLTrackContext& ctx,
+                     Circle& circle_ZY_plane, 
                      Line2D& line_XZ_plane,
                      MinuitFitInfos& fit_ZY,
                      MinuitFitInfos& fit_XZ
                      ){
         LOG("ii", "Fitting drift circles starting from first guess");
-        std::cout << blue << "\n";
-        line_XZ_plane = FitXZDriftCircles(line_XZ_plane, fit_XZ);
-        std::cout << def << "\n";
+        line_XZ_plane = FitXZDriftCircles(ctx, line_XZ_plane, fit_XZ);
             
         LOG("ii", "Fitting drift circles starting from first guess");
-        std::cout << blue << "\n";
-        circle_ZY_plane = FitZYDriftCircles(circle_ZY_plane, fit_ZY);
-        std::cout << def << "\n";
+        circle_ZY_plane = FitZYDriftCircles(ctx, circle_ZY_plane, fit_ZY);
 }
 
 // sin fit
 
-double GetImpactParameterSin(TF1* TestSin, const dg_wire& wire){
-    /*
-        Use numerical Newton method to find distance sin function to a point 
-        in (wire.x, wire.z) in 2D space. TestSin = A sin(Bx + C) + D, functi
-        on to be minimized is the euclidian distance: 
-        - D(x) = (x_wire - x)**2 + (z_wire - TestSin(x))**2
-        - D_prime(x) = 2(x_wire - x) + 2(z_wire - TestSin(x))*TestSin_prime(x)
-        - TestSin_prime(x) = A B cos(Bx + C)
-    */
-    double x_wire = wire.x;
-    double z_wire = wire.z;
-    double x_min = TestSin->GetXmin();
-    double x_max = TestSin->GetXmax();
-
-    TF1* TestSin_prime = new TF1("TestSin_prime", "[0]*[1]*cos([1]*x + [2])", x_min, x_max);
-
-    TestSin_prime->SetParameters(TestSin->GetParameter(0),
-                                 TestSin->GetParameter(1),
-                                 TestSin->GetParameter(2));
-    /*
-        distance_sin_wire : distance curve TestSin to a point (x_wire, z_wire)
-        - variable x (space coordinate)
-        - parameter (x_wire, z_wire) coordinate f the wire to which the distace
-          is calculated
-    */
-    TF1* distance_sin_wire = new TF1("distance_sin_wire", [&](double*x, double *par){
-        double sin_at_x = TestSin->Eval(x[0]);
-        double x_w = par[0];
-        double z_w = par[1];
-        return sqrt((x[0] - x_w)*(x[0] - x_w) + (sin_at_x - z_w)*(sin_at_x - z_w));
-    }, x_min, x_max, 2);              
-    distance_sin_wire->SetParameters(x_wire, z_wire);
-    
-    // derivative of distance
-    TF1* distance_sin_wire_prime = new TF1("distance_sin_wire_prime", [&](double*x, double *par){
-        double distance = distance_sin_wire->Eval(x[0]);
-        double sin_at_x = TestSin->Eval(x[0]);
-        double derivative_at_x = TestSin_prime->Eval(x[0]);
-        double x_w = par[0];
-        double z_w = par[1];
-        return 1./(2.*distance)*(2*(x[0] - x_w) + 2*(sin_at_x - z_w)*derivative_at_x);
-    }, x_min, x_max, 2);
-    distance_sin_wire_prime->SetParameters(x_wire, z_wire);
-
-    double x_guess = x_wire;
-
-    double impact_par = RecoUtils::NewtonRaphson2D(distance_sin_wire, distance_sin_wire_prime, x_guess, 0.2, 1000);
-
-    return impact_par;
-}
-
-double NLL_Sin(TF1* TestSin, std::vector<dg_wire*>& wires){
-    /*
-        run over vertical fired wires
-        - get impact par from TDC
-        - compare it with wire - track 
-          min distance
-    */
-    static int calls   = 0;
-    double nll         = 0.;
-    const double sigma = 0.2; // 200 mu_m = 0.2 mm
-    
-    for(auto& wire : wires){
-
-        // r_estimated = impact parameter estimated as distance sin function - wire
-        double r_estimated = GetImpactParameterSin(TestSin, *wire);
-
-        // r_observed = impact parameter from the observed tdc
-        double r_observed = wire->drift_time_measured * sand_reco::stt::v_drift;
-
-        nll += (r_estimated - r_observed) * (r_estimated - r_observed) / (sigma * sigma);
-
-        // std::cout << "impact par : true " << wire.drift_time * sand_reco::stt::v_drift
-        //                << ", r_observed : " << r_observed
-        //                << ", r_estimated : " << r_estimated << "\n";
-
-    }
-    calls ++;
-    return sqrt(nll)/wires.size();
-}
-
-double FunctorNLL_Sin(const double* p){
-    
-    double amplitude = p[0];
-    double frequency = p[1];
-    double phase = p[2];
-    double offset = p[3];
-    // fixed
-    double x_min = p[4];
-    double x_max = p[5];
-    
-    TF1* TestSin = new TF1("TestSin", "[0]*sin([1]*x + [2]) + [3]", x_min, x_max);
-    
-    // Set initial parameters for the fit
-    TestSin->SetParameters(amplitude, 
-                           frequency, 
-                           phase, 
-                           offset);
-    
-    return NLL_Sin(TestSin, vertical_fired_wires);
-}
-
-TF1* GetRecoXZTrack(TF1* first_guess,
-                    MinuitFitInfos& fit_infos){
+std::vector<double> GetRecoXZTrack(NLLTrackContext& ctx,
+                                   TF1* first_guess,
+                                   MinuitFitInfos& fit_infos){
     /*
         Fit TDCs on XZ plane using a sin function.
         Parameter of the sin function:
@@ -955,64 +863,43 @@ TF1* GetRecoXZTrack(TF1* first_guess,
         - B: frequency
         - C: phase
         - D: offset
+        returns the fitted {A, B, C, D}
     */
     double amplitude = first_guess->GetParameter(0); // A
     double frequency = first_guess->GetParameter(1); // B
     double phase = first_guess->GetParameter(2); // C
     double offset = first_guess->GetParameter(3); // D
-    double x_min = first_guess->GetXmin();
-    double x_max = first_guess->GetXmax();
-    
-    ROOT::Math::Functor functor(&FunctorNLL_Sin, 6);                  
 
-    ROOT::Math::Minimizer* minimizer = ROOT::Math::Factory::CreateMinimizer("Minuit", "Migrad");
-
-    minimizer->SetFunction(functor);
+    SANDRecoDriftSinModel model(ctx.vertical_fired_wires, DRIFT_RADIUS_SIGMA);
+    std::vector<double> pars = {amplitude, frequency, phase, offset};
+    SANDRecoLeastSquaresResult result;
 
+    ctx.fitter->ReleaseParameters();
     // A
-    minimizer->SetLimitedVariable(0, "A", amplitude, amplitude*0.01, amplitude*0.8,amplitude*1.2);
+    ctx.fitter->SetParameterLimits(0, std::min(amplitude*0.8, amplitude*1.2), std::max(amplitude*0.8, amplitude*1.2));
     // B
-    minimizer->SetLimitedVariable(1, "B", frequency, frequency*0.01, frequency*0.8, frequency*1.2);
-    // C
-    // minimizer->SetLimitedVariable(2, "C", phase, phase*0.01, phase*0.8, phase*1.2);
-    // D
-    // minimizer->SetLimitedVariable(3, "D", offset, offset*0.01, offset*0.8, offset*1.2);
-
-    // extreme [x_min, x_max]
-    minimizer->SetFixedVariable(2, "C", phase);
-    minimizer->SetFixedVariable(3, "D", offset);
-    minimizer->SetFixedVariable(4, "x_min", x_min);
-    minimizer->SetFixedVariable(5, "x_max", x_max);
-
-    // minimization settings
-    if(_DEBUG_) minimizer->SetPrintLevel(4);
-
-    // start minimization
-    minimizer->Minimize();
-
-    // retrieve result of the minimization and errors
-    const double* pars = minimizer->X();
-    const double* parsErrors = minimizer->Errors();
+    ctx.fitter->SetParameterLimits(1, std::min(frequency*0.8, frequency*1.2), std::max(frequency*0.8, frequency*1.2));
+    // C, D
+    ctx.fitter->FixParameter(2);
+    ctx.fitter->FixParameter(3);
+
+    ctx.fitter->Minimize(model, pars, result);
     
     // fill output object fit_infos
-    Parameter A = CreateParam("amplitude", 0, false, amplitude, pars[0], parsErrors[0]);                                        
-    Parameter B = CreateParam("frequency", 1, false, frequency, pars[1], parsErrors[1]);                                        
-    Parameter C = CreateParam("phase", 2, true, phase, pars[2], parsErrors[2]);                                        
-    Parameter D = CreateParam("offset", 3, true, offset, pars[3], parsErrors[3]);
+    Parameter A = CreateParam("amplitude", 0, false, amplitude, pars[0], result.errors[0]);                                        
+    Parameter B = CreateParam("frequency", 1, false, frequency, pars[1], result.errors[1]);                                        
+    Parameter C = CreateParam("phase", 2, true, phase, pars[2], result.errors[2]);                                        
+    Parameter D = CreateParam("offset", 3, true, offset, pars[3], result.errors[3]);
     fit_infos.Auxiliary_name = "Sin_Fit_XZ";                          
     fit_infos.fitted_parameters = {A,B,C,D};                          
-    fit_infos.TMinuitFinalStatus = minimizer->Status();
-    fit_infos.NIterations = minimizer->NIterations();
-    fit_infos.MinValue = minimizer->MinValue();
-
-    // final fit
-    TF1* SinFinalFit = new TF1("SinFinalFit", "[0]*sin([1]*x + [2]) + [3]", x_min, x_max);
-    SinFinalFit->SetParameters(pars[0],pars[1],pars[2],pars[3]);
+    fit_infos.TMinuitFinalStatus = result.status;
+    fit_infos.NIterations = result.n_iterations;
+    fit_infos.MinValue = result.chi2;
 
     // print results of the minimization
-    minimizer->PrintResults();
+    if(_DEBUG_) PrintFitResults(fit_infos);
 
-    return SinFinalFit;
+    return pars;
 }
 
 // Helix Reconstruct(Circle FittedCircle,
@@ -1065,11 +952,212 @@ TF1* GetRecoXZTrack(TF1* first_guess,
 //     return h;
 // }
 
+// TRACK FIT___________________________________________________________________
+
+bool IsChargedPrimary(const TG4Trajectory& trj){
+    if(trj.GetParentId() != -1) return false;
+    auto particle = TDatabasePDG::Instance()->GetParticle(trj.GetPDGCode());
+    return particle && particle->Charge() != 0.;
+}
+
+std::unique_ptr<NLLTrackContext> CreateTrackContext(unsigned int event_index,
+                                                    const TG4Trajectory& trj){
+    std::unique_ptr<NLLTrackContext> ctx(new NLLTrackContext);
+    ctx->edep_event_index = event_index;
+    ctx->track_id = trj.GetTrackId();
+    ctx->trajectory = trj;
+    return ctx;
+}
+
+void SelectTrackWires(NLLTrackContext& ctx, const std::vector<dg_wire*>& selected_wires){
+    /*
+        copy the wires selected for the track in its context
+        and check that there are enough of them
+    */
+    ctx.fired_wires.clear();
+    for(auto wire : selected_wires) ctx.fired_wires.push_back(*wire);
+
+    LOG("I", "Group wires in vertical and horizontal");
+    SplitWiresHorVer(ctx);
+
+    LOG("ii", TString::Format("number of horizontal fired wires for trackid %d : %d", ctx.track_id, (int)ctx.horizontal_fired_wires.size()).Data());
+    LOG("ii", TString::Format("number of vertical fired wires for trackid %d : %d", ctx.track_id, (int)ctx.vertical_fired_wires.size()).Data());
+    LOG("I", "Check event with enough hits");
+
+    ctx.KeepThisEvent = PassSelectionNofHits(ctx.horizontal_fired_wires.size(), ctx.vertical_fired_wires.size());
+
+    if(!ctx.KeepThisEvent){
+        LOG("W", TString::Format("Skipping Event %d track %d not enough hits", ctx.edep_event_index, ctx.track_id).Data());
+    }
+}
+
+std::vector<std::unique_ptr<NLLTrackContext>> PrepareEventTracks(unsigned int i){
+    /*
+        Select the tracks to be fitted in the current event
+        (evEdep, RecoUtils::event_digits). Runs on the main thread:
+        the navigation of the geometry is not thread safe.
+        An event with no track to fit gives a single context
+        with KeepThisEvent = false, to keep the 1-1 correspondence
+        with the input file
+    */
+    std::vector<std::unique_ptr<NLLTrackContext>> tracks;
+
+    auto muon_trj = evEdep->Trajectories[0];
+
+    auto vertex = evEdep->Primaries[0];
+
+    bool KeepThisEvent = false;
+
+    const char* reason = "not in fiducial volume";
+
+    if(FIT_ALL_PRIMARIES){
+        // Discard event if no charged primary is found
+        KeepThisEvent = std::any_of(evEdep->Trajectories.begin(), evEdep->Trajectories.end(), IsChargedPrimary);
+        if (!KeepThisEvent) reason = "no charged primary";
+        // Discard event if vertex not in fiducial volume
+        if (KeepThisEvent) KeepThisEvent = IsInFiducialVolume("mm", vertex.GetPosition().X(), vertex.GetPosition().Y(), vertex.GetPosition().Z());
+    }else{
+        // Discard event if no muon(antimuon) is found
+        KeepThisEvent = (abs(muon_trj.GetPDGCode()) != 13);
+
+        if (!KeepThisEvent) {
+            // Discard event if vertex not in fiducial volume
+            KeepThisEvent = IsInFiducialVolume("mm", vertex.GetPosition().X(), vertex.GetPosition().Y(), vertex.GetPosition().Z());
+        }
+        if (abs(muon_trj.GetPDGCode()) != 13) reason = "first trajectory is neither mu- nor mu+";
+    }
+
+    if (!KeepThisEvent) {
+        LOG("W", TString::Format("Skipping Event %d, reason: %s", i, reason).Data());
+        tracks.push_back(CreateTrackContext(i, muon_trj));
+        return tracks;
+    }
+
+    LOG("I", "Reading Fired Wires From File Digit");
+    std::cout << "Event total fired wires : " << RecoUtils::event_digits->size() << "\n";
+
+    if(USE_HOUGH_PATTERN_RECO){
+        LOG("I", "HOUGH PATTERN RECO : Select fired_wires of the largest candidate");
+        tracks.push_back(CreateTrackContext(i, muon_trj));
+        SelectTrackWires(*tracks.back(), SelectWireFiredByHough(*RecoUtils::event_digits));
+    }else{
+        for(const auto& trj : evEdep->Trajectories){
+            if(FIT_ALL_PRIMARIES ? !IsChargedPrimary(trj) : (&trj != &evEdep->Trajectories[0])) continue;
+            LOG("I", TString::Format("FAKE PATTERN RECO : Select fired_wires that belongs to %d", trj.GetTrackId()).Data());
+            tracks.push_back(CreateTrackContext(i, trj));
+            SelectTrackWires(*tracks.back(), SelectWireFiredByTraj(*evEdep, *RecoUtils::event_digits, trj.GetTrackId()));
+        }
+    }
+
+    // the true helix needs the PDG database, not thread safe
+    for(auto& ctx : tracks){
+        if(ctx->KeepThisEvent) ctx->reco_object.true_helix = Helix(ctx->trajectory);
+    }
+
+    return tracks;
+}
+
+void FitTrack(NLLTrackContext& ctx){
+    /*
+        Fit the drift radii of the wires of the track
+        and fill ctx.reco_object. Only touches the context,
+        so that several tracks can be fitted concurrently
+    */
+    if(!ctx.KeepThisEvent) return;
+
+    const auto& trj = ctx.trajectory;
+
+    const Helix& true_helix = ctx.reco_object.true_helix;
+
+    LOG("I", TString::Format("event number : %d, track id : %d, momentum : (%f, %f, %f, %f)",
+                            ctx.edep_event_index, ctx.track_id,
+                            trj.GetInitialMomentum().X(), trj.GetInitialMomentum().Y(),
+                            trj.GetInitialMomentum().Z(), trj.GetInitialMomentum().T()).Data());
+
+    {
+        std::lock_guard<std::mutex> lock(log_mutex);
+        true_helix.PrintHelixPars();
+    }
+
+    MinuitFitInfos fit_XZ, fit_ZY;
+    Circle circle_ZY_plane;
+    Line2D line_XZ_plane;
+    TVector3 particle_momentum;
+    Helix reco_helix;
+    std::vector<double> drift_radii(ctx.fired_wires.size(), -1.);
+
+    LOG("I", "Track First Guess (seed): fitting wire coordinates");
+    GetTrackFirstGuess(ctx, circle_ZY_plane, line_XZ_plane);
+
+    /*
+        The drift radii depend on the signal propagation time along the
+        wire, which is taken from the track of the other view: iterate
+        until the radii are stable
+    */
+    for (auto cycle = 0u; cycle < MAX_NOF_FIT_CYCLES; cycle++)
+    {
+        LOG("I", TString::Format("---------> Starting cycle number %d ", cycle).Data());
+
+        LOG("I","Converting measured TDC into drift time ");
+        
+        LOG("ii","Converting horizontal wires");
+        TDC2DriftDistance<Line2D>(ctx, ctx.horizontal_fired_wires, line_XZ_plane);
+        
+        LOG("ii","Converting vertical wires");
+        TDC2DriftDistance<Circle>(ctx, ctx.vertical_fired_wires, circle_ZY_plane);
+        
+        double deviation = 0.;
+        for(const auto& w : ctx.fired_wires) deviation += (w.signal_time - w.signal_time_measured);
+        LOG("W", TString::Format("Sum (t_signal_propagation_time_true - t_signal_propagation_time_assumed) %f [ns]", deviation).Data());
+
+        double max_radius_change = 0.;
+        for(auto j = 0u; j < ctx.fired_wires.size(); j++){
+            double radius = ctx.fired_wires[j].drift_time_measured * sand_reco::stt::v_drift;
+            max_radius_change = std::max(max_radius_change, fabs(radius - drift_radii[j]));
+            drift_radii[j] = radius;
+        }
+        if(cycle > 0 && max_radius_change < DRIFT_RADIUS_TOLERANCE){
+            LOG("ii", TString::Format("Drift radii stable after %d cycles", cycle).Data());
+            break;
+        }
+
+        LOG("I", "Fitting drift circles with a NLL method");
+        FitDriftCircles(ctx, circle_ZY_plane, line_XZ_plane, fit_ZY, fit_XZ);
+    }
+
+    LOG("I","Reconstructed Helix from Circle (ZY plane) and Line (XZ plane)");
+    /*
+        To be modified in the future:
+            pass vertex and helicity of the true helix
+    */
+    reco_helix = RecoUtils::GetHelixFromCircleLine(circle_ZY_plane, line_XZ_plane, true_helix, particle_momentum);
+    {
+        std::lock_guard<std::mutex> lock(log_mutex);
+        reco_helix.PrintHelixPars();
+    }
+    LOG("R", TString::Format("True momentum: (%f, %f, %f)",  trj.GetInitialMomentum().X(),  trj.GetInitialMomentum().Y(),  trj.GetInitialMomentum().Z()));
+    LOG("R", TString::Format("Reco momentum: (%f, %f, %f)", particle_momentum.X(), particle_momentum.Y(), particle_momentum.Z()));
+
+    auto& reco_object = ctx.reco_object;
+    reco_object.fit_infos_xz = fit_XZ;
+    reco_object.fit_infos_zy = fit_ZY;
+    reco_object.fired_wires = ctx.fired_wires;
+    reco_object.pt_true = true_helix.R()*0.3*0.6;
+    reco_object.reco_helix = reco_helix;
+    reco_object.pt_reco = reco_helix.R()*0.3*0.6;
+    reco_object.p_true = {trj.GetInitialMomentum().X(),
+                          trj.GetInitialMomentum().Y(), 
+                          trj.GetInitialMomentum().Z()};
+    reco_object.p_reco = {particle_momentum.X(), 
+                          particle_momentum.Y(), 
+                          particle_momentum.Z()};
+}
+
 // MAIN________________________________________________________________________
 
 int main(int argc, char* argv[]){
 
-    if (argc < 3 || argc > 10) {
+    if (argc < 3 || argc > 13) {
         help_input();
     return -1;
     }
@@ -1146,6 +1234,17 @@ int main(int argc, char* argv[]){
                 std::cerr << e.what() << '\n';
                 return 1;
             }
+        }else if(opt.CompareTo("--hough")==0){
+            USE_HOUGH_PATTERN_RECO = true;
+        }else if(opt.CompareTo("--all_primaries")==0){
+            FIT_ALL_PRIMARIES = true;
+        }else if(opt.CompareTo("-j")==0){
+            int nthreads = (index + 1 < argc) ? atoi(argv[++index]) : 0;
+            if(nthreads < 1){
+                std::cout << "invalid number of threads\n";
+                return 1;
+            }
+            NOF_THREADS = nthreads;
         }else if(opt.CompareTo("--debug")==0){
             _DEBUG_ = true;
         }else{
@@ -1176,12 +1275,12 @@ int main(int argc, char* argv[]){
     
     RecoObject reco_object;
     
-    std::vector<dg_wire> fired_wires;
-    
     std::vector<dg_wire> wire_infos;
 
     unsigned int edep_event_index;
 
+    int track_id;
+
     bool KeepThisEvent = false;
 
     std::string fEDepInputStr = fEDepInput;
@@ -1198,6 +1297,8 @@ int main(int argc, char* argv[]){
     tout.Branch("digit_file_input", &fDigitInputStr);
     
     tout.Branch("edep_event_index", &edep_event_index, "edep_event_index/i");
+
+    tout.Branch("track_id", &track_id, "track_id/I");
     
     tout.Branch("KeepThisEvent", &KeepThisEvent, "KeepThisEvent/O");
     
@@ -1206,150 +1307,147 @@ int main(int argc, char* argv[]){
     LOG("I","Loading wires lookup table");
     ReadWireInfos(fWireInfo, wire_infos);
 
-    // int j = 0;
-    for(auto i=0u; i < tEdep->GetEntries(); i++)
-    {
-        // if(i != 33u && i != 111u && i != 127u && i != 166u) continue;
-        LOG("I", TString::Format("********************** PROCESSING EDEP EVENT %d **********************", i).Data());
-        
-        KeepThisEvent = false;
-        
-        edep_event_index = i;
-        
-        RecoUtils::event_digits->clear();
-        
-        tEdep->GetEntry(i);
-        tDigit->GetEntry(i);
-
-        // tDigit->GetEntry(j);
-        // j++;
-
-        auto muon_trj = evEdep->Trajectories[0];
-
-        // Discard event if no muon(antimuon) is found
-        KeepThisEvent = (abs(muon_trj.GetPDGCode()) != 13);
+    // one entry per track, in the (event, track) order of the input
+    auto fill_output = [&](NLLTrackContext& ctx) {
+        edep_event_index = ctx.edep_event_index;
+        track_id = ctx.track_id;
+        KeepThisEvent = ctx.KeepThisEvent;
+        std::swap(reco_object, ctx.reco_object);
+        tout.Fill();
+    };
 
-        if (!KeepThisEvent) {
-            // Discard event if vertex not in fiducial volume
-            auto vertex = evEdep->Primaries[0];
-            KeepThisEvent = IsInFiducialVolume("mm", vertex.GetPosition().X(), vertex.GetPosition().Y(), vertex.GetPosition().Z());
-        }
+    if(NOF_THREADS == 1){
+        SANDRecoLeastSquares fitter;
 
-        if (!KeepThisEvent) {
-            LOG("W", TString::Format("Skipping Event %d, reason: %s", i,
-                (abs(muon_trj.GetPDGCode()) != 13) ? "first trajectory is neither mu- nor mu+" : "not in fiducial volume").Data());
-            tout.Fill();  // Fill empty event to keep 1-1 correspondence with input file
-            continue;
+        for(auto i=0u; i < tEdep->GetEntries(); i++)
+        {
+            LOG("I", TString::Format("********************** PROCESSING EDEP EVENT %d **********************", i).Data());
+            
+            RecoUtils::event_digits->clear();
+            
+            tEdep->GetEntry(i);
+            tDigit->GetEntry(i);
+
+            for(auto& ctx : PrepareEventTracks(i)){
+                ctx->fitter = &fitter;
+                FitTrack(*ctx);
+                LOG("I", "Filling output tree");
+                fill_output(*ctx);
+            }
         }
+    }else{
+        /*
+            the main thread reads the events and selects the tracks, 
+            the pool fits them and the main thread writes them back
+            in the input order
+        */
+        ROOT::EnableThreadSafety();
+
+        const unsigned int max_in_flight = NOF_THREADS * MAX_TRACKS_IN_FLIGHT_PER_THREAD;
+
+        std::mutex mtx;
+        std::condition_variable cv_task;   // a track has been queued
+        std::condition_variable cv_done;   // a track has been fitted
+        std::map<unsigned int, std::unique_ptr<NLLTrackContext>> queued;
+        std::map<unsigned int, std::unique_ptr<NLLTrackContext>> done;
+        unsigned int next_task = 0;
+        unsigned int nof_tasks = 0;
+        unsigned int next_to_write = 0;
+        bool all_queued = false;
+        bool failed = false;
+
+        auto worker = [&]() {
+            SANDRecoLeastSquares fitter;
+
+            while (true) {
+                std::unique_ptr<NLLTrackContext> ctx;
+                unsigned int k;
+                {
+                    std::unique_lock<std::mutex> lock(mtx);
+                    cv_task.wait(lock, [&] {
+                        return failed || next_task < nof_tasks || all_queued;
+                    });
+                    if (failed || next_task >= nof_tasks) break;
+                    k = next_task++;
+                    auto it = queued.find(k);
+                    ctx = std::move(it->second);
+                    queued.erase(it);
+                }
 
-        event_drift_hits = evEdep->SegmentDetectors["DriftVolume"];
-
-        std::cout << "event number : " << i 
-                  << ", muon_momentum : (" 
-                  << muon_trj.GetInitialMomentum().X() << ", " 
-                  << muon_trj.GetInitialMomentum().Y() << ", " 
-                  << muon_trj.GetInitialMomentum().Z() << ", " 
-                  << muon_trj.GetInitialMomentum().T() << ")\n";
-        LOG("","\n");
-
-        Helix true_helix(muon_trj);
-
-        LOG("I", "Reading Fired Wires From File Digit");
-        std::cout << "Event total fired wires : " << RecoUtils::event_digits->size() << "\n";
-
-        // clear vectors from previous events
-        horizontal_fired_wires.clear();
-        vertical_fired_wires.clear();
-
-        LOG("I", TString::Format("FAKE PATTERN RECO : Select fired_wires that belongs to %d", muon_trj.GetTrackId()).Data());
-        std::vector<dg_wire*> selected_wires = SelectWireFiredByTraj(muon_trj.GetTrackId());
-
-        LOG("I", "Group wires in vertical and horizontal");
-        SplitWiresHorVer(selected_wires);
+                try {
+                    ctx->fitter = &fitter;
+                    FitTrack(*ctx);
+                    ctx->fitter = nullptr;
+                } catch (...) {
+                    LOG("W", TString::Format("fit of event %d track %d failed", ctx->edep_event_index, ctx->track_id).Data());
+                    std::lock_guard<std::mutex> lock(mtx);
+                    failed = true;
+                    cv_task.notify_all();
+                    cv_done.notify_all();
+                    break;
+                }
 
-        LOG("ii", TString::Format("number of horizontal fired wires for trackid %d : %d", muon_trj.GetTrackId(), (int)horizontal_fired_wires.size()).Data());
-        LOG("ii", TString::Format("number of vertical fired wires for trackid %d : %d", muon_trj.GetTrackId(), (int)vertical_fired_wires.size()).Data());
-        LOG("I", "Check event with enough hits");
-        
-        KeepThisEvent = PassSelectionNofHits(horizontal_fired_wires.size(), vertical_fired_wires.size());
-        
-        if(!KeepThisEvent){
-            LOG("W", TString::Format("Skipping Event %d not enough hits", i).Data());
-            tout.Fill();
-            continue;
+                std::lock_guard<std::mutex> lock(mtx);
+                done[k] = std::move(ctx);
+                cv_done.notify_all();
+            }
         };
 
-        true_helix.PrintHelixPars();
+        // write the next track in order, false if the pool failed
+        auto write_next = [&]() {
+            std::unique_ptr<NLLTrackContext> ctx;
+            {
+                std::unique_lock<std::mutex> lock(mtx);
+                cv_done.wait(lock, [&] { return failed || done.count(next_to_write) > 0; });
+                if (failed) return false;
+                auto it = done.find(next_to_write);
+                ctx = std::move(it->second);
+                done.erase(it);
+                next_to_write++;
+            }
+            fill_output(*ctx);
+            return true;
+        };
 
-        MinuitFitInfos fit_XZ, fit_ZY;
-        Circle circle_ZY_plane;
-        Line2D line_XZ_plane;
-        TVector3 particle_momentum;
-        Helix reco_helix;
-        unsigned int nof_cycles = 3;
+        std::vector<std::thread> workers;
+        for (auto k = 0u; k < NOF_THREADS; k++) workers.emplace_back(worker);
 
-        LOG("I", "Track First Guess (seed): fitting wire coordinates");
-        GetTrackFirstGuess(circle_ZY_plane, line_XZ_plane);
+        // false as soon as the pool fails
+        bool writing = true;
 
-        for (auto cycle = 0u; cycle < nof_cycles; cycle++)
+        for(auto i=0u; i < tEdep->GetEntries() && writing; i++)
         {
-            LOG("I", TString::Format("---------> Starting cycle number %d ", cycle).Data());
-
-            LOG("I","Converting measured TDC into drift time ");
+            LOG("I", TString::Format("********************** PROCESSING EDEP EVENT %d **********************", i).Data());
             
-            LOG("ii","Converting horizontal wires");
-            TDC2DriftDistance<Line2D>(horizontal_fired_wires, line_XZ_plane);
+            RecoUtils::event_digits->clear();
             
-            LOG("ii","Converting vertical wires");
-            TDC2DriftDistance<Circle>(vertical_fired_wires, circle_ZY_plane);
-            
-            double deviation = 0.;
-            for(auto w : selected_wires) deviation += (w->signal_time - w->signal_time_measured);
-            LOG("W", TString::Format("Sum (t_signal_propagation_time_true - t_signal_propagation_time_assumed) %f [ns]", deviation).Data());
-                                
-            LOG("I", "Creating drift circles from drift time");
-            std::vector<Circle> vertical_drift_circles = Wire2DriftCircle(vertical_fired_wires);
-            std::vector<Circle> horizontal_drift_circles = Wire2DriftCircle(horizontal_fired_wires);
-
-            LOG("I", "Fitting drift circles with a NLL method");
-            FitDriftCircles(circle_ZY_plane, line_XZ_plane, fit_ZY, fit_XZ);
+            tEdep->GetEntry(i);
+            tDigit->GetEntry(i);
+
+            for(auto& ctx : PrepareEventTracks(i)){
+                // bound the memory: write the fitted tracks before queueing new ones
+                while (writing && nof_tasks >= next_to_write + max_in_flight) writing = write_next();
+                if (!writing) break;
+
+                std::lock_guard<std::mutex> lock(mtx);
+                queued[nof_tasks++] = std::move(ctx);
+                cv_task.notify_one();
+            }
         }
 
-        LOG("I","Reconstructed Helix from Circle (ZY plane) and Line (XZ plane)");
-        // reco_helix.Setx0(true_helix.x0());
-        // reco_helix.Seth(true_helix.h());
-        /*
-            To be modified in the future:
-                pass vertex and helicity of the true helix
-        */
-        reco_helix = RecoUtils::GetHelixFromCircleLine(circle_ZY_plane, line_XZ_plane, true_helix, particle_momentum);
-        reco_helix.PrintHelixPars();                                     
-        LOG("R", TString::Format("True momentum: (%f, %f, %f)",  muon_trj.GetInitialMomentum().X(),  muon_trj.GetInitialMomentum().Y(),  muon_trj.GetInitialMomentum().Z()));
-        LOG("R", TString::Format("Reco momentum: (%f, %f, %f)", particle_momentum.X(), particle_momentum.Y(), particle_momentum.Z()));
-        // throw "";
-        LOG("I", "Filling output tree");
-        reco_object.fit_infos_xz = fit_XZ;
-        reco_object.fit_infos_zy = fit_ZY;
-
-        // reco_object.fired_wires = *RecoUtils::event_digits;
-        reco_object.fired_wires.clear();
-        for(dg_wire* wire : selected_wires){
-            reco_object.fired_wires.push_back(*wire);
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            all_queued = true;
+            cv_task.notify_all();
         }
 
-        reco_object.true_helix = true_helix;
-        reco_object.pt_true = true_helix.R()*0.3*0.6;
-        reco_object.reco_helix = reco_helix;
-        reco_object.pt_reco = reco_helix.R()*0.3*0.6;
-        reco_object.p_true = {muon_trj.GetInitialMomentum().X(),
-                              muon_trj.GetInitialMomentum().Y(), 
-                              muon_trj.GetInitialMomentum().Z()};
-        reco_object.p_reco = {particle_momentum.X(), 
-                              particle_momentum.Y(), 
-                              particle_momentum.Z()};
-        
-        tout.Fill();
+        while (writing && next_to_write < nof_tasks) writing = write_next();
+
+        for (auto& w : workers) w.join();
+
+        if (failed) return 1;
     }
+
     fout.cd();
 
     tout.Write();
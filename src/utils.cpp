@@ -1,6 +1,7 @@
 #include "utils.h"
 #include "struct.h"
 #include "transf.h"
+#include "SANDCounterRNG.h"
 
 #include "TG4Event.h"
 #include "TG4HitSegment.h"
@@ -17,7 +18,7 @@
 
 namespace sand_reco
 {
-std::map<int, double> t0;
+thread_local std::map<int, double> t0;
 namespace ecal
 {
 double acquisition::fixed_thresh_pe = 3.;
@@ -792,9 +793,10 @@ void sand_reco::fluka::init(TGeoManager* geo)
 
 // evaluated t0 for each tube assuming the beam bucket that
 // produced the neutrino is known
-void sand_reco::stt::initT0(TG4Event* ev, SANDGeoManager& geo)
+void sand_reco::stt::initT0(TG4Event* ev, SANDGeoManager& geo,
+                            unsigned int run_seed, int event_index)
 {
-  TRandom3 r(0);
+  SANDCounterRNG r(run_seed, event_index, SANDCounterRNG::Subsystem::kT0, 0);
   t0.clear();
 
   double t0_beam = ev->Primaries[0].Position.T() -
@@ -813,9 +815,10 @@ void sand_reco::stt::initT0(TG4Event* ev, SANDGeoManager& geo)
   }
 }
 
-void sand_reco::chamber::initT0(TG4Event* ev, SANDGeoManager& geo)
+void sand_reco::chamber::initT0(TG4Event* ev, SANDGeoManager& geo,
+                                unsigned int run_seed, int event_index)
 {
-  TRandom3 r(0);
+  SANDCounterRNG r(run_seed, event_index, SANDCounterRNG::Subsystem::kT0, 0);
   t0.clear();
 
   double t0_beam = ev->Primaries[0].Position.T() -
@@ -0,0 +1,162 @@
+/*
+    Closest approach of a helix to a wire: the closed form seed + Newton
+    refinement of RecoUtils::GetMinImpactParameter(s) against a brute force
+    scan followed by a golden section search.
+    Random helices, wires along x and y placed a few mm from a point of
+    the helix on the branch selected by the wire plane (phi in [0, pi]).
+    The scan covers that branch only: a flat helix crosses the plane of a
+    vertical wire twice and the other crossing may be closer.
+    Returns 1 if any distance differs by more than the tolerance
+*/
+
+#include <TRandom3.h>
+
+#include <cmath>
+#include <iostream>
+#include <vector>
+
+#include "SANDRecoUtils.h"
+
+TGeoManager* geo = nullptr;
+std::vector<dg_wire>* RecoUtils::event_digits = nullptr;
+
+namespace
+{
+const double tolerance = 1E-9;  // mm
+
+double PointLineDistance(const TVector3& p, const dg_wire& wire)
+{
+    TVector3 d = wire.hor ? TVector3(1., 0., 0.) : TVector3(0., 1., 0.);
+    TVector3 w = p - TVector3(wire.x, wire.y, wire.z);
+    return (w - w.Dot(d) * d).Mag();
+}
+
+// minimum distance for s in [s_begin, s_end]
+double BruteForceDistance(const Helix& helix, const dg_wire& wire, double s_begin,
+                          double s_end)
+{
+    auto distance = [&](double s) {
+        return PointLineDistance(helix.GetPointAt(s), wire);
+    };
+
+    const int n_samples = 20000;
+    const double step = (s_end - s_begin) / n_samples;
+
+    double s_best = s_begin;
+    double d_best = distance(s_begin);
+    for (int i = 1; i <= n_samples; i++) {
+        double s = s_begin + i * step;
+        double d = distance(s);
+        if (d < d_best) {
+            d_best = d;
+            s_best = s;
+        }
+    }
+
+    // golden section in the neighbouring samples
+    const double g = 0.5 * (sqrt(5.) - 1.);
+    double a = s_best - step;
+    double b = s_best + step;
+    double c = b - g * (b - a);
+    double e = a + g * (b - a);
+    double dc = distance(c);
+    double de = distance(e);
+    for (int i = 0; i < 200; i++) {
+        if (dc < de) {
+            b = e;
+            e = c;
+            de = dc;
+            c = b - g * (b - a);
+            dc = distance(c);
+        } else {
+            a = c;
+            c = e;
+            dc = de;
+            e = a + g * (b - a);
+            de = distance(e);
+        }
+    }
+    return std::min(d_best, std::min(dc, de));
+}
+}  // namespace
+
+int main()
+{
+    TRandom3 rnd(12345);
+
+    const int n_helices = 200;
+    const int n_wires = 20;
+
+    int n_checked = 0;
+    int n_failed = 0;
+    double max_difference = 0.;
+
+    for (int i = 0; i < n_helices; i++) {
+        double R = rnd.Uniform(500., 10000.);
+        double dip = rnd.Uniform(-1., 1.);
+        double Phi0 = rnd.Uniform(0., 2. * M_PI);
+        int h = rnd.Rndm() < 0.5 ? 1 : -1;
+        TVector3 x0(rnd.Uniform(-1000., 1000.), rnd.Uniform(-1000., 1000.),
+                    rnd.Uniform(22000., 26000.));
+        Helix helix(R, dip, Phi0, h, x0);
+        const double k = h * cos(dip) / R;
+
+        const double s_branch_begin = (0. - Phi0) / k;
+        const double s_branch_end = (M_PI - Phi0) / k;
+
+        std::vector<dg_wire> wires;
+        for (int j = 0; j < n_wires; j++) {
+            // point of the helix with phi on the acos branch used to
+            // select the turn: phi in (0, pi)
+            double phi = rnd.Uniform(0.05, M_PI - 0.05);
+            double s = (phi - Phi0) / k;
+            TVector3 p = helix.GetPointAt(s);
+
+            dg_wire wire;
+            wire.hor = rnd.Rndm() < 0.5;
+            wire.wire_length = 4000.;
+            TVector3 d = wire.hor ? TVector3(1., 0., 0.) : TVector3(0., 1., 0.);
+            // offset perpendicular to the wire, shift along it
+            TVector3 offset(rnd.Gaus(), rnd.Gaus(), rnd.Gaus());
+            offset -= offset.Dot(d) * d;
+            offset.SetMag(rnd.Uniform(0., 5.));
+            TVector3 center = p + offset + rnd.Uniform(-1000., 1000.) * d;
+            wire.x = center.X();
+            wire.y = center.Y();
+            wire.z = center.Z();
+
+            wires.push_back(wire);
+        }
+
+        WireArrays wire_arrays;
+        for (const auto& wire : wires) wire_arrays.Add(wire);
+        std::vector<double> impact_parameters(wires.size());
+        std::vector<double> s(wires.size());
+        std::vector<double> t(wires.size());
+        RecoUtils::GetMinImpactParameters(helix, wire_arrays, impact_parameters.data(),
+                                          s.data(), t.data());
+
+        for (auto j = 0u; j < wires.size(); j++) {
+            double reference = BruteForceDistance(helix, wires[j], s_branch_begin,
+                                                  s_branch_end);
+            double single = RecoUtils::GetMinImpactParameter(
+                helix, RecoUtils::GetLineFromWire(wires[j]));
+
+            double difference = std::max(fabs(impact_parameters[j] - reference),
+                                         fabs(single - reference));
+            max_difference = std::max(max_difference, difference);
+            n_checked++;
+            if (difference > tolerance) {
+                n_failed++;
+                std::cout << "helix " << i << " wire " << j
+                          << ": brute force " << reference
+                          << " batch " << impact_parameters[j]
+                          << " single " << single << "\n";
+            }
+        }
+    }
+
+    std::cout << "wires checked: " << n_checked << ", failed: " << n_failed
+              << ", max difference: " << max_difference << " mm\n";
+    return n_failed == 0 ? 0 : 1;
+}
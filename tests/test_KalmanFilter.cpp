@@ -0,0 +1,165 @@
+/*
+    Kalman filter + smoother of SANDTrackerKalmanFilter on simulated
+    tracks: stations of one horizontal and one vertical wire every 20 mm,
+    measurements smeared with the position error of the filter.
+    - straight tracks (q/p = 0) without material
+    - 1 GeV tracks in the field with the multiple scattering of the planes
+      simulated with the same model used by the filter
+    The pulls of the smoothed state at the first station must have mean 0
+    and RMS 1, and chi2 / ndf must be close to 1.
+    Also checks the transport jacobian against central differences.
+    Returns 1 if any check fails
+*/
+
+#include <TRandom3.h>
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <vector>
+
+#include "SANDTrackerKalmanFilter.h"
+
+namespace
+{
+const int n_tracks = 500;
+const int n_stations = 60;
+const double station_pitch = 20.;  // mm
+
+const double max_pull_mean = 0.15;
+const double max_pull_rms_difference = 0.15;
+const double max_chi2_ndf_difference = 0.1;
+const double max_jacobian_difference = 1E-6;
+
+const char* parameter_names[5] = {"x", "y", "tx", "ty", "q/p"};
+
+// slopes kicked by a draw from the multiple scattering covariance
+void Scatter(const SANDTrackerKalmanFilter& kf, SANDTrackerKFStateVector& state,
+             TRandom3& rnd)
+{
+  auto q = kf.MultipleScattering(state);
+  if (!(q(2, 2) > 0.)) return;
+  double l11 = sqrt(q(2, 2));
+  double l21 = q(3, 2) / l11;
+  double l22 = sqrt(std::max(q(3, 3) - l21 * l21, 0.));
+  double g1 = rnd.Gaus(0., 1.);
+  double g2 = rnd.Gaus(0., 1.);
+  state(2) += l11 * g1;
+  state(3) += l21 * g1 + l22 * g2;
+}
+
+bool CheckPulls(const char* name, bool curved)
+{
+  TRandom3 rnd(curved ? 2 : 1);
+
+  SANDTrackerKalmanFilter kf;
+  if (!curved) kf.SetPlaneThicknessInX0(0.);
+  const double sigma = 2. * SANDTrackerUtils::GetTubeRadius() / sqrt(12.);
+  kf.SetSigmaPosition(sigma);
+
+  double sum[5] = {0.}, sum2[5] = {0.};
+  double chi2_ndf = 0.;
+  int n_fitted = 0;
+
+  for (int t = 0; t < n_tracks; t++) {
+    SANDTrackerKFStateVector truth;
+    truth(0) = rnd.Uniform(-500., 500.);
+    truth(1) = rnd.Uniform(-500., 500.);
+    truth(2) = rnd.Uniform(-0.3, 0.3);
+    truth(3) = rnd.Uniform(-0.3, 0.3);
+    truth(4) = curved ? (rnd.Rndm() < 0.5 ? -1. : 1.) : 0.;
+
+    std::vector<dg_wire> digits;
+    SANDTrackerKFStateVector state = truth;
+    for (int i = 0; i < n_stations; i++) {
+      double z = i * station_pitch;
+      if (i > 0) {
+        if (curved) Scatter(kf, state, rnd);
+        SANDTrackerKFStateVector next;
+        kf.Propagate(state, z - station_pitch, z, next);
+        state = next;
+      }
+      for (int view = 0; view < 2; view++) {
+        dg_wire digit;
+        digit.hor = view == 1;
+        digit.z = z;
+        digit.x = digit.hor ? state(0) : state(0) + rnd.Gaus(0., sigma);
+        digit.y = digit.hor ? state(1) + rnd.Gaus(0., sigma) : state(1);
+        digits.push_back(digit);
+      }
+    }
+
+    SANDTrackerKFResult result;
+    if (!kf.Fit(digits, result)) continue;
+    n_fitted++;
+
+    const auto& first = result.sites.front();
+    for (int i = 0; i < 5; i++) {
+      double pull = (first.smoothed(i) - truth(i)) / sqrt(first.smoothed_cov(i, i));
+      sum[i] += pull;
+      sum2[i] += pull * pull;
+    }
+    chi2_ndf += result.chi2 / result.ndf;
+  }
+
+  bool ok = n_fitted == n_tracks;
+  std::cout << name << ": " << n_fitted << "/" << n_tracks << " fitted";
+  chi2_ndf /= n_fitted;
+  std::cout << ", chi2/ndf " << chi2_ndf << "\n";
+  if (fabs(chi2_ndf - 1.) > max_chi2_ndf_difference) ok = false;
+
+  for (int i = 0; i < 5; i++) {
+    double mean = sum[i] / n_fitted;
+    double rms = sqrt(sum2[i] / n_fitted - mean * mean);
+    std::cout << "  pull " << parameter_names[i] << ": mean " << mean << " rms "
+              << rms << "\n";
+    if (fabs(mean) > max_pull_mean || fabs(rms - 1.) > max_pull_rms_difference)
+      ok = false;
+  }
+  return ok;
+}
+
+bool CheckJacobian()
+{
+  SANDTrackerKalmanFilter kf;
+  SANDTrackerKFStateVector state;
+  state(0) = 100.;
+  state(1) = -200.;
+  state(2) = 0.2;
+  state(3) = -0.4;
+  state(4) = 2.;
+  const double dz = 300.;
+
+  SANDTrackerKFStateVector out;
+  SANDTrackerKFStateCovarianceMatrix jacobian;
+  kf.Propagate(state, 0., dz, out, &jacobian);
+
+  double max_difference = 0.;
+  for (int j = 0; j < 5; j++) {
+    double eps = 1E-6;
+    SANDTrackerKFStateVector up = state, down = state;
+    up(j) += eps;
+    down(j) -= eps;
+    SANDTrackerKFStateVector out_up, out_down;
+    kf.Propagate(up, 0., dz, out_up);
+    kf.Propagate(down, 0., dz, out_down);
+    for (int i = 0; i < 5; i++) {
+      double numeric = (out_up(i) - out_down(i)) / (2. * eps);
+      max_difference = std::max(max_difference, fabs(numeric - jacobian(i, j)) /
+                                                    std::max(1., fabs(numeric)));
+    }
+  }
+  std::cout << "jacobian: max relative difference from central differences "
+            << max_difference << "\n";
+  return max_difference < max_jacobian_difference;
+}
+}  // namespace
+
+int main()
+{
+  bool ok = CheckJacobian();
+  ok = CheckPulls("straight tracks", false) && ok;
+  ok = CheckPulls("1 GeV tracks with scattering", true) && ok;
+  std::cout << (ok ? "OK" : "FAILED") << "\n";
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,393 @@
+/*
+    Clustering of tracker digits on a synthetic geometry (no TGeo): planes
+    of horizontal wires every 10 mm in z, cells 10 mm x 10 mm, so that a
+    cell is adjacent to the cells next to it in its plane and in the
+    following plane.
+    - cellular automaton: two straight tracks and some noise, each track
+      must be one cluster with its cells from upstream, the noise none
+    - connected subsets of 3 cells on random fired cells: the same sets as
+      the algorithm they replaced (ordered sequences of adjacent cells,
+      repeated sets removed), each set exactly once
+    - connected components of the tracks and of the noise
+    - cluster ids numbered from 0 in each container, and the last digit
+      of a repeated digit id
+    - nearest cluster of a position, and std::out_of_range if the
+      container has no clusters
+    - clusters of a plane: nearest clusters of random positions at once
+      VS one at a time VS a scan of all the digits, -1 for a plane
+      without clusters
+    Returns 1 if any check fails
+*/
+
+#include <TRandom3.h>
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <set>
+#include <stdexcept>
+#include <vector>
+
+#include "SANDGeoManager.h"
+#include "SANDTrackerClusterCollection.h"
+#include "SANDTrackerDigitCollection.h"
+
+namespace
+{
+const int n_planes = 10;
+const int n_cells = 40;
+const double pitch = 10.;        // mm, in y and in z
+const double wire_length = 2000.;  // mm
+
+double CellY(int cell)
+{
+  return (cell - 0.5 * (n_cells - 1)) * pitch;
+}
+
+unsigned long CellId(int plane, int cell)
+{
+  return SANDGeoManager::encode_cell_id(SANDTrackerPlaneID(plane + 1),
+                                        SANDTrackerCellID(cell))();
+}
+
+void BuildGeometry(SANDGeoManager& sand_geo)
+{
+  std::vector<SANDTrackerPlane> planes;
+  for (int i = 0; i < n_planes; i++) {
+    SANDTrackerPlane plane(SANDTrackerPlaneID(i + 1), SANDTrackerPlaneID(i));
+    plane.setRotation(0.);
+    plane.setPosition(TVector3(0., 0., i * pitch));
+    plane.setDimension(TVector3(wire_length, n_cells * pitch, pitch));
+    plane.computePlaneVertices();
+    plane.computeMaxTransversePosition();
+
+    for (int k = 0; k < n_cells; k++) {
+      auto id = CellId(i, k);
+      TVector3 first(-0.5 * wire_length, CellY(k), i * pitch);
+      TVector3 second(0.5 * wire_length, CellY(k), i * pitch);
+      SANDWireInfo w;
+      w.id(SANDWireID(id));
+      w.type(SANDWireInfo::Type::kSignal);
+      w.orientation(SANDWireInfo::Orient::kHorizontal);
+      w.readout_end(SANDWireInfo::ReadoutEnd::kFirst);
+      w.setPoint(first);
+      w.setPoint(second);
+      w.center((first + second) * 0.5);
+      w.length(wire_length);
+      plane.addCell(CellY(k), SANDTrackerCell(SANDTrackerCellID(id), w, pitch, pitch, 0.05));
+    }
+    planes.push_back(plane);
+  }
+  sand_geo.init_tracker(planes);
+}
+
+SANDTrackerDigit MakeDigit(int plane, int cell)
+{
+  SANDTrackerDigit d;
+  d.det = "DriftChamber";
+  d.did = CellId(plane, cell);
+  d.x = 0.;
+  d.y = CellY(cell);
+  d.z = plane * pitch;
+  d.hor = true;
+  d.wire_length = wire_length;
+  return d;
+}
+
+// cells fired by a straight track y = y0 + slope * z, one per plane
+std::vector<SANDTrackerDigit> TrackDigits(double y0, double slope)
+{
+  std::vector<SANDTrackerDigit> digits;
+  for (int i = 0; i < n_planes; i++) {
+    int cell = std::lround((y0 + slope * i * pitch) / pitch + 0.5 * (n_cells - 1));
+    digits.push_back(MakeDigit(i, std::min(std::max(cell, 0), n_cells - 1)));
+  }
+  return digits;
+}
+
+bool CheckCellularAutomaton(const SANDGeoManager& sand_geo)
+{
+  auto track1 = TrackDigits(-150., 0.3);
+  auto track2 = TrackDigits(100., -0.25);
+
+  // the tracks and a two cell segment of noise, shorter than a cluster
+  std::vector<SANDTrackerDigit> digits;
+  digits.insert(digits.end(), track1.begin(), track1.end());
+  digits.push_back(MakeDigit(4, 20));
+  digits.push_back(MakeDigit(5, 20));
+  digits.insert(digits.end(), track2.begin(), track2.end());
+
+  SANDTrackerDigitCollection digit_collection(digits, &sand_geo);
+  SANDTrackerClusterCollection clusters(
+      &sand_geo, digit_collection,
+      SANDTrackerClusterCollection::ClusteringMethod::kCellularAutomaton);
+  const auto& container = *clusters.GetContainers().at(0);
+
+  bool ok = container.GetClusters().size() == 2;
+  std::cout << "cellular automaton: " << container.GetClusters().size()
+            << " clusters\n";
+
+  for (const auto* track : {&track1, &track2}) {
+    std::vector<SANDTrackerDigitID> expected;
+    for (const auto& d : *track) expected.push_back(SANDTrackerDigitID(d.did));
+    auto found = std::count_if(
+        container.GetClusters().begin(), container.GetClusters().end(),
+        [&expected](const SANDTrackerCluster& c) { return c.GetDigits() == expected; });
+    if (found != 1) {
+      std::cout << "  track starting at cell " << expected.front()()
+                << " found " << found << " times\n";
+      ok = false;
+    }
+  }
+
+  // the first digit of track 1 is the closest one
+  const auto& nearest = container.GetNearestCluster(0., CellY(0) + 5.);
+  if (nearest.GetDigits().front()() != static_cast<unsigned long>(track1.front().did)) {
+    std::cout << "  wrong nearest cluster\n";
+    ok = false;
+  }
+  return ok;
+}
+
+using CellSet = std::vector<unsigned long>;
+
+// digit ids of a cluster, sorted
+CellSet SortedDigits(const SANDTrackerCluster& cluster)
+{
+  CellSet ids;
+  for (const auto& d : cluster.GetDigits()) ids.push_back(d());
+  std::sort(ids.begin(), ids.end());
+  return ids;
+}
+
+// connected sets of cluster_size cells as found before the ESU
+// enumeration: sequences grown with any fired cell adjacent to a cell of
+// the sequence, the permutations of the sets already found dropped
+void GrowSequences(const SANDGeoManager& sand_geo, const std::vector<unsigned long>& fired,
+                   std::vector<unsigned long>& sequence, unsigned int cluster_size,
+                   std::vector<CellSet>& sets)
+{
+  for (auto next : fired) {
+    if (std::find(sequence.begin(), sequence.end(), next) != sequence.end()) continue;
+    bool adjacent = false;
+    for (auto id : sequence)
+      adjacent = adjacent || sand_geo.get_cell_info(SANDTrackerCellID(id))
+                                 ->second.isAdjacent(SANDTrackerCellID(next));
+    if (!adjacent) continue;
+
+    sequence.push_back(next);
+    if (sequence.size() == cluster_size) {
+      bool found = false;
+      for (const auto& set : sets)
+        found = found || std::is_permutation(sequence.begin(), sequence.end(), set.begin());
+      if (!found) {
+        sets.push_back(sequence);
+        std::sort(sets.back().begin(), sets.back().end());
+      }
+    } else {
+      GrowSequences(sand_geo, fired, sequence, cluster_size, sets);
+    }
+    sequence.pop_back();
+  }
+}
+
+bool CheckConnectedSubsets(const SANDGeoManager& sand_geo)
+{
+  TRandom3 rnd(3);
+  const int n_events = 20;
+  const double fired_probability = 0.35;
+
+  bool ok = true;
+  std::size_t n_sets = 0;
+  for (int e = 0; e < n_events; e++) {
+    // random cells in a corner of the planes
+    std::vector<SANDTrackerDigit> digits;
+    for (int i = 0; i < 6; i++)
+      for (int k = 10; k < 20; k++)
+        if (rnd.Rndm() < fired_probability) digits.push_back(MakeDigit(i, k));
+
+    SANDTrackerDigitCollection digit_collection(digits, &sand_geo);
+    SANDTrackerClusterCollection clusters(
+        &sand_geo, digit_collection,
+        SANDTrackerClusterCollection::ClusteringMethod::kCellAdjacency);
+
+    std::vector<CellSet> found;
+    for (const auto& cluster : clusters.GetContainers().at(0)->GetClusters())
+      found.push_back(SortedDigits(cluster));
+    std::set<CellSet> unique_found(found.begin(), found.end());
+
+    std::vector<unsigned long> fired;
+    for (const auto& d : digits) fired.push_back(d.did);
+    std::sort(fired.begin(), fired.end());
+    std::vector<CellSet> reference;
+    for (auto root : fired) {
+      std::vector<unsigned long> sequence{root};
+      GrowSequences(sand_geo, fired, sequence, 3, reference);
+    }
+    std::set<CellSet> unique_reference(reference.begin(), reference.end());
+
+    n_sets += reference.size();
+    if (unique_found.size() != found.size() || unique_found != unique_reference) {
+      std::cout << "  event " << e << ": " << found.size() << " clusters ("
+                << unique_found.size() << " different), " << reference.size()
+                << " expected\n";
+      ok = false;
+    }
+  }
+  std::cout << "connected subsets: " << n_sets << " sets of 3 cells in "
+            << n_events << " events\n";
+  return ok;
+}
+
+bool CheckConnectedComponents(const SANDGeoManager& sand_geo)
+{
+  auto track1 = TrackDigits(-150., 0.3);
+  auto track2 = TrackDigits(100., -0.25);
+  std::vector<SANDTrackerDigit> noise{MakeDigit(4, 20), MakeDigit(5, 21)};
+  std::vector<SANDTrackerDigit> single{MakeDigit(8, 15)};
+
+  std::vector<SANDTrackerDigit> digits;
+  for (const auto* group : {&track1, &noise, &single, &track2})
+    digits.insert(digits.end(), group->begin(), group->end());
+
+  SANDTrackerDigitCollection digit_collection(digits, &sand_geo);
+  SANDTrackerClusterCollection clusters(
+      &sand_geo, digit_collection,
+      SANDTrackerClusterCollection::ClusteringMethod::kConnectedComponents);
+  const auto& found = clusters.GetContainers().at(0)->GetClusters();
+
+  bool ok = found.size() == 4;
+  std::cout << "connected components: " << found.size() << " clusters\n";
+  for (const auto* group : {&track1, &noise, &single, &track2}) {
+    CellSet expected;
+    for (const auto& d : *group) expected.push_back(d.did);
+    std::sort(expected.begin(), expected.end());
+    auto n = std::count_if(found.begin(), found.end(), [&expected](const SANDTrackerCluster& c) {
+      return SortedDigits(c) == expected;
+    });
+    if (n != 1) {
+      std::cout << "  component of " << expected.size() << " cells found " << n
+                << " times\n";
+      ok = false;
+    }
+  }
+  return ok;
+}
+
+bool CheckIds(const SANDGeoManager& sand_geo)
+{
+  auto digits = TrackDigits(-150., 0.3);
+  auto repeated = MakeDigit(0, 5);
+  repeated.tdc = 42.;
+  digits.push_back(repeated);
+
+  SANDTrackerDigitCollection digit_collection(digits, &sand_geo);
+  bool ok = digit_collection.GetDigit(SANDTrackerDigitID(repeated.did)).tdc == repeated.tdc;
+
+  // two collections of the same digits: the ids restart in each container
+  for (int c = 0; c < 2; c++) {
+    SANDTrackerClusterCollection clusters(
+        &sand_geo, digit_collection,
+        SANDTrackerClusterCollection::ClusteringMethod::kCellAdjacency);
+    const auto& found = clusters.GetContainers().at(0)->GetClusters();
+    for (auto i = 0u; i < found.size(); i++) ok = ok && found[i].GetId()() == i;
+  }
+  std::cout << "cluster and digit ids " << (ok ? "ok" : "wrong") << "\n";
+  return ok;
+}
+
+bool CheckNearestClustersInPlane(const SANDGeoManager& sand_geo)
+{
+  TRandom3 rnd(5);
+  const int n_events = 10;
+  const int n_positions = 500;
+  const double fired_probability = 0.2;
+
+  std::vector<double> x(n_positions), y(n_positions);
+  std::vector<int> nearest(n_positions);
+
+  bool ok = true;
+  int n_checked = 0;
+  for (int e = 0; e < n_events; e++) {
+    std::vector<SANDTrackerDigit> digits;
+    for (int i = 0; i < n_planes; i++)
+      for (int k = 0; k < n_cells; k++)
+        if (rnd.Rndm() < fired_probability) digits.push_back(MakeDigit(i, k));
+
+    SANDTrackerDigitCollection digit_collection(digits, &sand_geo);
+    SANDTrackerClusterCollection clusters(
+        &sand_geo, digit_collection,
+        SANDTrackerClusterCollection::ClusteringMethod::kProximityInPlane);
+
+    for (const auto* container : clusters.GetContainers()) {
+      const auto& plane = dynamic_cast<const SANDTrackerClustersInPlane&>(*container);
+      for (int q = 0; q < n_positions; q++) {
+        x[q] = rnd.Uniform(-0.5 * wire_length, 0.5 * wire_length);
+        y[q] = rnd.Uniform(-0.6 * n_cells * pitch, 0.6 * n_cells * pitch);
+      }
+      plane.GetNearestClusters(n_positions, x.data(), y.data(), nearest.data());
+
+      const auto* first = plane.GetClusters().data();
+      for (int q = 0; q < n_positions; q++) {
+        int single = &plane.GetNearestCluster(x[q], y[q]) - first;
+        int scan = &plane.ClustersContainer::GetNearestCluster(x[q], y[q]) - first;
+        n_checked++;
+        if (nearest[q] != single || nearest[q] != scan) {
+          std::cout << "  (" << x[q] << ", " << y[q] << "): batch " << nearest[q]
+                    << ", single " << single << ", scan " << scan << "\n";
+          ok = false;
+        }
+      }
+    }
+  }
+
+  // a plane without clusters
+  std::vector<SANDTrackerDigit> no_digits;
+  SANDTrackerDigitCollection empty_collection(no_digits, &sand_geo);
+  SANDTrackerClustersInPlane empty_plane(&sand_geo, empty_collection,
+                                         SANDTrackerClustersContainerID(3),
+                                         std::vector<SANDTrackerDigitID>());
+  empty_plane.GetNearestClusters(n_positions, x.data(), y.data(), nearest.data());
+  bool empty_ok = std::all_of(nearest.begin(), nearest.end(), [](int c) { return c == -1; });
+
+  std::cout << "nearest clusters in plane: " << n_checked << " positions, plane "
+            << "without clusters " << (empty_ok ? "ok" : "wrong") << "\n";
+  return ok && empty_ok;
+}
+
+bool CheckNoClusters(const SANDGeoManager& sand_geo)
+{
+  std::vector<SANDTrackerDigit> digits{MakeDigit(3, 7)};
+  SANDTrackerDigitCollection digit_collection(digits, &sand_geo);
+  SANDTrackerClusterCollection clusters(
+      &sand_geo, digit_collection,
+      SANDTrackerClusterCollection::ClusteringMethod::kCellularAutomaton);
+  const auto& container = *clusters.GetContainers().at(0);
+
+  bool thrown = false;
+  try {
+    container.GetNearestCluster(0., 0.);
+  } catch (const std::out_of_range&) {
+    thrown = true;
+  }
+  std::cout << "no clusters: " << container.GetClusters().size()
+            << " clusters, nearest cluster "
+            << (thrown ? "throws" : "does not throw") << "\n";
+  return container.GetClusters().empty() && thrown;
+}
+}  // namespace
+
+int main()
+{
+  SANDGeoManager sand_geo;
+  BuildGeometry(sand_geo);
+
+  bool ok = CheckCellularAutomaton(sand_geo);
+  ok = CheckConnectedSubsets(sand_geo) && ok;
+  ok = CheckConnectedComponents(sand_geo) && ok;
+  ok = CheckIds(sand_geo) && ok;
+  ok = CheckNearestClustersInPlane(sand_geo) && ok;
+  ok = CheckNoClusters(sand_geo) && ok;
+  std::cout << (ok ? "OK" : "FAILED") << "\n";
+  return ok ? 0 : 1;
+}